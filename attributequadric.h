@@ -0,0 +1,220 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstddef>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// attributes a quadric can carry: a normal (3) and a texture coordinate (2)
+#define ATTRIBUTE_QUADRIC_MAX 5
+// faces with a Gram determinant below this, relative to their squared edge lengths, get no attribute gradient
+#define ATTRIBUTE_QUADRIC_MIN_GRAM 1e-12f
+
+// Hoppe's memory-efficient quadric ("New quadric metric for simplifying meshes with appearance attributes",
+// 1999) over a position x and n attributes s. Each face adds, weighted by its area,
+//   (n . x + e)^2 + sum_j (g_j . x + d_j - s_j)^2
+// where g_j, d_j interpolate attribute j linearly over the face. Summed, the quadric is
+//   x^T A x + 2 b . x + c - 2 sum_j s_j (g_j . x + d_j) + w sum_j s_j^2
+// which takes 11 + 4n floats rather than the (4 + n)(5 + n) / 2 of Garland and Heckbert's full matrix: the
+// attribute block is w times the identity, so only its scale is stored. 32 floats with the padding, two
+// cache lines, and a sum is eight 4-wide adds.
+struct AttributeQuadric {
+    // upper triangle of A: a00 a01 a02 a11 a12 a22
+    float a[6];
+    float b[3];
+    float c;
+    // summed area, the weight of the attribute block
+    float w;
+    float g[ATTRIBUTE_QUADRIC_MAX][3];
+    float d[ATTRIBUTE_QUADRIC_MAX];
+    float pad;
+
+    AttributeQuadric& operator+=(const AttributeQuadric &other) {
+        float* to = a;
+        const float* from = other.a;
+        for (int i = 0; i < 32; i++) {
+            to[i] += from[i];
+        }
+        return *this;
+    }
+
+    AttributeQuadric& operator*=(float scale) {
+        float* to = a;
+        for (int i = 0; i < 32; i++) {
+            to[i] *= scale;
+        }
+        return *this;
+    }
+};
+
+static_assert(sizeof(AttributeQuadric) == 32 * sizeof(float), "AttributeQuadric must stay two cache lines");
+
+inline AttributeQuadric operator+(AttributeQuadric x, const AttributeQuadric &y) {
+    x += y;
+    return x;
+}
+
+// Quadric of the face (p0, p1, p2) carrying attributes s0, s1, s2 at its corners, count of them each.
+// Degenerate faces add nothing.
+AttributeQuadric faceAttributeQuadric(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, const float* s0, const float* s1,
+                                      const float* s2, int count) {
+    AttributeQuadric q = {};
+    glm::vec3 e1 = p1 - p0, e2 = p2 - p0;
+    glm::vec3 normal = glm::cross(e1, e2);
+    float length = glm::length(normal);
+    if (!(length > 0.0f)) {
+        return q;
+    }
+    float area = 0.5f * length;
+    normal /= length;
+    float offset = -glm::dot(normal, p0);
+
+    glm::vec3 A0 = normal * normal.x, A1 = normal * normal.y, A2 = normal * normal.z;
+    glm::vec3 b = normal * offset;
+    float c = offset * offset;
+
+    // g lies in the plane of the face, g = alpha e1 + beta e2, with g . e1 = s1 - s0 and g . e2 = s2 - s0
+    float e11 = glm::dot(e1, e1), e12 = glm::dot(e1, e2), e22 = glm::dot(e2, e2);
+    float gram = e11 * e22 - e12 * e12;
+    bool solvable = gram > ATTRIBUTE_QUADRIC_MIN_GRAM * e11 * e22;
+    for (int j = 0; j < count; j++) {
+        glm::vec3 g(0.0f);
+        float d = (s0[j] + s1[j] + s2[j]) / 3.0f;
+        if (solvable) {
+            float ds1 = s1[j] - s0[j], ds2 = s2[j] - s0[j];
+            float alpha = (e22 * ds1 - e12 * ds2) / gram;
+            float beta = (e11 * ds2 - e12 * ds1) / gram;
+            g = alpha * e1 + beta * e2;
+            d = s0[j] - glm::dot(g, p0);
+        }
+        A0 += g * g.x;
+        A1 += g * g.y;
+        A2 += g * g.z;
+        b += g * d;
+        c += d * d;
+        q.g[j][0] = area * g.x;
+        q.g[j][1] = area * g.y;
+        q.g[j][2] = area * g.z;
+        q.d[j] = area * d;
+    }
+    q.a[0] = area * A0.x;
+    q.a[1] = area * A0.y;
+    q.a[2] = area * A0.z;
+    q.a[3] = area * A1.y;
+    q.a[4] = area * A1.z;
+    q.a[5] = area * A2.z;
+    q.b[0] = area * b.x;
+    q.b[1] = area * b.y;
+    q.b[2] = area * b.z;
+    q.c = area * c;
+    q.w = area;
+    return q;
+}
+
+// The attributes that minimise q at position x: s_j = (g_j . x + d_j) / w
+void attributeValues(const AttributeQuadric &q, int count, glm::vec3 x, float* s) {
+    for (int j = 0; j < count; j++) {
+        s[j] = q.w > 0.0f ? (q.g[j][0] * x.x + q.g[j][1] * x.y + q.g[j][2] * x.z + q.d[j]) / q.w : 0.0f;
+    }
+}
+
+// Substituting the best attributes leaves a quadric in x alone,
+//   A' = A - sum_j g_j g_j^T / w,  b' = b - sum_j d_j g_j / w,  c' = c - sum_j d_j^2 / w
+// returned in the symmetric mat4 layout of the positional quadrics, so optimalPlacement() and
+// optimalPlacements() solve it as they are.
+glm::mat4 reducedQuadric(const AttributeQuadric &q, int count) {
+    float a[6] = {q.a[0], q.a[1], q.a[2], q.a[3], q.a[4], q.a[5]};
+    float b[3] = {q.b[0], q.b[1], q.b[2]};
+    float c = q.c;
+    if (q.w > 0.0f) {
+        float inverse = 1.0f / q.w;
+        for (int j = 0; j < count; j++) {
+            const float* g = q.g[j];
+            float d = q.d[j] * inverse;
+            a[0] -= g[0] * g[0] * inverse;
+            a[1] -= g[0] * g[1] * inverse;
+            a[2] -= g[0] * g[2] * inverse;
+            a[3] -= g[1] * g[1] * inverse;
+            a[4] -= g[1] * g[2] * inverse;
+            a[5] -= g[2] * g[2] * inverse;
+            b[0] -= g[0] * d;
+            b[1] -= g[1] * d;
+            b[2] -= g[2] * d;
+            c -= q.d[j] * d;
+        }
+    }
+    return glm::mat4(glm::vec4(a[0], a[1], a[2], b[0]),
+                     glm::vec4(a[1], a[3], a[4], b[1]),
+                     glm::vec4(a[2], a[4], a[5], b[2]),
+                     glm::vec4(b[0], b[1], b[2], c));
+}
+
+// reducedQuadric() of the summed vertex quadrics of count edges, the edge quadrics of a collapse pass. With
+// SSE2 a pair is summed four floats at a time and the reduction runs over four edges at once, one per lane.
+void reducedQuadrics(const AttributeQuadric* quadrics, const std::pair<int, int>* edges, size_t count,
+                     int attributes, glm::mat4* reduced) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    alignas(16) AttributeQuadric sums[4];
+    for (; i + 4 <= count; i += 4) {
+        for (int k = 0; k < 4; k++) {
+            const float* from1 = quadrics[edges[i + k].first].a;
+            const float* from2 = quadrics[edges[i + k].second].a;
+            float* to = sums[k].a;
+            for (int f = 0; f < 32; f += 4) {
+                _mm_store_ps(to + f, _mm_add_ps(_mm_loadu_ps(from1 + f), _mm_loadu_ps(from2 + f)));
+            }
+        }
+        #define ATTRIBUTE_GATHER(field) _mm_setr_ps(sums[0].field, sums[1].field, sums[2].field, sums[3].field)
+        __m128 a[6] = {ATTRIBUTE_GATHER(a[0]), ATTRIBUTE_GATHER(a[1]), ATTRIBUTE_GATHER(a[2]),
+                       ATTRIBUTE_GATHER(a[3]), ATTRIBUTE_GATHER(a[4]), ATTRIBUTE_GATHER(a[5])};
+        __m128 b[3] = {ATTRIBUTE_GATHER(b[0]), ATTRIBUTE_GATHER(b[1]), ATTRIBUTE_GATHER(b[2])};
+        __m128 c = ATTRIBUTE_GATHER(c);
+        __m128 w = ATTRIBUTE_GATHER(w);
+        // lanes with no area keep their positional part, as in reducedQuadric()
+        __m128 inverse = _mm_and_ps(_mm_cmpgt_ps(w, _mm_setzero_ps()), _mm_div_ps(_mm_set1_ps(1.0f), w));
+        for (int j = 0; j < attributes; j++) {
+            __m128 g0 = ATTRIBUTE_GATHER(g[j][0]), g1 = ATTRIBUTE_GATHER(g[j][1]), g2 = ATTRIBUTE_GATHER(g[j][2]);
+            __m128 dj = ATTRIBUTE_GATHER(d[j]);
+            __m128 s0 = _mm_mul_ps(g0, inverse), s1 = _mm_mul_ps(g1, inverse), s2 = _mm_mul_ps(g2, inverse);
+            __m128 d = _mm_mul_ps(dj, inverse);
+            a[0] = _mm_sub_ps(a[0], _mm_mul_ps(g0, s0));
+            a[1] = _mm_sub_ps(a[1], _mm_mul_ps(g0, s1));
+            a[2] = _mm_sub_ps(a[2], _mm_mul_ps(g0, s2));
+            a[3] = _mm_sub_ps(a[3], _mm_mul_ps(g1, s1));
+            a[4] = _mm_sub_ps(a[4], _mm_mul_ps(g1, s2));
+            a[5] = _mm_sub_ps(a[5], _mm_mul_ps(g2, s2));
+            b[0] = _mm_sub_ps(b[0], _mm_mul_ps(g0, d));
+            b[1] = _mm_sub_ps(b[1], _mm_mul_ps(g1, d));
+            b[2] = _mm_sub_ps(b[2], _mm_mul_ps(g2, d));
+            c = _mm_sub_ps(c, _mm_mul_ps(dj, d));
+        }
+        #undef ATTRIBUTE_GATHER
+
+        float lanes[10][4];
+        for (int k = 0; k < 6; k++) {
+            _mm_storeu_ps(lanes[k], a[k]);
+        }
+        for (int k = 0; k < 3; k++) {
+            _mm_storeu_ps(lanes[6 + k], b[k]);
+        }
+        _mm_storeu_ps(lanes[9], c);
+        for (int k = 0; k < 4; k++) {
+            float a00 = lanes[0][k], a01 = lanes[1][k], a02 = lanes[2][k], a11 = lanes[3][k], a12 = lanes[4][k],
+                  a22 = lanes[5][k], b0 = lanes[6][k], b1 = lanes[7][k], b2 = lanes[8][k];
+            reduced[i + k] = glm::mat4(glm::vec4(a00, a01, a02, b0),
+                                       glm::vec4(a01, a11, a12, b1),
+                                       glm::vec4(a02, a12, a22, b2),
+                                       glm::vec4(b0, b1, b2, lanes[9][k]));
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        reduced[i] = reducedQuadric(quadrics[edges[i].first] + quadrics[edges[i].second], attributes);
+    }
+}
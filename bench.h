@@ -0,0 +1,1235 @@
+#pragma once
+
+#include "model.h"
+#include "optimize.h"
+#include "quantize.h"
+#include "clusterlod.h"
+#include "culling.h"
+#include "simplify.h"
+#include "bvh.h"
+#include "meshdistance.h"
+#include "softraster.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <chrono>
+#include <random>
+
+// Headless benchmarks. None of these touch OpenGL, so they can run in CI on machines without a GPU.
+
+double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void printCacheStats(const char* label, const VertexCacheStats &fifo, const VertexCacheStats &lru) {
+    printf("  %-10s FIFO ACMR %.3f ATVR %.3f | LRU ACMR %.3f ATVR %.3f\n",
+           label, fifo.acmr, fifo.atvr, lru.acmr, lru.atvr);
+}
+
+// measure how well the index buffer uses the post-transform cache before and after reordering it
+void benchVertexCache(Model &model) {
+    const std::vector<glm::ivec3> &faces = model.getFaces();
+    size_t vertexCount = model.getVertices().size();
+
+    printf("vertex cache (%d entries, %lu triangles)\n", VERTEX_CACHE_SIZE, faces.size());
+    printCacheStats("before", simulateVertexCacheFIFO(faces, vertexCount), simulateVertexCacheLRU(faces, vertexCount));
+
+    auto start = std::chrono::steady_clock::now();
+    model.optimizeVertexCache();
+    double ms = elapsedMs(start);
+
+    printCacheStats("after", simulateVertexCacheFIFO(faces, vertexCount), simulateVertexCacheLRU(faces, vertexCount));
+    printf("  optimization took %.3f ms\n", ms);
+}
+
+void printFetchStats(const char* label, const VertexFetchStats &stats) {
+    printf("  %-10s %lu bytes fetched for %lu bytes referenced, overfetch %.3f\n",
+           label, stats.bytesFetched, stats.bytesReferenced, stats.overfetch);
+}
+
+// simulated fetch cache over the interleaved position + normal data, before and after renumbering the vertices
+void benchVertexFetch(Model &model) {
+    const size_t vertexSize = 2 * sizeof(glm::vec3);
+
+    printf("vertex fetch (%d x %d byte lines, %lu byte vertices)\n", FETCH_CACHE_LINES, FETCH_CACHE_LINE, vertexSize);
+    printFetchStats("before", simulateVertexFetch(model.getFaces(), model.getVertices().size(), vertexSize));
+
+    auto start = std::chrono::steady_clock::now();
+    model.optimizeVertexFetch();
+    double ms = elapsedMs(start);
+
+    printFetchStats("after", simulateVertexFetch(model.getFaces(), model.getVertices().size(), vertexSize));
+    printf("  optimization took %.3f ms\n", ms);
+}
+
+// size of the float streams against the quantized interleaved buffer, plus the error the quantization introduces
+void benchQuantization(Model &model) {
+    const std::vector<glm::vec3> &vertices = model.getVertices();
+    const std::vector<glm::vec3> &normals = model.getNormals();
+    const std::vector<glm::ivec3> &faces = model.getFaces();
+
+    auto start = std::chrono::steady_clock::now();
+    glm::vec3 offset, scale;
+    std::vector<QuantizedVertex> packed = quantizeVertices(vertices, normals, offset, scale);
+    double ms = elapsedMs(start);
+
+    float maxPositionError = 0.0f;
+    float maxNormalError = 0.0f;
+    for (size_t i = 0; i < vertices.size(); i++) {
+        glm::vec3 p = offset + scale * glm::vec3(packed[i].position[0], packed[i].position[1], packed[i].position[2]) / 65535.0f;
+        maxPositionError = std::max(maxPositionError, glm::length(p - vertices[i]));
+        glm::vec3 n = octDecode(glm::vec2(packed[i].normal[0], packed[i].normal[1]) / 32767.0f);
+        float cosAngle = glm::clamp(glm::dot(n, glm::normalize(normals[i])), -1.0f, 1.0f);
+        maxNormalError = std::max(maxNormalError, glm::degrees(std::acos(cosAngle)));
+    }
+
+    size_t floatBytes = vertices.size() * 2 * sizeof(glm::vec3) + faces.size() * sizeof(glm::ivec3);
+    size_t indexSize = vertices.size() < 65536 ? sizeof(uint16_t) : sizeof(uint32_t);
+    size_t quantizedBytes = packed.size() * sizeof(QuantizedVertex) + faces.size() * 3 * indexSize;
+
+    printf("quantization (%lu byte vertices, %lu byte indices)\n", sizeof(QuantizedVertex), indexSize);
+    printf("  float %lu bytes, quantized %lu bytes (%.1f%%)\n", floatBytes, quantizedBytes, 100.0 * quantizedBytes / floatBytes);
+    printf("  max position error %g, max normal error %.4f degrees, took %.3f ms\n", maxPositionError, maxNormalError, ms);
+}
+
+void benchMeshlets(Model &model) {
+    auto start = std::chrono::steady_clock::now();
+    model.buildMeshlets();
+    double ms = elapsedMs(start);
+
+    const MeshletData &data = model.getMeshlets();
+    size_t cullable = 0;
+    for (const Meshlet &m : data.meshlets) {
+        cullable += m.coneCutoff < 1.0f;
+    }
+    printf("meshlets (max %d vertices, %d triangles)\n", MESHLET_MAX_VERTICES, MESHLET_MAX_TRIANGLES);
+    printf("  %lu meshlets, %.1f vertices and %.1f triangles on average, %lu with a cullable normal cone\n",
+           data.meshlets.size(), (float) data.vertices.size() / data.meshlets.size(),
+           (float) model.getFaces().size() / data.meshlets.size(), cullable);
+    printf("  build took %.3f ms\n", ms);
+}
+
+void benchClusterLod(const Model &model) {
+    auto start = std::chrono::steady_clock::now();
+    ClusterDag dag = buildClusterDag(model.getVertices(), model.getNormals(), model.getFaces());
+    double ms = elapsedMs(start);
+
+    printf("cluster LOD DAG (%u threads)\n", workerCount());
+    printf("  %lu clusters, %lu groups, %d levels, built in %.3f ms\n", dag.clusters.size(), dag.groups.size(), dag.levels, ms);
+    for (int level = 0; level < dag.levels; level++) {
+        size_t clusters = 0, triangles = 0;
+        float error = 0.0f;
+        for (const LodCluster &c : dag.clusters) {
+            if (c.level == level) {
+                clusters++;
+                triangles += c.triangleCount;
+                error = std::max(error, c.lodError);
+            }
+        }
+        printf("  level %d: %lu clusters, %lu triangles, max error %g\n", level, clusters, triangles, error);
+    }
+
+    // LOD cuts for a 1080p view with a 45 degree field of view and a one pixel error budget
+    glm::vec3 center;
+    float radius;
+    computeBoundingSphere(model.getVertices(), center, radius);
+    float projectionScale = 1080.0f / (2.0f * std::tan(glm::radians(45.0f) / 2.0f));
+    for (float distance : {2.0f, 8.0f, 32.0f, 128.0f}) {
+        glm::vec3 eye = center + glm::vec3(0.0f, 0.0f, radius * distance);
+        std::vector<uint32_t> cut = selectClusterLod(dag, eye, projectionScale, 1.0f);
+        size_t triangles = 0;
+        for (uint32_t id : cut) {
+            triangles += dag.clusters[id].triangleCount;
+        }
+        printf("  cut at %5.0fx radius: %lu clusters, %lu triangles\n", distance, cut.size(), triangles);
+    }
+}
+
+// load a model, reporting its size and load time
+Model* loadModel(const char* path) {
+    auto start = std::chrono::steady_clock::now();
+    Model* model = new Model(path);
+    printf("loaded %s in %.3f ms: %lu vertices, %lu faces\n",
+           path, elapsedMs(start), model->getVertices().size(), model->getFaces().size());
+    return model;
+}
+
+// collapse edges until the model has targetRatio of its face count
+void simplifyModel(Model &model, float targetRatio) {
+    size_t targetFaces = (size_t) (model.getFaces().size() * targetRatio);
+    auto start = std::chrono::steady_clock::now();
+    size_t collapses = 0;
+    while (model.getFaces().size() > targetFaces && model.collapseMeshQEM()) {
+        collapses++;
+    }
+    printf("simplified to %lu faces with %lu collapses in %.3f ms\n", model.getFaces().size(), collapses, elapsedMs(start));
+}
+
+// load and simplify to targetRatio of the original face count
+Model* loadSimplified(const char* path, float targetRatio) {
+    Model* model = loadModel(path);
+    simplifyModel(*model, targetRatio);
+    return model;
+}
+
+// Cost every edge of the mesh three ways: the midpoint the simplifier used to take, the optimal placement
+// one edge at a time, and the batched solve. Reports throughput and the mean error each placement leaves.
+void benchPlacement(const Model &model) {
+    const std::vector<glm::vec3> &vertices = model.getVertices();
+    const std::vector<glm::ivec3> &faces = model.getFaces();
+    std::vector<glm::mat4> vertexQuadrics(vertices.size(), glm::mat4(0.0f));
+    std::vector<std::pair<int, int>> edges;
+    for (const glm::ivec3 &face : faces) {
+        glm::mat4 kp = computeKp(computePlaneCoeffs(vertices[face[0]], vertices[face[1]], vertices[face[2]]));
+        for (int k = 0; k < 3; k++) {
+            vertexQuadrics[face[k]] += kp;
+            int a = face[k], b = face[(k + 1) % 3];
+            edges.emplace_back(std::min(a, b), std::max(a, b));
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+    size_t count = edges.size();
+    std::vector<glm::mat4> quadrics(count);
+    std::vector<glm::vec3> p1(count), p2(count);
+    for (size_t i = 0; i < count; i++) {
+        quadrics[i] = vertexQuadrics[edges[i].first] + vertexQuadrics[edges[i].second];
+        p1[i] = vertices[edges[i].first];
+        p2[i] = vertices[edges[i].second];
+    }
+
+    const int runs = 20;
+    std::vector<float> midpointErrors(count), scalarErrors(count), batchedErrors(count);
+    std::vector<glm::vec3> scalarPositions(count), batchedPositions(count);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int run = 0; run < runs; run++) {
+        for (size_t i = 0; i < count; i++) {
+            midpointErrors[i] = quadricErrorAt(quadrics[i], (p1[i] + p2[i]) * 0.5f);
+        }
+    }
+    double midpointMs = elapsedMs(start) / runs;
+
+    start = std::chrono::steady_clock::now();
+    for (int run = 0; run < runs; run++) {
+        for (size_t i = 0; i < count; i++) {
+            scalarErrors[i] = optimalPlacement(quadrics[i], p1[i], p2[i], scalarPositions[i]);
+        }
+    }
+    double scalarMs = elapsedMs(start) / runs;
+
+    start = std::chrono::steady_clock::now();
+    for (int run = 0; run < runs; run++) {
+        optimalPlacements(quadrics.data(), p1.data(), p2.data(), count, batchedPositions.data(), batchedErrors.data());
+    }
+    double batchedMs = elapsedMs(start) / runs;
+
+    double midpointSum = 0.0, optimalSum = 0.0;
+    float maxDifference = 0.0f;
+    for (size_t i = 0; i < count; i++) {
+        midpointSum += midpointErrors[i];
+        optimalSum += batchedErrors[i];
+        maxDifference = std::max(maxDifference, glm::length(batchedPositions[i] - scalarPositions[i]));
+    }
+    printf("edge placement (%lu edges)\n", count);
+    printf("  midpoint   %.3f ms, %.1f Medges/s, mean error %.3e\n", midpointMs, count / (midpointMs * 1000.0), midpointSum / count);
+    printf("  optimal    %.3f ms, %.1f Medges/s, mean error %.3e\n", scalarMs, count / (scalarMs * 1000.0), optimalSum / count);
+    printf("  batched    %.3f ms, %.1f Medges/s (max distance to the scalar result %.2e)\n", batchedMs,
+           count / (batchedMs * 1000.0), maxDifference);
+}
+
+// curved height field over the unit square, scaled up so that collapse errors stay well above float noise and
+// ties do not decide the order
+glm::vec3 benchSurfacePoint(float x, float y) {
+    return glm::vec3(10.0f * x, 10.0f * y, std::sin(6.0f * x) * std::cos(4.0f * y));
+}
+
+// n x n quads split into two triangles each: every interior vertex has valence 6
+void makeGridMesh(int n, std::vector<glm::vec3> &vertices, std::vector<glm::ivec3> &faces) {
+    for (int y = 0; y <= n; y++) {
+        for (int x = 0; x <= n; x++) {
+            vertices.push_back(benchSurfacePoint((float) x / n, (float) y / n));
+        }
+    }
+    for (int y = 0; y < n; y++) {
+        for (int x = 0; x < n; x++) {
+            int v = y * (n + 1) + x;
+            faces.emplace_back(v, v + 1, v + n + 2);
+            faces.emplace_back(v, v + n + 2, v + n + 1);
+        }
+    }
+}
+
+// latitude-longitude sphere: valence 6 everywhere except two poles shared by a whole ring of slivers
+void makeSphereMesh(int segments, int rings, std::vector<glm::vec3> &vertices, std::vector<glm::ivec3> &faces) {
+    vertices.push_back(glm::vec3(0.0f, 1.0f, 0.0f));
+    for (int r = 1; r < rings; r++) {
+        float theta = glm::radians(180.0f) * r / rings;
+        for (int s = 0; s < segments; s++) {
+            float phi = glm::radians(360.0f) * s / segments;
+            vertices.push_back(glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)));
+        }
+    }
+    int south = (int) vertices.size();
+    vertices.push_back(glm::vec3(0.0f, -1.0f, 0.0f));
+    auto ring = [&](int r, int s) { return 1 + (r - 1) * segments + s % segments; };
+    for (int s = 0; s < segments; s++) {
+        faces.emplace_back(0, ring(1, s + 1), ring(1, s));
+        faces.emplace_back(south, ring(rings - 1, s), ring(rings - 1, s + 1));
+        for (int r = 1; r + 1 < rings; r++) {
+            faces.emplace_back(ring(r, s), ring(r, s + 1), ring(r + 1, s + 1));
+            faces.emplace_back(ring(r, s), ring(r + 1, s + 1), ring(r + 1, s));
+        }
+    }
+}
+
+// cells x cells squares, each a fan around a centre vertex through `side` points per edge: hubs of valence
+// 4 * side surrounded by vertices of valence 4 to 6
+void makeHubMesh(int cells, int side, std::vector<glm::vec3> &vertices, std::vector<glm::ivec3> &faces) {
+    int n = cells * side;
+    for (int y = 0; y <= n; y++) {
+        for (int x = 0; x <= n; x++) {
+            vertices.push_back(benchSurfacePoint((float) x / n, (float) y / n));
+        }
+    }
+    std::vector<int> boundary;
+    for (int cy = 0; cy < cells; cy++) {
+        for (int cx = 0; cx < cells; cx++) {
+            int hub = (int) vertices.size();
+            vertices.push_back(benchSurfacePoint((cx + 0.5f) / cells, (cy + 0.5f) / cells));
+            // walk the cell outline counter-clockwise; points inside the cell stay unreferenced
+            int x0 = cx * side, y0 = cy * side;
+            boundary.clear();
+            for (int i = 0; i < side; i++) boundary.push_back(y0 * (n + 1) + x0 + i);
+            for (int i = 0; i < side; i++) boundary.push_back((y0 + i) * (n + 1) + x0 + side);
+            for (int i = 0; i < side; i++) boundary.push_back((y0 + side) * (n + 1) + x0 + side - i);
+            for (int i = 0; i < side; i++) boundary.push_back((y0 + side - i) * (n + 1) + x0);
+            for (size_t i = 0; i < boundary.size(); i++) {
+                faces.emplace_back(hub, boundary[i], boundary[(i + 1) % boundary.size()]);
+            }
+        }
+    }
+}
+
+// number of distinct neighbours of every referenced vertex, as mean and max
+void valenceStats(const std::vector<glm::ivec3> &faces, size_t vertexCount, float &mean, size_t &max) {
+    std::vector<std::vector<int>> neighbours(vertexCount);
+    for (const glm::ivec3 &face : faces) {
+        for (int j = 0; j < 3; j++) {
+            neighbours[face[j]].push_back(face[(j + 1) % 3]);
+            neighbours[face[j]].push_back(face[(j + 2) % 3]);
+        }
+    }
+    size_t total = 0, referenced = 0;
+    max = 0;
+    for (std::vector<int> &n : neighbours) {
+        if (n.empty()) {
+            continue;
+        }
+        std::sort(n.begin(), n.end());
+        size_t valence = std::unique(n.begin(), n.end()) - n.begin();
+        total += valence;
+        referenced++;
+        max = std::max(max, valence);
+    }
+    mean = referenced ? (float) total / referenced : 0.0f;
+}
+
+void printQueueRun(const char* label, double ms, double referenceMs, size_t triangles, float error,
+                   double errorSum, double referenceErrorSum, const SimplifyStats &stats) {
+    printf("    %-10s %8.2f ms (%.2fx), %lu triangles, max error %.4g, error sum %.3g (%.2fx) | %lu pushes, "
+           "%lu updates, %lu removals, %lu pops (%lu stale), peak queue %lu\n",
+           label, ms, referenceMs / ms, triangles, error, errorSum, errorSum / referenceErrorSum, stats.pushes,
+           stats.updates, stats.removals, stats.pops, stats.stalePops, stats.peakQueueSize);
+}
+
+// simplify the same mesh to a tenth with each queue policy. Speed and error sum are relative to the lazy exact
+// queue: the error sum is what a looser order gives up for throughput.
+void benchQueuePolicy(const char* label, const std::vector<glm::vec3> &vertices, const std::vector<glm::ivec3> &faces) {
+    float meanValence;
+    size_t maxValence;
+    valenceStats(faces, vertices.size(), meanValence, maxValence);
+    printf("  %s: %lu triangles, valence %.2f mean, %lu max\n", label, faces.size(), meanValence, maxValence);
+
+    std::vector<bool> locked(vertices.size(), false);
+    double referenceMs = 0.0, referenceErrorSum = 0.0;
+    for (QueuePolicy policy : {QUEUE_LAZY, QUEUE_EAGER, QUEUE_BUCKETED}) {
+        for (int bits : {1, 3, 5}) {
+            if (policy != QUEUE_BUCKETED && bits != 1) {
+                continue;
+            }
+            std::vector<glm::ivec3> simplified = faces;
+            SimplifyStats stats;
+            auto start = std::chrono::steady_clock::now();
+            float error = simplifyQEM(vertices, simplified, locked, faces.size() / 10, policy, &stats, bits);
+            double ms = elapsedMs(start);
+            if (policy == QUEUE_LAZY) {
+                referenceMs = ms;
+                referenceErrorSum = stats.errorSum;
+            }
+            char name[32];
+            snprintf(name, sizeof(name), "%s", policy == QUEUE_LAZY ? "lazy" : policy == QUEUE_EAGER ? "eager" : "");
+            if (policy == QUEUE_BUCKETED) {
+                snprintf(name, sizeof(name), "bucket/%d", bits);
+            }
+            printQueueRun(name, ms, referenceMs, simplified.size(), error, stats.errorSum, referenceErrorSum, stats);
+        }
+    }
+}
+
+void benchQueuePolicies(const Model &model) {
+    printf("simplification queue: lazy version stamps, eager indexed heap, bucket queue with n mantissa bits\n");
+    benchQueuePolicy("model", model.getVertices(), model.getFaces());
+
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::ivec3> faces;
+    makeGridMesh(256, vertices, faces);
+    benchQueuePolicy("grid", vertices, faces);
+
+    vertices.clear();
+    faces.clear();
+    makeSphereMesh(1024, 64, vertices, faces);
+    benchQueuePolicy("sphere", vertices, faces);
+
+    vertices.clear();
+    faces.clear();
+    makeHubMesh(32, 16, vertices, faces);
+    benchQueuePolicy("hubs", vertices, faces);
+}
+
+size_t countClosePairsBruteForce(const std::vector<glm::vec3> &positions, float radius) {
+    size_t count = 0;
+    for (size_t i = 0; i < positions.size(); i++) {
+        for (size_t j = i + 1; j < positions.size(); j++) {
+            glm::vec3 d = positions[j] - positions[i];
+            count += glm::dot(d, d) <= radius * radius;
+        }
+    }
+    return count;
+}
+
+void benchClosePairs(const char* label, const std::vector<glm::vec3> &positions, float radius) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::pair<int, int>> pairs = findClosePairs(positions, radius);
+    double gridMs = elapsedMs(start);
+    printf("  %-8s t = %-9.4g %8lu pairs, grid %8.3f ms", label, radius, pairs.size(), gridMs);
+    // the quadratic scan only where it finishes in reasonable time
+    if (positions.size() <= 20000) {
+        start = std::chrono::steady_clock::now();
+        size_t expected = countClosePairsBruteForce(positions, radius);
+        printf(", all pairs %8.3f ms (%s)", elapsedMs(start), expected == pairs.size() ? "match" : "MISMATCH");
+    }
+    printf("\n");
+}
+
+// virtual pair search for thresholds relative to the bounding box diagonal, then its share of computeQEM()
+void benchVirtualPairs(const Model &model) {
+    glm::vec3 aabbMin, aabbMax;
+    computeBounds(model.getVertices(), aabbMin, aabbMax);
+    float diagonal = glm::length(aabbMax - aabbMin);
+    printf("virtual pairs (%u threads)\n", workerCount());
+    for (float fraction : {0.002f, 0.01f, 0.05f}) {
+        benchClosePairs("model", model.getVertices(), fraction * diagonal);
+    }
+
+    // a million points in a unit cube, about 4 neighbours each within t
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<glm::vec3> points(1000000);
+    for (glm::vec3 &p : points) {
+        p = glm::vec3(unit(rng), unit(rng), unit(rng));
+    }
+    benchClosePairs("random", points, 0.01f);
+
+    Model copy(model.getVertices(), model.getNormals(), model.getFaces());
+    auto start = std::chrono::steady_clock::now();
+    copy.computeQEM();
+    double edgesOnlyMs = elapsedMs(start);
+    start = std::chrono::steady_clock::now();
+    copy.setPairThreshold(0.01f * diagonal);
+    double withPairsMs = elapsedMs(start);
+    printf("  computeQEM %.3f ms with edges only, %.3f ms with %lu virtual pairs at t = 1%% of the diagonal "
+           "(search %.3f ms)\n", edgesOnlyMs, withPairsMs, copy.getVirtualPairCount(), copy.getPairSearchMs());
+}
+
+// nearest hit and closest point over every face, for checking the BVH
+float intersectAllFaces(const std::vector<glm::vec3> &vertices, const std::vector<glm::ivec3> &faces,
+                        glm::vec3 origin, glm::vec3 direction) {
+    float best = INFINITY;
+    for (const glm::ivec3 &face : faces) {
+        float u, v;
+        best = std::min(best, intersectTriangle(origin, direction, vertices[face.x], vertices[face.y], vertices[face.z], u, v));
+    }
+    return best;
+}
+
+float closestDistanceAllFaces(const std::vector<glm::vec3> &vertices, const std::vector<glm::ivec3> &faces, glm::vec3 p) {
+    float best = INFINITY;
+    for (const glm::ivec3 &face : faces) {
+        best = std::min(best, glm::length(closestPointOnTriangle(p, vertices[face.x], vertices[face.y], vertices[face.z]) - p));
+    }
+    return best;
+}
+
+// Build, query and refit a BVH over a mesh. Rays start on a sphere around the mesh and aim at random points in
+// its bounds; closest-point queries are uniform in the bounds grown by a tenth. A sample of both is checked
+// against the brute force answer.
+void benchBvhMesh(const char* label, const std::vector<glm::vec3> &vertices, const std::vector<glm::ivec3> &faces) {
+    Bvh bvh;
+    auto start = std::chrono::steady_clock::now();
+    bvh.build(vertices, faces);
+    double buildMs = elapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    bvh.refit(vertices, faces);
+    double refitMs = elapsedMs(start);
+    printf("  %-6s %lu triangles: build %.3f ms (%lu nodes), refit %.3f ms\n", label, faces.size(), buildMs,
+           bvh.getNodeCount(), refitMs);
+
+    glm::vec3 aabbMin, aabbMax;
+    computeBounds(vertices, aabbMin, aabbMax);
+    glm::vec3 center = (aabbMin + aabbMax) * 0.5f, extent = aabbMax - aabbMin;
+    float radius = glm::length(extent);
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    const size_t queries = 100000;
+    std::vector<glm::vec3> origins(queries), directions(queries), points(queries);
+    for (size_t i = 0; i < queries; i++) {
+        glm::vec3 onSphere = glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng)) - 0.5f + glm::vec3(1e-6f));
+        origins[i] = center + onSphere * radius;
+        glm::vec3 target = aabbMin + extent * glm::vec3(unit(rng), unit(rng), unit(rng));
+        directions[i] = glm::normalize(target - origins[i]);
+        points[i] = aabbMin - 0.05f * extent + 1.1f * extent * glm::vec3(unit(rng), unit(rng), unit(rng));
+    }
+
+    std::vector<BvhHit> hits(queries);
+    start = std::chrono::steady_clock::now();
+    parallelFor(queries, 256, [&](size_t i) {
+        bvh.intersect(origins[i], directions[i], INFINITY, hits[i]);
+    });
+    double rayMs = elapsedMs(start);
+
+    std::vector<BvhClosest> closest(queries);
+    start = std::chrono::steady_clock::now();
+    parallelFor(queries, 256, [&](size_t i) {
+        bvh.closestPoint(points[i], INFINITY, closest[i]);
+    });
+    double closestMs = elapsedMs(start);
+
+    size_t hitCount = 0, mismatches = 0;
+    for (size_t i = 0; i < queries; i++) {
+        hitCount += hits[i].face >= 0;
+    }
+    const size_t checked = 200;
+    for (size_t i = 0; i < checked; i++) {
+        float t = intersectAllFaces(vertices, faces, origins[i], directions[i]);
+        float d = closestDistanceAllFaces(vertices, faces, points[i]);
+        mismatches += !(t == hits[i].t || std::fabs(t - hits[i].t) <= 1e-5f * radius);
+        mismatches += std::fabs(d - closest[i].distance) > 1e-5f * radius;
+    }
+    printf("         rays %.2f M/s (%lu of %lu hit), closest points %.2f M/s, %lu of %lu checked queries differ\n",
+           queries / (rayMs * 1000.0), hitCount, queries, queries / (closestMs * 1000.0), mismatches, 2 * checked);
+}
+
+void benchBvh(const Model &model) {
+    printf("BVH (%d wide, %d bins, %u threads)\n", BVH_WIDTH, BVH_BINS, workerCount());
+    benchBvhMesh("model", model.getVertices(), model.getFaces());
+
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::ivec3> faces;
+    makeSphereMesh(1024, 512, vertices, faces);
+    benchBvhMesh("sphere", vertices, faces);
+
+    // renumbering the vertices keeps the faces in order, so the tree only needs a refit
+    Model compacted(model.getVertices(), model.getNormals(), model.getFaces());
+    Bvh bvh;
+    bvh.build(compacted.getVertices(), compacted.getFaces());
+    compacted.optimizeVertexFetch();
+    auto start = std::chrono::steady_clock::now();
+    bvh.refit(compacted.getVertices(), compacted.getFaces());
+    double refitMs = elapsedMs(start);
+    BvhClosest closest;
+    glm::vec3 probe = compacted.getVertices()[0] + glm::vec3(0.01f);
+    bvh.closestPoint(probe, INFINITY, closest);
+    float expected = closestDistanceAllFaces(compacted.getVertices(), compacted.getFaces(), probe);
+    printf("  refit after optimizeVertexFetch %.3f ms, closest point %s\n", refitMs,
+           std::fabs(closest.distance - expected) <= 1e-6f ? "matches" : "DIFFERS");
+}
+
+// area-weighted vertex normals, as loadObj() makes them when the file has none
+std::vector<glm::vec3> smoothNormals(const std::vector<glm::vec3> &vertices, const std::vector<glm::ivec3> &faces) {
+    std::vector<glm::vec3> normals(vertices.size(), glm::vec3(0.0f));
+    for (const glm::ivec3 &f : faces) {
+        glm::vec3 n = glm::cross(vertices[f.y] - vertices[f.x], vertices[f.z] - vertices[f.x]);
+        normals[f.x] += n;
+        normals[f.y] += n;
+        normals[f.z] += n;
+    }
+    for (glm::vec3 &n : normals) {
+        n = glm::dot(n, n) > 0.0f ? glm::normalize(n) : glm::vec3(0.0f, 0.0f, 1.0f);
+    }
+    return normals;
+}
+
+// mean angle in degrees between the normal of each vertex of the original and the normal the simplified mesh
+// interpolates at the closest point to it: how far the shading moved
+double normalDeviation(const std::vector<glm::vec3> &vertices, const std::vector<glm::vec3> &normals,
+                       const std::vector<glm::ivec3> &faces, const Model &simplified) {
+    const std::vector<glm::vec3> &sv = simplified.getVertices();
+    const std::vector<glm::vec3> &sn = simplified.getNormals();
+    Bvh bvh;
+    bvh.build(sv, simplified.getFaces());
+    std::vector<uint8_t> used(vertices.size(), 0);
+    for (const glm::ivec3 &f : faces) {
+        used[f.x] = used[f.y] = used[f.z] = 1;
+    }
+    double sum = 0.0;
+    size_t count = 0;
+    for (size_t v = 0; v < vertices.size(); v++) {
+        BvhClosest closest;
+        if (!used[v] || !bvh.closestPoint(vertices[v], INFINITY, closest)) {
+            continue;
+        }
+        glm::ivec3 f = simplified.getFaces()[closest.face];
+        glm::vec3 e1 = sv[f.y] - sv[f.x], e2 = sv[f.z] - sv[f.x], ep = closest.point - sv[f.x];
+        float d11 = glm::dot(e1, e1), d12 = glm::dot(e1, e2), d22 = glm::dot(e2, e2);
+        float denominator = d11 * d22 - d12 * d12;
+        float u = 0.0f, w = 0.0f;
+        if (denominator > 0.0f) {
+            u = (d22 * glm::dot(ep, e1) - d12 * glm::dot(ep, e2)) / denominator;
+            w = (d11 * glm::dot(ep, e2) - d12 * glm::dot(ep, e1)) / denominator;
+        }
+        glm::vec3 n = sn[f.x] * (1.0f - u - w) + sn[f.y] * u + sn[f.z] * w;
+        float cosAngle = glm::dot(n, n) > 0.0f ? glm::dot(glm::normalize(n), normals[v]) : 1.0f;
+        sum += glm::degrees(std::acos(glm::clamp(cosAngle, -1.0f, 1.0f)));
+        count++;
+    }
+    return count ? sum / count : 0.0;
+}
+
+// Cost of the attribute quadrics against positional ones (the full computeQEM() pass, and the batched
+// reduction against the scalar one), and what they buy: a curved grid simplified with collapseMeshQEM() at
+// several normal weights, measured for geometric error and for how far its interpolated normals moved.
+void benchAttributeQuadrics(const Model &model) {
+    printf("attribute quadrics (position + normal, %lu bytes a vertex against %lu)\n", sizeof(AttributeQuadric),
+           sizeof(glm::mat4));
+    Model copy(model.getVertices(), model.getNormals(), model.getFaces());
+    const int runs = 5;
+    auto start = std::chrono::steady_clock::now();
+    for (int run = 0; run < runs; run++) {
+        copy.computeQEM();
+    }
+    double positionalMs = elapsedMs(start) / runs;
+    copy.setNormalWeight(1.0f);
+    start = std::chrono::steady_clock::now();
+    for (int run = 0; run < runs; run++) {
+        copy.computeQEM();
+    }
+    double attributeMs = elapsedMs(start) / runs;
+    printf("  computeQEM  positions %.3f ms, positions + normals %.3f ms (%.2fx)\n", positionalMs, attributeMs,
+           attributeMs / positionalMs);
+
+    // the edge reductions alone, scalar against batched, over every edge of the model
+    std::vector<AttributeQuadric> quadrics(model.getVertices().size(), AttributeQuadric());
+    const std::vector<glm::vec3> &vertices = model.getVertices();
+    const std::vector<glm::vec3> &normals = model.getNormals();
+    std::vector<std::pair<int, int>> edges;
+    for (const glm::ivec3 &f : model.getFaces()) {
+        AttributeQuadric q = faceAttributeQuadric(vertices[f.x], vertices[f.y], vertices[f.z], &normals[f.x].x,
+                                                  &normals[f.y].x, &normals[f.z].x, 3);
+        for (int k = 0; k < 3; k++) {
+            quadrics[f[k]] += q;
+            edges.emplace_back(f[k], f[(k + 1) % 3]);
+        }
+    }
+    std::vector<glm::mat4> scalar(edges.size()), batched(edges.size());
+    const int reductionRuns = 50;
+    start = std::chrono::steady_clock::now();
+    for (int run = 0; run < reductionRuns; run++) {
+        for (size_t i = 0; i < edges.size(); i++) {
+            scalar[i] = reducedQuadric(quadrics[edges[i].first] + quadrics[edges[i].second], 3);
+        }
+    }
+    double scalarMs = elapsedMs(start) / reductionRuns;
+    start = std::chrono::steady_clock::now();
+    for (int run = 0; run < reductionRuns; run++) {
+        reducedQuadrics(quadrics.data(), edges.data(), edges.size(), 3, batched.data());
+    }
+    double batchedMs = elapsedMs(start) / reductionRuns;
+    float maxDifference = 0.0f, maxEntry = 0.0f;
+    for (size_t i = 0; i < edges.size(); i++) {
+        for (int c = 0; c < 4; c++) {
+            for (int r = 0; r < 4; r++) {
+                maxDifference = std::max(maxDifference, std::fabs(scalar[i][c][r] - batched[i][c][r]));
+                maxEntry = std::max(maxEntry, std::fabs(scalar[i][c][r]));
+            }
+        }
+    }
+    printf("  reduction   scalar %.1f Medges/s, batched %.1f Medges/s (%.2fx, max difference %.1e of %.1e)\n",
+           edges.size() / (scalarMs * 1000.0), edges.size() / (batchedMs * 1000.0), scalarMs / batchedMs,
+           maxDifference, maxEntry);
+
+    std::vector<glm::vec3> gridVertices;
+    std::vector<glm::ivec3> gridFaces;
+    makeGridMesh(24, gridVertices, gridFaces);
+    std::vector<glm::vec3> gridNormals = smoothNormals(gridVertices, gridFaces);
+    for (float ratio : {0.25f, 0.1f}) {
+        for (float weight : {0.0f, 0.5f, 2.0f}) {
+            Model grid(gridVertices, gridNormals, gridFaces);
+            if (weight > 0.0f) {
+                grid.setNormalWeight(weight);
+            }
+            size_t target = (size_t) (gridFaces.size() * ratio);
+            start = std::chrono::steady_clock::now();
+            while (grid.getFaces().size() > target) {
+                if (!grid.collapseMeshQEM()) {
+                    break;
+                }
+            }
+            double ms = elapsedMs(start);
+            MeshError error = meshError(gridVertices, gridFaces, grid.getVertices(), grid.getFaces(), 100000);
+            printf("  grid %4lu -> %3lu faces, normal weight %.1f: rms %.5f, hausdorff %.5f, normals off by %.2f deg "
+                   "(%.1f ms)\n", gridFaces.size(), grid.getFaces().size(), weight, error.rms, error.hausdorff,
+                   normalDeviation(gridVertices, gridNormals, gridFaces, grid), ms);
+        }
+    }
+}
+
+// RMS distance from the original surface to the simplified one, over the samples inside the box and those
+// outside it
+void regionRms(const std::vector<glm::vec3> &vertices, const std::vector<glm::ivec3> &faces, const Model &simplified,
+               const ImportanceBox &box, float &inside, float &outside) {
+    std::vector<glm::vec3> samples = sampleSurface(vertices, faces, 100000), in, out;
+    for (glm::vec3 p : samples) {
+        (insideImportanceBox(box, p) ? in : out).push_back(p);
+    }
+    Bvh bvh;
+    bvh.build(simplified.getVertices(), simplified.getFaces());
+    inside = pointsToSurface(in, bvh).rms;
+    outside = pointsToSurface(out, bvh).rms;
+}
+
+// Cost of importance weights in computeQEM(), and where they move the triangles: a curved grid simplified
+// with one corner weighted up, against uniform weights at the same face count.
+void benchImportance(const Model &model) {
+    printf("importance weights\n");
+    // the two passes alternate and the fastest of each counts, since the hash maps make single runs noisy
+    std::vector<float> weights(model.getVertices().size());
+    for (size_t v = 0; v < weights.size(); v++) {
+        weights[v] = 0.5f + (v % 7) * 0.5f;
+    }
+    Model uniform(model.getVertices(), model.getNormals(), model.getFaces());
+    Model weighted(model.getVertices(), model.getNormals(), model.getFaces());
+    weighted.setImportance(weights);
+    double uniformMs = INFINITY, weightedMs = INFINITY;
+    for (int run = 0; run < 10; run++) {
+        auto start = std::chrono::steady_clock::now();
+        uniform.computeQEM();
+        uniformMs = std::min(uniformMs, elapsedMs(start));
+        start = std::chrono::steady_clock::now();
+        weighted.computeQEM();
+        weightedMs = std::min(weightedMs, elapsedMs(start));
+    }
+    printf("  computeQEM  uniform %.3f ms, weighted %.3f ms (%.2fx)\n", uniformMs, weightedMs, weightedMs / uniformMs);
+
+    std::vector<glm::vec3> gridVertices;
+    std::vector<glm::ivec3> gridFaces;
+    makeGridMesh(24, gridVertices, gridFaces);
+    std::vector<glm::vec3> gridNormals = smoothNormals(gridVertices, gridFaces);
+    ImportanceBox box = {glm::vec3(0.0f, 0.0f, -10.0f), glm::vec3(4.0f, 4.0f, 10.0f), 10.0f};
+    for (float weight : {1.0f, box.weight}) {
+        Model grid(gridVertices, gridNormals, gridFaces);
+        if (weight != 1.0f) {
+            std::vector<float> gridWeights(gridVertices.size(), 1.0f);
+            applyImportanceBox(gridVertices, box, gridWeights);
+            grid.setImportance(gridWeights);
+        }
+        size_t target = gridFaces.size() / 4;
+        while (grid.getFaces().size() > target) {
+            if (!grid.collapseMeshQEM()) {
+                break;
+            }
+        }
+        size_t facesInside = 0;
+        for (const glm::ivec3 &f : grid.getFaces()) {
+            glm::vec3 centroid = (grid.getVertices()[f.x] + grid.getVertices()[f.y] + grid.getVertices()[f.z]) / 3.0f;
+            facesInside += insideImportanceBox(box, centroid);
+        }
+        float inside, outside;
+        regionRms(gridVertices, gridFaces, grid, box, inside, outside);
+        printf("  grid %lu -> %lu faces, box weight %4.1f: %3lu faces in the box, rms %.5f inside, %.5f outside\n",
+               gridFaces.size(), grid.getFaces().size(), weight, facesInside, inside, outside);
+    }
+}
+
+// Error of a mesh against its own simplifications: the sampled distances both ways, timed, and the forward
+// side recomputed by brute force over a subset of the samples to check the accelerated search.
+void benchMeshErrorMesh(const char* label, const std::vector<glm::vec3> &vertices, const std::vector<glm::ivec3> &faces) {
+    std::vector<bool> locked(vertices.size(), false);
+    for (float ratio : {0.5f, 0.1f}) {
+        std::vector<glm::ivec3> simplified = faces;
+        simplifyQEM(vertices, simplified, locked, (size_t) (faces.size() * ratio));
+
+        auto start = std::chrono::steady_clock::now();
+        MeshError error = meshError(vertices, faces, vertices, simplified);
+        double ms = elapsedMs(start);
+
+        // every vertex is a sample too, so a stride through them and the surface points keeps the check short
+        std::vector<glm::vec3> samples = sampleSurface(vertices, faces, 1000), points;
+        for (size_t i = 0; i < samples.size(); i += std::max<size_t>(samples.size() / 1000, 1)) {
+            points.push_back(samples[i]);
+        }
+        Bvh bvh;
+        bvh.build(vertices, simplified);
+        MeshDistance accelerated = pointsToSurface(points, bvh);
+        float hausdorff = 0.0f;
+        for (glm::vec3 p : points) {
+            hausdorff = std::max(hausdorff, closestDistanceAllFaces(vertices, simplified, p));
+        }
+        printf("  %-6s %7lu -> %7lu faces: hausdorff %.6f (%.6f / %.6f), rms %.6f in %.3f ms (%.2f M samples/s), brute force %s\n",
+               label, faces.size(), simplified.size(), error.hausdorff, error.forward.hausdorff,
+               error.backward.hausdorff, error.rms, ms, (error.forward.samples + error.backward.samples) / (ms * 1000.0),
+               hausdorff == accelerated.hausdorff ? "matches" : "DIFFERS");
+    }
+}
+
+void benchMeshError(const Model &model) {
+    printf("mesh error (%d samples a side, %u threads)\n", MESH_DISTANCE_DEFAULT_SAMPLES, workerCount());
+    benchMeshErrorMesh("model", model.getVertices(), model.getFaces());
+
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::ivec3> faces;
+    makeSphereMesh(512, 256, vertices, faces);
+    benchMeshErrorMesh("sphere", vertices, faces);
+}
+
+// The first pass of every simplifier here: each face's plane quadric added to its three vertices. Its vertex
+// reads and quadric writes follow the index order, which is what the spatial reorder is for.
+void accumulatePlaneQuadrics(const std::vector<glm::vec3> &vertices, const std::vector<glm::ivec3> &faces,
+                             std::vector<glm::mat4> &quadrics) {
+    quadrics.assign(vertices.size(), glm::mat4(0.0f));
+    for (const glm::ivec3 &f : faces) {
+        glm::mat4 Kp = computeKp(computePlaneCoeffs(vertices[f.x], vertices[f.y], vertices[f.z]));
+        quadrics[f.x] += Kp;
+        quadrics[f.y] += Kp;
+        quadrics[f.z] += Kp;
+    }
+}
+
+// A sphere with its vertices and faces shuffled, as some exporters write them, against the same mesh after
+// reorderMeshSpatially(): the time of the reorder, simulated cache misses of the position reads of a pass
+// over the faces at L2 and L3 sizes (FIFO, 64-byte lines), and the time of the quadric pass and of
+// Model::computeQEM() on both orders.
+void benchSpatialOrderMesh(int segments, int rings, bool withModel) {
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::ivec3> faces;
+    makeSphereMesh(segments, rings, vertices, faces);
+    std::mt19937 rng(1);
+    std::vector<int> shuffle(vertices.size());
+    for (size_t v = 0; v < shuffle.size(); v++) {
+        shuffle[v] = (int) v;
+    }
+    std::shuffle(shuffle.begin(), shuffle.end(), rng);
+    remapVertexStream(vertices, shuffle, vertices.size());
+    for (glm::ivec3 &f : faces) {
+        f = glm::ivec3(shuffle[f.x], shuffle[f.y], shuffle[f.z]);
+    }
+    std::shuffle(faces.begin(), faces.end(), rng);
+
+    std::vector<glm::vec3> sortedVertices = vertices;
+    std::vector<glm::ivec3> sortedFaces = faces;
+    auto start = std::chrono::steady_clock::now();
+    reorderMeshSpatially(sortedVertices, sortedFaces);
+    double reorderMs = elapsedMs(start);
+    printf("  %lu vertices, %lu faces: reorder %.3f ms\n", vertices.size(), faces.size(), reorderMs);
+
+    for (int sorted = 0; sorted < 2; sorted++) {
+        const std::vector<glm::vec3> &v = sorted ? sortedVertices : vertices;
+        const std::vector<glm::ivec3> &f = sorted ? sortedFaces : faces;
+        VertexFetchStats l2 = simulateVertexFetch(f, v.size(), sizeof(glm::vec3), (256 << 10) / FETCH_CACHE_LINE);
+        VertexFetchStats l3 = simulateVertexFetch(f, v.size(), sizeof(glm::vec3), (8 << 20) / FETCH_CACHE_LINE);
+        std::vector<glm::mat4> quadrics;
+        start = std::chrono::steady_clock::now();
+        accumulatePlaneQuadrics(v, f, quadrics);
+        double quadricMs = elapsedMs(start);
+        printf("    %-9s misses per face L2 %.3f, L3 %.3f | quadric pass %.3f ms", sorted ? "morton" : "shuffled",
+               (float) l2.bytesFetched / FETCH_CACHE_LINE / f.size(), (float) l3.bytesFetched / FETCH_CACHE_LINE / f.size(),
+               quadricMs);
+        if (withModel) {
+            Model model(v, std::vector<glm::vec3>(v.size(), glm::vec3(0.0f, 0.0f, 1.0f)), f);
+            start = std::chrono::steady_clock::now();
+            model.computeQEM();
+            printf(", computeQEM %.3f ms", elapsedMs(start));
+        }
+        printf("\n");
+    }
+}
+
+void benchSpatialOrder() {
+    printf("spatial reorder (%d-bit Morton codes, %d-bit radix digits, %u threads)\n", 3 * MORTON_AXIS_BITS,
+           RADIX_SORT_BITS, workerCount());
+    benchSpatialOrderMesh(512, 256, true);
+    benchSpatialOrderMesh(2048, 1024, false);
+}
+
+// Duplicates the vertices of a mesh the way scanners and STL exports do. Faces are grouped into patches by the
+// cube of side patchSize their centroid falls in, each patch gets its own copy of the vertices it uses, so
+// every vertex on a patch border is repeated, and the copies are jittered by up to jitter. patchSize 0 gives
+// every face its own three corners, as in STL.
+void splitIntoPatches(std::vector<glm::vec3> &vertices, std::vector<glm::ivec3> &faces, float patchSize, float jitter) {
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> offset(-jitter, jitter);
+    // patch cells numbered as they are met, then (patch, vertex) to the copy
+    std::unordered_map<uint64_t, uint64_t> patches;
+    std::unordered_map<uint64_t, int> copies;
+    std::vector<glm::vec3> split;
+    for (size_t f = 0; f < faces.size(); f++) {
+        uint64_t patch = f;
+        if (patchSize > 0.0f) {
+            glm::vec3 centroid = (vertices[faces[f].x] + vertices[faces[f].y] + vertices[faces[f].z]) / 3.0f;
+            glm::ivec3 cell = glm::ivec3(glm::floor(centroid / patchSize)) + glm::ivec3(1 << 20);
+            uint64_t cellKey = ((uint64_t) cell.x << 42) | ((uint64_t) cell.y << 21) | (uint64_t) cell.z;
+            patch = patches.emplace(cellKey, patches.size()).first->second;
+        }
+        for (int k = 0; k < 3; k++) {
+            uint64_t key = patch * vertices.size() + faces[f][k];
+            auto it = copies.find(key);
+            if (it == copies.end()) {
+                it = copies.emplace(key, (int) split.size()).first;
+                split.push_back(vertices[faces[f][k]] + glm::vec3(offset(rng), offset(rng), offset(rng)));
+            }
+            faces[f][k] = it->second;
+        }
+    }
+    vertices.swap(split);
+}
+
+// Welds a split sphere, checking it comes back whole: the indexed vertex count and every face. With a path,
+// the split mesh is also written there and read back with loadObj() first, to set the weld against the load
+// it follows.
+void benchWeldMesh(const char* label, int segments, int rings, float patchSize, const char* path) {
+    const float jitter = 1e-7f, epsilon = 1e-6f;
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::ivec3> faces;
+    makeSphereMesh(segments, rings, vertices, faces);
+    size_t expectedVertices = vertices.size(), expectedFaces = faces.size();
+    splitIntoPatches(vertices, faces, patchSize, jitter);
+
+    double loadMs = 0.0;
+    if (path) {
+        FILE* file = fopen(path, "w");
+        if (file == NULL) {
+            fprintf(stderr, "Unable to write %s\n", path);
+            return;
+        }
+        for (const glm::vec3 &v : vertices) {
+            fprintf(file, "v %.9g %.9g %.9g\n", v.x, v.y, v.z);
+        }
+        for (const glm::ivec3 &f : faces) {
+            fprintf(file, "f %d %d %d\n", f.x + 1, f.y + 1, f.z + 1);
+        }
+        fclose(file);
+        vertices.clear();
+        faces.clear();
+        std::vector<glm::vec3> normals;
+        auto start = std::chrono::steady_clock::now();
+        loadObj(path, vertices, faces, normals);
+        loadMs = elapsedMs(start);
+        remove(path);
+    }
+
+    size_t before = vertices.size();
+    auto start = std::chrono::steady_clock::now();
+    weldVertices(vertices, faces, epsilon);
+    double weldMs = elapsedMs(start);
+    bool whole = vertices.size() == expectedVertices && faces.size() == expectedFaces;
+    printf("  %-8s %8lu -> %8lu vertices, %8lu faces: weld %9.3f ms (%5.1f ns per vertex)", label, before,
+           vertices.size(), faces.size(), weldMs, weldMs * 1e6 / before);
+    if (path) {
+        printf(", load %.3f ms, weld %.1f%% of it", loadMs, 100.0 * weldMs / loadMs);
+    }
+    printf("%s\n", whole ? "" : " MISMATCH");
+}
+
+void benchWeld() {
+    printf("vertex welding (%u threads)\n", workerCount());
+    benchWeldMesh("patches", 512, 256, 0.25f, "bench_weld.obj");
+    benchWeldMesh("stl", 512, 256, 0.0f, "bench_weld.obj");
+    benchWeldMesh("patches", 2048, 1024, 0.25f, nullptr);
+    benchWeldMesh("stl", 2048, 1024, 0.0f, nullptr);
+}
+
+// connected parts of a mesh, counting only the vertices some face uses
+size_t countParts(size_t vertexCount, const std::vector<glm::ivec3> &faces) {
+    std::vector<int> parent(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++) {
+        parent[v] = (int) v;
+    }
+    auto find = [&](int v) {
+        while (parent[v] != v) {
+            parent[v] = parent[parent[v]];
+            v = parent[v];
+        }
+        return v;
+    };
+    std::vector<uint8_t> used(vertexCount, 0);
+    for (const glm::ivec3 &f : faces) {
+        used[f.x] = used[f.y] = used[f.z] = 1;
+        parent[find(f.y)] = find(f.x);
+        parent[find(f.z)] = find(f.x);
+    }
+    size_t parts = 0;
+    for (size_t v = 0; v < vertexCount; v++) {
+        parts += used[v] && find((int) v) == (int) v;
+    }
+    return parts;
+}
+
+// What virtual pairs are for: a sphere in patches with duplicated, jittered seams, simplified to a quarter of
+// its faces with edges only and with pairs across the seams. Edges alone keep every patch apart; the pairs
+// stitch them back together as they go.
+void benchVirtualPairSimplify() {
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::ivec3> faces;
+    makeSphereMesh(64, 32, vertices, faces);
+    std::vector<glm::vec3> originalVertices = vertices;
+    std::vector<glm::ivec3> originalFaces = faces;
+    splitIntoPatches(vertices, faces, 0.5f, 1e-4f);
+    std::vector<glm::vec3> normals = smoothNormals(vertices, faces);
+
+    printf("virtual pair simplification (%lu faces in %lu parts)\n", faces.size(), countParts(vertices.size(), faces));
+    for (float threshold : {0.0f, 1e-3f}) {
+        Model model(vertices, normals, faces);
+        if (threshold > 0.0f) {
+            model.setPairThreshold(threshold);
+        }
+        size_t target = faces.size() / 4;
+        size_t collapses = 0;
+        auto start = std::chrono::steady_clock::now();
+        while (model.getFaces().size() > target && model.collapseMeshQEM()) {
+            collapses++;
+        }
+        double ms = elapsedMs(start);
+        MeshError error = meshError(originalVertices, originalFaces, model.getVertices(), model.getFaces(), 100000);
+        printf("  t = %-6g %5lu faces in %3lu parts after %4lu collapses: rms %.5f, hausdorff %.5f (%.1f ms)\n",
+               threshold, model.getFaces().size(), countParts(model.getVertices().size(), model.getFaces()),
+               collapses, error.rms, error.hausdorff, ms);
+    }
+}
+
+// frustum and cone culling of synthetic chunks scattered around the camera: the scalar loop, the batched test
+// on one thread and the batched test across all threads
+void benchChunkCulling(size_t count) {
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> position(-50.0f, 50.0f);
+    std::uniform_real_distribution<float> size(0.1f, 2.0f);
+    std::uniform_real_distribution<float> direction(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> cutoff(-0.2f, 1.0f);
+
+    ChunkBounds bounds;
+    for (size_t i = 0; i < count; i++) {
+        glm::vec3 axis = glm::normalize(glm::vec3(direction(rng), direction(rng), direction(rng)) + glm::vec3(0.0f, 0.0f, 1e-3f));
+        addChunk(bounds, glm::vec3(position(rng), position(rng), position(rng)), size(rng), axis, cutoff(rng));
+    }
+    glm::vec3 eye(0.0f, 5.0f, 40.0f);
+    glm::mat4 viewProjection = glm::perspective(glm::radians(45.0f), 1.5f, 0.1f, 100.0f) *
+                               glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    Frustum frustum = extractFrustum(viewProjection);
+
+    const int runs = 20;
+    std::vector<uint8_t> reference(count);
+    auto start = std::chrono::steady_clock::now();
+    for (int run = 0; run < runs; run++) {
+        for (size_t i = 0; i < count; i++) {
+            glm::vec3 center(bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]);
+            glm::vec3 axis(bounds.axisX[i], bounds.axisY[i], bounds.axisZ[i]);
+            reference[i] = !sphereOutsideFrustum(frustum, center, bounds.radius[i]) &&
+                           !coneBackfacing(center, bounds.radius[i], axis, bounds.cutoff[i], eye);
+        }
+    }
+    double scalarMs = elapsedMs(start) / runs;
+
+    std::vector<uint8_t> batched((count + CULL_BATCH - 1) / CULL_BATCH * CULL_BATCH);
+    start = std::chrono::steady_clock::now();
+    for (int run = 0; run < runs; run++) {
+        for (size_t first = 0; first < count; first += CULL_BATCH) {
+            cullChunkBatch(bounds, frustum, eye, first, batched.data());
+        }
+    }
+    double batchedMs = elapsedMs(start) / runs;
+
+    std::vector<uint8_t> threaded;
+    start = std::chrono::steady_clock::now();
+    for (int run = 0; run < runs; run++) {
+        cullChunks(bounds, frustum, eye, threaded);
+    }
+    double threadedMs = elapsedMs(start) / runs;
+
+    size_t visible = 0;
+    size_t mismatches = 0;
+    for (size_t i = 0; i < count; i++) {
+        visible += reference[i];
+        mismatches += reference[i] != batched[i] || reference[i] != threaded[i];
+    }
+    printf("chunk culling (%lu chunks, %lu visible, %lu mismatches)\n", count, visible, mismatches);
+    printf("  scalar     %.3f ms\n", scalarMs);
+    printf("  batched    %.3f ms (%d wide)\n", batchedMs, CULL_BATCH);
+    printf("  threaded   %.3f ms (%u threads)\n", threadedMs, workerCount());
+}
+
+int runBenchmarks(const char* path, float targetRatio) {
+    Model* model = loadSimplified(path, targetRatio);
+
+    benchVertexCache(*model);
+    benchMeshlets(*model);
+    benchVertexFetch(*model);
+    benchQuantization(*model);
+    benchClusterLod(*model);
+    benchPlacement(*model);
+    benchAttributeQuadrics(*model);
+    benchImportance(*model);
+    benchQueuePolicies(*model);
+    benchVirtualPairs(*model);
+    benchBvh(*model);
+    benchMeshError(*model);
+    benchSpatialOrder();
+    benchWeld();
+    benchVirtualPairSimplify();
+    benchChunkCulling(100000);
+
+    delete model;
+    return 0;
+}
+
+// simplify, optimize and write the meshlet tables of a model
+bool exportMeshlets(const char* path, const char* outPath, float targetRatio) {
+    Model* model = loadSimplified(path, targetRatio);
+    model->optimizeVertexCache();
+    model->buildMeshlets();
+    model->optimizeVertexFetch();
+    bool ok = model->saveMeshlets(outPath);
+    if (ok) {
+        printf("wrote %lu meshlets to %s\n", model->getMeshlets().meshlets.size(), outPath);
+    }
+    delete model;
+    return ok;
+}
+
+// build and write the cluster LOD DAG of a model
+bool exportClusterDag(const char* path, const char* outPath) {
+    Model model(path);
+    auto start = std::chrono::steady_clock::now();
+    ClusterDag dag = buildClusterDag(model.getVertices(), model.getNormals(), model.getFaces());
+    bool ok = writeClusterDag(outPath, dag);
+    if (ok) {
+        printf("wrote %lu clusters in %d levels to %s (%.3f ms)\n", dag.clusters.size(), dag.levels, outPath, elapsedMs(start));
+    }
+    return ok;
+}
+
+// Render every LOD of a model with the software rasterizer to <prefix>_lod<k>.png, framed on its bounding
+// sphere from the viewer's default direction. The full resolution mesh is also split into meshlets and tested
+// against the Hi-Z buffer of its own depth, to show how many survive cone culling only to be hidden.
+bool exportThumbnails(const char* path, const char* prefix, int size) {
+    Model model(path);
+    const std::vector<glm::vec3> &vertices = model.getVertices();
+    glm::vec3 center;
+    float radius;
+    computeBoundingSphere(vertices, center, radius);
+
+    float fov = glm::radians(45.0f);
+    float distance = radius / std::sin(fov / 2.0f);
+    glm::vec3 eye = center + distance * glm::normalize(glm::vec3(-0.25f, 0.45f, 1.0f));
+    glm::mat4 view = glm::lookAt(eye, center, glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(fov, 1.0f, std::max(distance - radius, 1e-3f * distance), distance + radius);
+    FrameConstants constants = makeFrameConstants(glm::mat4(1.0f), view, projection, glm::vec3(1.0f, 2.0f, 1.0f), eye);
+
+    SoftwareRasterizer rasterizer(size, size);
+    std::vector<bool> locked(vertices.size(), false);
+    printf("thumbnails (%dx%d, %u threads)\n", size, size, workerCount());
+    for (int lod = 0; lod < 5; lod++) {
+        std::vector<glm::ivec3> faces = model.getFaces();
+        if (lod > 0) {
+            simplifyQEM(vertices, faces, locked, faces.size() >> lod);
+        }
+        auto start = std::chrono::steady_clock::now();
+        rasterizer.clear(glm::vec3(0.82f, 0.93f, 0.99f));
+        rasterizer.drawMesh(vertices, model.getNormals(), faces, constants);
+        double ms = elapsedMs(start);
+
+        char file[1024];
+        snprintf(file, sizeof(file), "%s_lod%d.png", prefix, lod);
+        if (!rasterizer.writePng(file)) {
+            return false;
+        }
+        printf("  %s: %lu triangles in %.3f ms\n", file, faces.size(), ms);
+    }
+
+    // occlusion of the full mesh by itself
+    std::vector<glm::ivec3> faces = model.getFaces();
+    MeshletData meshlets = buildMeshlets(vertices, faces);
+    rasterizer.clear(glm::vec3(0.0f));
+    auto start = std::chrono::steady_clock::now();
+    rasterizer.drawMesh(vertices, model.getNormals(), faces, constants, false);
+    HiZBuffer hiz;
+    rasterizer.buildHiZ(hiz);
+    double ms = elapsedMs(start);
+
+    glm::mat4 viewProjection = projection * view;
+    Frustum frustum = extractFrustum(viewProjection);
+    size_t coneCulled = 0, occluded = 0;
+    for (const Meshlet &m : meshlets.meshlets) {
+        if (sphereOutsideFrustum(frustum, m.center, m.radius) || coneBackfacing(m.center, m.radius, m.coneAxis, m.coneCutoff, eye)) {
+            coneCulled++;
+        }
+        else if (sphereOccluded(hiz, viewProjection, m.center, m.radius)) {
+            occluded++;
+        }
+    }
+    printf("  occlusion: %lu meshlets, %lu frustum/cone culled, %lu occluded (depth + %dx%d Hi-Z in %.3f ms)\n",
+           meshlets.meshlets.size(), coneCulled, occluded, hiz.width, hiz.height, ms);
+    return true;
+}
+
+// simplify a model to targetRatio of its faces and report its distance from the original
+bool reportMeshError(const char* path, float targetRatio, size_t samples) {
+    Model* model = loadModel(path);
+    if (model->getFaces().empty()) {
+        fprintf(stderr, "no faces in %s\n", path);
+        delete model;
+        return false;
+    }
+    std::vector<glm::vec3> originalVertices = model->getVertices();
+    std::vector<glm::ivec3> originalFaces = model->getFaces();
+    simplifyModel(*model, targetRatio);
+
+    auto start = std::chrono::steady_clock::now();
+    MeshError error = meshError(originalVertices, originalFaces, model->getVertices(), model->getFaces(), samples);
+    printf("original -> simplified: hausdorff %g, rms %g, mean %g\n", error.forward.hausdorff, error.forward.rms,
+           error.forward.mean);
+    printf("simplified -> original: hausdorff %g, rms %g, mean %g\n", error.backward.hausdorff, error.backward.rms,
+           error.backward.mean);
+    printf("symmetric: hausdorff %g, rms %g (%lu samples in %.3f ms)\n", error.hausdorff, error.rms,
+           error.forward.samples + error.backward.samples, elapsedMs(start));
+    delete model;
+    return true;
+}
+
+// distance between two meshes, e.g. an original and a simplification written by another tool
+bool reportMeshDistance(const char* pathA, const char* pathB, size_t samples) {
+    Model a(pathA), b(pathB);
+    if (a.getFaces().empty() || b.getFaces().empty()) {
+        fprintf(stderr, "no faces in %s\n", a.getFaces().empty() ? pathA : pathB);
+        return false;
+    }
+    auto start = std::chrono::steady_clock::now();
+    MeshError error = meshError(a.getVertices(), a.getFaces(), b.getVertices(), b.getFaces(), samples);
+    printf("%s -> %s: hausdorff %g, rms %g, mean %g\n", pathA, pathB, error.forward.hausdorff, error.forward.rms,
+           error.forward.mean);
+    printf("%s -> %s: hausdorff %g, rms %g, mean %g\n", pathB, pathA, error.backward.hausdorff, error.backward.rms,
+           error.backward.mean);
+    printf("symmetric: hausdorff %g, rms %g (%lu samples in %.3f ms)\n", error.hausdorff, error.rms,
+           error.forward.samples + error.backward.samples, elapsedMs(start));
+    return true;
+}
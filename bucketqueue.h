@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+// mantissa bits kept in a bucket index: each octave of error is split into 2^bits buckets
+#define BUCKET_QUEUE_DEFAULT_BITS 3
+
+// Approximate min-priority queue on non-negative float keys. The bucket of a key is the top bits of its IEEE
+// pattern, the exponent and precisionBits of mantissa, which is log2(key) quantized to 2^-precisionBits of an
+// octave. Positive floats order like their bit patterns, so bucket order is key order and push is a shift.
+// Entries within a bucket come out last in, first out, so a pop may return a key up to (1 + 2^-precisionBits)
+// times the true minimum. An occupancy bitmask lets pop skip empty buckets 64 at a time.
+//
+// Keys are taken as-is: zero and negative keys share the first bucket, infinity and NaN sort after every
+// finite key.
+template <typename T>
+class BucketQueue {
+public:
+    BucketQueue(int precisionBits = BUCKET_QUEUE_DEFAULT_BITS)
+        : _shift(23 - precisionBits), _buckets((size_t) 256 << precisionBits),
+          _occupied((_buckets.size() + 63) / 64, 0) {}
+
+    bool empty() const { return _size == 0; }
+    size_t size() const { return _size; }
+
+    void push(float key, const T &value) {
+        size_t b = bucketOf(key);
+        _buckets[b].emplace_back(key, value);
+        _occupied[b / 64] |= (uint64_t) 1 << (b % 64);
+        if (b < _lowest) {
+            _lowest = b;
+        }
+        _size++;
+    }
+
+    // the entry pop() removes next, as (key, value) like a multimap element. The queue must not be empty.
+    const std::pair<float, T>& top() {
+        return _buckets[findLowest()].back();
+    }
+
+    void pop() {
+        size_t b = findLowest();
+        _buckets[b].pop_back();
+        if (_buckets[b].empty()) {
+            _occupied[b / 64] &= ~((uint64_t) 1 << (b % 64));
+        }
+        _size--;
+    }
+
+    void clear() {
+        for (size_t word = 0; word < _occupied.size(); word++) {
+            for (uint64_t bits = _occupied[word]; bits; bits &= bits - 1) {
+                _buckets[word * 64 + __builtin_ctzll(bits)].clear();
+            }
+            _occupied[word] = 0;
+        }
+        _lowest = 0;
+        _size = 0;
+    }
+
+private:
+    int _shift;
+    std::vector<std::vector<std::pair<float, T>>> _buckets;
+    std::vector<uint64_t> _occupied;
+    // no bucket below this holds anything
+    size_t _lowest = 0;
+    size_t _size = 0;
+
+    size_t bucketOf(float key) const {
+        uint32_t bits;
+        std::memcpy(&bits, &key, sizeof(bits));
+        if (bits & 0x80000000u) {
+            return 0;
+        }
+        size_t b = bits >> _shift;
+        return b < _buckets.size() ? b : _buckets.size() - 1;
+    }
+
+    size_t findLowest() {
+        size_t word = _lowest / 64;
+        uint64_t bits = _occupied[word] & (~(uint64_t) 0 << (_lowest % 64));
+        while (bits == 0) {
+            bits = _occupied[++word];
+        }
+        _lowest = word * 64 + __builtin_ctzll(bits);
+        return _lowest;
+    }
+};
@@ -0,0 +1,607 @@
+#pragma once
+
+#include "parallel.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// children per node, the width of an SSE register
+#define BVH_WIDTH 4
+// centroid bins per axis in the SAH sweep
+#define BVH_BINS 16
+// triangles per leaf, at most 7 so the count fits the leaf encoding
+#define BVH_MAX_LEAF 4
+// ranges smaller than this are never handed to another thread
+#define BVH_PARALLEL_MIN 4096
+#define BVH_STACK_SIZE 256
+
+// child slot holding nothing; its box is inverted so it is never closest, and traversal skips it for rays
+#define BVH_EMPTY (~0)
+
+struct BvhHit {
+    float t = INFINITY;
+    // index into the faces the BVH was built over, -1 when nothing was hit
+    int face = -1;
+    // barycentric coordinates of the hit point with respect to the face's second and third vertex
+    float u = 0.0f;
+    float v = 0.0f;
+};
+
+struct BvhClosest {
+    glm::vec3 point = glm::vec3(0.0f);
+    float distance = INFINITY;
+    int face = -1;
+};
+
+// Four child boxes as structure of arrays, so one node is tested against a ray or a point with one SSE
+// operation per field. A child is an interior node index when >= 0, otherwise a leaf encoded as
+// ~(first primitive << 3 | triangle count).
+struct BvhNode {
+    float minX[BVH_WIDTH], minY[BVH_WIDTH], minZ[BVH_WIDTH];
+    float maxX[BVH_WIDTH], maxY[BVH_WIDTH], maxZ[BVH_WIDTH];
+    int32_t child[BVH_WIDTH];
+};
+
+// closest point to p on triangle abc (Ericson, Real-Time Collision Detection 5.1.5)
+glm::vec3 closestPointOnTriangle(glm::vec3 p, glm::vec3 a, glm::vec3 b, glm::vec3 c) {
+    glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+    float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+    if (d1 <= 0.0f && d2 <= 0.0f) {
+        return a;
+    }
+    glm::vec3 bp = p - b;
+    float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+    if (d3 >= 0.0f && d4 <= d3) {
+        return b;
+    }
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+        return a + ab * (d1 / (d1 - d3));
+    }
+    glm::vec3 cp = p - c;
+    float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+    if (d6 >= 0.0f && d5 <= d6) {
+        return c;
+    }
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+        return a + ac * (d2 / (d2 - d6));
+    }
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f) {
+        return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+    }
+    float denom = 1.0f / (va + vb + vc);
+    return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+// Moller-Trumbore, two-sided. Returns the distance along direction, or INFINITY on a miss.
+float intersectTriangle(glm::vec3 origin, glm::vec3 direction, glm::vec3 a, glm::vec3 b, glm::vec3 c,
+                        float &u, float &v) {
+    glm::vec3 e1 = b - a, e2 = c - a;
+    glm::vec3 pv = glm::cross(direction, e2);
+    float det = glm::dot(e1, pv);
+    if (std::fabs(det) < 1e-12f) {
+        return INFINITY;
+    }
+    float invDet = 1.0f / det;
+    glm::vec3 tv = origin - a;
+    u = glm::dot(tv, pv) * invDet;
+    if (u < 0.0f || u > 1.0f) {
+        return INFINITY;
+    }
+    glm::vec3 qv = glm::cross(tv, e1);
+    v = glm::dot(direction, qv) * invDet;
+    if (v < 0.0f || u + v > 1.0f) {
+        return INFINITY;
+    }
+    float t = glm::dot(e2, qv) * invDet;
+    return t >= 0.0f ? t : INFINITY;
+}
+
+// Bounding volume hierarchy over a triangle mesh for ray and closest-point queries.
+//
+// build() makes a binary tree with a binned surface area heuristic: primitives are sorted into BVH_BINS
+// centroid bins per axis and the cheapest of the bin boundaries is taken. The top of the tree is split on the
+// calling thread until there are a few independent ranges per core, then the ranges are built in parallel and
+// spliced in. The binary tree is then collapsed into BVH_WIDTH-wide nodes by repeatedly opening the child with
+// the largest surface area, and queries test the four child boxes of a node at once.
+//
+// Nodes are stored parents before children, so refit() can recompute every box in one backward pass.
+class Bvh {
+public:
+    void build(const std::vector<glm::vec3> &vertices, const std::vector<glm::ivec3> &faces);
+    // recompute the boxes for new vertex positions or indices, keeping the tree. faces must have the same
+    // count and order as when built, e.g. after optimizeVertexFetch() renumbered the vertices.
+    void refit(const std::vector<glm::vec3> &vertices, const std::vector<glm::ivec3> &faces);
+
+    // nearest hit along the ray within [0, tMax)
+    bool intersect(glm::vec3 origin, glm::vec3 direction, float tMax, BvhHit &hit) const;
+    // closest point on the mesh within maxDistance of p
+    bool closestPoint(glm::vec3 p, float maxDistance, BvhClosest &closest) const;
+
+    size_t getNodeCount() const { return _nodes.size(); }
+    size_t getTriangleCount() const { return _faceIndex.size(); }
+
+private:
+    std::vector<BvhNode> _nodes;
+    // face of each primitive, in leaf order, and its corners copied out so leaves read memory in sequence
+    std::vector<uint32_t> _faceIndex;
+    std::vector<glm::vec3> _corners;
+
+    struct BinaryNode {
+        glm::vec3 lo, hi;
+        int left = -1, right = -1;
+        uint32_t first = 0, count = 0;
+    };
+
+    // build state, only alive during build(). Each triangle's box and centroid travel with its index and are
+    // partitioned in place, so every pass over a range reads memory in sequence.
+    struct BuildBox {
+        float lo[3], hi[3], centroid[3];
+        uint32_t primitive;
+    };
+    struct BuildInput {
+        std::vector<BuildBox> boxes;
+    };
+
+    static float area(glm::vec3 lo, glm::vec3 hi) {
+        glm::vec3 d = glm::max(hi - lo, glm::vec3(0.0f));
+        return d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+
+    static uint32_t splitRange(BuildInput &input, uint32_t first, uint32_t count, const float* cmin, const float* cmax);
+    static int buildBinary(BuildInput &input, std::vector<BinaryNode> &nodes, uint32_t first, uint32_t count,
+                           int parallelDepth, std::vector<int> *tasks);
+    int collapse(const std::vector<BinaryNode> &binary, int b);
+    void refitNodes();
+};
+
+// SAH split of primitives [first, first + count), whose centroids lie in [cmin, cmax]: partitions them and
+// returns the size of the left part, or 0 to make a leaf
+uint32_t Bvh::splitRange(BuildInput &input, uint32_t first, uint32_t count, const float* cmin, const float* cmax) {
+    if (count <= BVH_MAX_LEAF) {
+        return 0;
+    }
+
+    // one pass fills the bins of all three axes. Small ranges use fewer bins, since setting up and sweeping
+    // the bins would otherwise cost more than binning the few primitives.
+    int bins = std::min(BVH_BINS, (int) count);
+    float scale[3];
+    for (int axis = 0; axis < 3; axis++) {
+        float extent = cmax[axis] - cmin[axis];
+        scale[axis] = extent > 0.0f ? bins * (1.0f - 1e-6f) / extent : 0.0f;
+    }
+    uint32_t binCount[3][BVH_BINS] = {};
+    float binLo[3][BVH_BINS][3], binHi[3][BVH_BINS][3];
+    for (int axis = 0; axis < 3; axis++) {
+        for (int b = 0; b < bins; b++) {
+            for (int k = 0; k < 3; k++) {
+                binLo[axis][b][k] = INFINITY;
+                binHi[axis][b][k] = -INFINITY;
+            }
+        }
+    }
+    for (uint32_t i = first; i < first + count; i++) {
+        const BuildBox &box = input.boxes[i];
+        for (int axis = 0; axis < 3; axis++) {
+            int b = std::min((int) ((box.centroid[axis] - cmin[axis]) * scale[axis]), bins - 1);
+            binCount[axis][b]++;
+            for (int k = 0; k < 3; k++) {
+                binLo[axis][b][k] = std::min(binLo[axis][b][k], box.lo[k]);
+                binHi[axis][b][k] = std::max(binHi[axis][b][k], box.hi[k]);
+            }
+        }
+    }
+
+    float bestCost = INFINITY;
+    int bestAxis = -1, bestSplit = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        if (scale[axis] == 0.0f) {
+            continue;
+        }
+        // area and count of everything left of each boundary, then sweep back from the right
+        float leftArea[BVH_BINS];
+        uint32_t leftCount[BVH_BINS];
+        glm::vec3 lo(INFINITY), hi(-INFINITY);
+        uint32_t n = 0;
+        for (int b = 0; b < bins - 1; b++) {
+            lo = glm::min(lo, glm::vec3(binLo[axis][b][0], binLo[axis][b][1], binLo[axis][b][2]));
+            hi = glm::max(hi, glm::vec3(binHi[axis][b][0], binHi[axis][b][1], binHi[axis][b][2]));
+            n += binCount[axis][b];
+            leftArea[b] = area(lo, hi);
+            leftCount[b] = n;
+        }
+        lo = glm::vec3(INFINITY);
+        hi = glm::vec3(-INFINITY);
+        n = 0;
+        for (int b = bins - 1; b > 0; b--) {
+            lo = glm::min(lo, glm::vec3(binLo[axis][b][0], binLo[axis][b][1], binLo[axis][b][2]));
+            hi = glm::max(hi, glm::vec3(binHi[axis][b][0], binHi[axis][b][1], binHi[axis][b][2]));
+            n += binCount[axis][b];
+            if (leftCount[b - 1] == 0 || n == 0) {
+                continue;
+            }
+            float cost = leftArea[b - 1] * leftCount[b - 1] + area(lo, hi) * n;
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = b;
+            }
+        }
+    }
+
+    BuildBox* begin = input.boxes.data() + first;
+    BuildBox* end = begin + count;
+    BuildBox* middle = begin + count / 2;
+    if (bestAxis >= 0) {
+        float axisScale = scale[bestAxis];
+        float minimum = cmin[bestAxis];
+        middle = std::partition(begin, end, [&](const BuildBox &box) {
+            return std::min((int) ((box.centroid[bestAxis] - minimum) * axisScale), bins - 1) < bestSplit;
+        });
+    }
+    // all centroids coincide: any halving is as good as another
+    if (middle == begin || middle == end) {
+        middle = begin + count / 2;
+    }
+    return (uint32_t) (middle - begin);
+}
+
+// Builds the subtree over [first, first + count) into nodes and returns its root. At parallelDepth 0 a large
+// range is not built but left as a placeholder node and recorded in tasks.
+int Bvh::buildBinary(BuildInput &input, std::vector<BinaryNode> &nodes, uint32_t first, uint32_t count,
+                     int parallelDepth, std::vector<int> *tasks) {
+    int index = (int) nodes.size();
+    nodes.emplace_back();
+    // node bounds and centroid bounds in one pass
+    float lo[3] = {INFINITY, INFINITY, INFINITY}, hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+    float cmin[3] = {INFINITY, INFINITY, INFINITY}, cmax[3] = {-INFINITY, -INFINITY, -INFINITY};
+    for (uint32_t i = first; i < first + count; i++) {
+        const BuildBox &box = input.boxes[i];
+        for (int k = 0; k < 3; k++) {
+            lo[k] = std::min(lo[k], box.lo[k]);
+            hi[k] = std::max(hi[k], box.hi[k]);
+            cmin[k] = std::min(cmin[k], box.centroid[k]);
+            cmax[k] = std::max(cmax[k], box.centroid[k]);
+        }
+    }
+    BinaryNode node;
+    node.lo = glm::vec3(lo[0], lo[1], lo[2]);
+    node.hi = glm::vec3(hi[0], hi[1], hi[2]);
+    node.first = first;
+    node.count = count;
+
+    if (tasks && parallelDepth == 0 && count > BVH_PARALLEL_MIN) {
+        nodes[index] = node;
+        tasks->push_back(index);
+        return index;
+    }
+    uint32_t left = splitRange(input, first, count, cmin, cmax);
+    if (left > 0) {
+        node.left = buildBinary(input, nodes, first, left, parallelDepth - 1, tasks);
+        node.right = buildBinary(input, nodes, first + left, count - left, parallelDepth - 1, tasks);
+        node.count = 0;
+    }
+    nodes[index] = node;
+    return index;
+}
+
+void Bvh::build(const std::vector<glm::vec3> &vertices, const std::vector<glm::ivec3> &faces) {
+    _nodes.clear();
+    BuildInput input;
+    size_t count = faces.size();
+    input.boxes.resize(count);
+    parallelFor(count, BVH_PARALLEL_MIN, [&](size_t i) {
+        glm::vec3 a = vertices[faces[i].x], b = vertices[faces[i].y], c = vertices[faces[i].z];
+        BuildBox &box = input.boxes[i];
+        for (int k = 0; k < 3; k++) {
+            box.lo[k] = std::min(a[k], std::min(b[k], c[k]));
+            box.hi[k] = std::max(a[k], std::max(b[k], c[k]));
+            box.centroid[k] = (box.lo[k] + box.hi[k]) * 0.5f;
+        }
+        box.primitive = (uint32_t) i;
+    });
+
+    // split serially until there are about four ranges per core, build those in parallel, then splice each
+    // subtree in place of its placeholder. Subtree node i > 0 lands at offset + i, its root on the placeholder.
+    std::vector<BinaryNode> binary;
+    std::vector<int> tasks;
+    int parallelDepth = 0;
+    while ((1u << parallelDepth) < 4 * workerCount() && workerCount() > 1) {
+        parallelDepth++;
+    }
+    buildBinary(input, binary, 0, (uint32_t) count, parallelDepth, workerCount() > 1 ? &tasks : nullptr);
+    std::vector<std::vector<BinaryNode>> subtrees(tasks.size());
+    parallelFor(tasks.size(), 1, [&](size_t t) {
+        const BinaryNode &placeholder = binary[tasks[t]];
+        buildBinary(input, subtrees[t], placeholder.first, placeholder.count, 0, nullptr);
+    });
+    for (size_t t = 0; t < tasks.size(); t++) {
+        int offset = (int) binary.size() - 1;
+        auto shift = [&](BinaryNode node) {
+            if (node.left >= 0) {
+                node.left += offset;
+                node.right += offset;
+            }
+            return node;
+        };
+        binary[tasks[t]] = shift(subtrees[t][0]);
+        for (size_t i = 1; i < subtrees[t].size(); i++) {
+            binary.push_back(shift(subtrees[t][i]));
+        }
+    }
+
+    _faceIndex.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        _faceIndex[i] = input.boxes[i].primitive;
+    }
+    _corners.resize(count * 3);
+    if (count > 0) {
+        collapse(binary, 0);
+    }
+    refit(vertices, faces);
+}
+
+// BVH_WIDTH-wide node for binary node b, opening the largest interior child until the node is full
+int Bvh::collapse(const std::vector<BinaryNode> &binary, int b) {
+    int index = (int) _nodes.size();
+    _nodes.emplace_back();
+
+    int children[BVH_WIDTH];
+    int count = 0;
+    if (binary[b].left >= 0) {
+        children[count++] = binary[b].left;
+        children[count++] = binary[b].right;
+    } else {
+        children[count++] = b;
+    }
+    while (count < BVH_WIDTH) {
+        int largest = -1;
+        float largestArea = -1.0f;
+        for (int k = 0; k < count; k++) {
+            const BinaryNode &child = binary[children[k]];
+            if (child.left >= 0 && area(child.lo, child.hi) > largestArea) {
+                largest = k;
+                largestArea = area(child.lo, child.hi);
+            }
+        }
+        if (largest < 0) {
+            break;
+        }
+        int opened = children[largest];
+        children[largest] = binary[opened].left;
+        children[count++] = binary[opened].right;
+    }
+
+    int32_t codes[BVH_WIDTH];
+    for (int k = 0; k < BVH_WIDTH; k++) {
+        if (k >= count) {
+            codes[k] = BVH_EMPTY;
+        } else if (binary[children[k]].left < 0) {
+            codes[k] = ~(int32_t) (binary[children[k]].first << 3 | binary[children[k]].count);
+        } else {
+            codes[k] = collapse(binary, children[k]);
+        }
+    }
+    for (int k = 0; k < BVH_WIDTH; k++) {
+        _nodes[index].child[k] = codes[k];
+    }
+    return index;
+}
+
+void Bvh::refit(const std::vector<glm::vec3> &vertices, const std::vector<glm::ivec3> &faces) {
+    parallelFor(_faceIndex.size(), BVH_PARALLEL_MIN, [&](size_t p) {
+        glm::ivec3 face = faces[_faceIndex[p]];
+        for (int k = 0; k < 3; k++) {
+            _corners[p * 3 + k] = vertices[face[k]];
+        }
+    });
+    refitNodes();
+}
+
+void Bvh::refitNodes() {
+    for (size_t n = _nodes.size(); n-- > 0;) {
+        BvhNode &node = _nodes[n];
+        for (int k = 0; k < BVH_WIDTH; k++) {
+            glm::vec3 lo(INFINITY), hi(-INFINITY);
+            int32_t code = node.child[k];
+            if (code >= 0) {
+                const BvhNode &child = _nodes[code];
+                for (int j = 0; j < BVH_WIDTH; j++) {
+                    lo = glm::min(lo, glm::vec3(child.minX[j], child.minY[j], child.minZ[j]));
+                    hi = glm::max(hi, glm::vec3(child.maxX[j], child.maxY[j], child.maxZ[j]));
+                }
+            } else {
+                uint32_t first = (uint32_t) ~code >> 3, triangles = (uint32_t) ~code & 7;
+                for (uint32_t i = first * 3; i < (first + triangles) * 3; i++) {
+                    lo = glm::min(lo, _corners[i]);
+                    hi = glm::max(hi, _corners[i]);
+                }
+            }
+            node.minX[k] = lo.x;
+            node.minY[k] = lo.y;
+            node.minZ[k] = lo.z;
+            node.maxX[k] = hi.x;
+            node.maxY[k] = hi.y;
+            node.maxZ[k] = hi.z;
+        }
+    }
+}
+
+bool Bvh::intersect(glm::vec3 origin, glm::vec3 direction, float tMax, BvhHit &hit) const {
+    hit = BvhHit();
+    hit.t = tMax;
+    if (_nodes.empty()) {
+        return false;
+    }
+    // a zero component becomes a huge inverse rather than inf, so (bound - origin) * inverse is never NaN
+    glm::vec3 inverse;
+    for (int a = 0; a < 3; a++) {
+        inverse[a] = 1.0f / (std::fabs(direction[a]) > 1e-30f ? direction[a] : 1e-30f);
+    }
+
+    int32_t stack[BVH_STACK_SIZE];
+    float stackNear[BVH_STACK_SIZE];
+    int top = 0;
+    stack[top] = 0;
+    stackNear[top++] = 0.0f;
+    while (top > 0) {
+        top--;
+        int32_t code = stack[top];
+        if (stackNear[top] >= hit.t) {
+            continue;
+        }
+        if (code < 0) {
+            uint32_t first = (uint32_t) ~code >> 3, triangles = (uint32_t) ~code & 7;
+            for (uint32_t p = first; p < first + triangles; p++) {
+                float u, v;
+                float t = intersectTriangle(origin, direction, _corners[p * 3], _corners[p * 3 + 1],
+                                            _corners[p * 3 + 2], u, v);
+                if (t < hit.t) {
+                    hit.t = t;
+                    hit.face = (int) _faceIndex[p];
+                    hit.u = u;
+                    hit.v = v;
+                }
+            }
+            continue;
+        }
+
+        const BvhNode &node = _nodes[code];
+        float tNear[BVH_WIDTH];
+        int mask = 0;
+#if defined(__SSE2__)
+        __m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+        __m128 ix = _mm_set1_ps(inverse.x), iy = _mm_set1_ps(inverse.y), iz = _mm_set1_ps(inverse.z);
+        __m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minX), ox), ix);
+        __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxX), ox), ix);
+        __m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minY), oy), iy);
+        __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxY), oy), iy);
+        __m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ), oz), iz);
+        __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxZ), oz), iz);
+        __m128 enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)),
+                                  _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_setzero_ps()));
+        __m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)),
+                                 _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(hit.t)));
+        mask = _mm_movemask_ps(_mm_cmple_ps(enter, exit));
+        _mm_storeu_ps(tNear, enter);
+#else
+        for (int k = 0; k < BVH_WIDTH; k++) {
+            float enter = 0.0f, exit = hit.t;
+            const float lo[3] = {node.minX[k], node.minY[k], node.minZ[k]};
+            const float hi[3] = {node.maxX[k], node.maxY[k], node.maxZ[k]};
+            for (int a = 0; a < 3; a++) {
+                float t0 = (lo[a] - origin[a]) * inverse[a], t1 = (hi[a] - origin[a]) * inverse[a];
+                enter = std::max(enter, std::min(t0, t1));
+                exit = std::min(exit, std::max(t0, t1));
+            }
+            tNear[k] = enter;
+            mask |= (enter <= exit) << k;
+        }
+#endif
+        // push far to near so the nearest child is popped first
+        int order[BVH_WIDTH];
+        int hits = 0;
+        for (int k = 0; k < BVH_WIDTH; k++) {
+            if ((mask >> k) & 1 && node.child[k] != BVH_EMPTY) {
+                int j = hits++;
+                while (j > 0 && tNear[order[j - 1]] < tNear[k]) {
+                    order[j] = order[j - 1];
+                    j--;
+                }
+                order[j] = k;
+            }
+        }
+        for (int j = 0; j < hits && top < BVH_STACK_SIZE; j++) {
+            stack[top] = node.child[order[j]];
+            stackNear[top++] = tNear[order[j]];
+        }
+    }
+    return hit.face >= 0;
+}
+
+bool Bvh::closestPoint(glm::vec3 p, float maxDistance, BvhClosest &closest) const {
+    closest = BvhClosest();
+    if (_nodes.empty()) {
+        return false;
+    }
+    float best2 = maxDistance * maxDistance;
+
+    int32_t stack[BVH_STACK_SIZE];
+    float stackDistance2[BVH_STACK_SIZE];
+    int top = 0;
+    stack[top] = 0;
+    stackDistance2[top++] = 0.0f;
+    while (top > 0) {
+        top--;
+        int32_t code = stack[top];
+        if (stackDistance2[top] >= best2) {
+            continue;
+        }
+        if (code < 0) {
+            uint32_t first = (uint32_t) ~code >> 3, triangles = (uint32_t) ~code & 7;
+            for (uint32_t i = first; i < first + triangles; i++) {
+                glm::vec3 q = closestPointOnTriangle(p, _corners[i * 3], _corners[i * 3 + 1], _corners[i * 3 + 2]);
+                glm::vec3 d = q - p;
+                float distance2 = glm::dot(d, d);
+                if (distance2 < best2) {
+                    best2 = distance2;
+                    closest.point = q;
+                    closest.face = (int) _faceIndex[i];
+                }
+            }
+            continue;
+        }
+
+        const BvhNode &node = _nodes[code];
+        float distance2[BVH_WIDTH];
+#if defined(__SSE2__)
+        __m128 px = _mm_set1_ps(p.x), py = _mm_set1_ps(p.y), pz = _mm_set1_ps(p.z);
+        __m128 zero = _mm_setzero_ps();
+        __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(node.minX), px),
+                                          _mm_sub_ps(px, _mm_loadu_ps(node.maxX))), zero);
+        __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(node.minY), py),
+                                          _mm_sub_ps(py, _mm_loadu_ps(node.maxY))), zero);
+        __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ), pz),
+                                          _mm_sub_ps(pz, _mm_loadu_ps(node.maxZ))), zero);
+        _mm_storeu_ps(distance2, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+#else
+        for (int k = 0; k < BVH_WIDTH; k++) {
+            float dx = std::max(std::max(node.minX[k] - p.x, p.x - node.maxX[k]), 0.0f);
+            float dy = std::max(std::max(node.minY[k] - p.y, p.y - node.maxY[k]), 0.0f);
+            float dz = std::max(std::max(node.minZ[k] - p.z, p.z - node.maxZ[k]), 0.0f);
+            distance2[k] = dx * dx + dy * dy + dz * dz;
+        }
+#endif
+        int order[BVH_WIDTH];
+        int candidates = 0;
+        for (int k = 0; k < BVH_WIDTH; k++) {
+            if (distance2[k] < best2 && node.child[k] != BVH_EMPTY) {
+                int j = candidates++;
+                while (j > 0 && distance2[order[j - 1]] < distance2[k]) {
+                    order[j] = order[j - 1];
+                    j--;
+                }
+                order[j] = k;
+            }
+        }
+        for (int j = 0; j < candidates && top < BVH_STACK_SIZE; j++) {
+            stack[top] = node.child[order[j]];
+            stackDistance2[top++] = distance2[order[j]];
+        }
+    }
+    if (closest.face < 0) {
+        return false;
+    }
+    closest.distance = std::sqrt(best2);
+    return true;
+}
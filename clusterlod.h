@@ -0,0 +1,430 @@
+#pragma once
+
+#include "meshlet.h"
+#include "simplify.h"
+#include "parallel.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cfloat>
+
+// Hierarchical cluster LOD (the Nanite approach). Level 0 is the meshlets of the input. Each further level
+// groups neighbouring clusters, simplifies every group to half its triangles with the group border locked,
+// and splits the result into new clusters. A group links its children (the clusters it consumed) to its
+// parents (the clusters it produced), which makes a DAG. Because borders are locked, any cut through the DAG
+// is crack free, and because a group's error is never below its children's, picking clusters by projected
+// error yields a consistent cut.
+
+// clusters merged into one group before simplifying
+#define CLUSTER_GROUP_SIZE 4
+
+struct LodCluster {
+    // range into ClusterDag::triangles
+    uint32_t triangleOffset;
+    uint32_t triangleCount;
+    int level;
+
+    // culling bounds
+    glm::vec3 center;
+    float radius;
+
+    // error and bounds of the group that produced this cluster (zero error for level 0)
+    glm::vec3 lodCenter;
+    float lodRadius;
+    float lodError;
+
+    // error and bounds of the group this cluster was simplified in, FLT_MAX error if it never was
+    glm::vec3 parentCenter;
+    float parentRadius;
+    float parentError;
+};
+
+struct LodGroup {
+    // children then parents, as ranges into ClusterDag::groupClusters
+    uint32_t childOffset;
+    uint32_t childCount;
+    uint32_t parentOffset;
+    uint32_t parentCount;
+    int level;
+
+    glm::vec3 center;
+    float radius;
+    float error;
+};
+
+struct ClusterDag {
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::ivec3> triangles;
+    std::vector<LodCluster> clusters;
+    std::vector<LodGroup> groups;
+    std::vector<uint32_t> groupClusters;
+    int levels = 0;
+};
+
+// smallest sphere around two spheres
+void mergeSpheres(glm::vec3 &center, float &radius, glm::vec3 otherCenter, float otherRadius) {
+    float d = glm::length(otherCenter - center);
+    if (d + otherRadius <= radius) {
+        return;
+    }
+    if (d + radius <= otherRadius) {
+        center = otherCenter;
+        radius = otherRadius;
+        return;
+    }
+    float newRadius = (d + radius + otherRadius) * 0.5f;
+    center += (otherCenter - center) * ((newRadius - radius) / d);
+    radius = newRadius;
+}
+
+// greedily group clusters with the clusters they share the most vertices with
+std::vector<std::vector<uint32_t>> groupClusters(const ClusterDag &dag, const std::vector<uint32_t> &working) {
+    // (vertex, cluster) pairs sorted by vertex give every cluster sharing each vertex
+    std::vector<std::pair<int, uint32_t>> uses;
+    for (uint32_t i = 0; i < working.size(); i++) {
+        const LodCluster &cluster = dag.clusters[working[i]];
+        for (uint32_t t = 0; t < cluster.triangleCount; t++) {
+            glm::ivec3 face = dag.triangles[cluster.triangleOffset + t];
+            for (int j = 0; j < 3; j++) {
+                uses.emplace_back(face[j], i);
+            }
+        }
+    }
+    std::sort(uses.begin(), uses.end());
+    uses.erase(std::unique(uses.begin(), uses.end()), uses.end());
+
+    std::vector<std::unordered_map<uint32_t, int>> shared(working.size());
+    for (size_t begin = 0; begin < uses.size(); ) {
+        size_t end = begin;
+        while (end < uses.size() && uses[end].first == uses[begin].first) {
+            end++;
+        }
+        for (size_t a = begin; a < end; a++) {
+            for (size_t b = begin; b < end; b++) {
+                if (a != b) {
+                    shared[uses[a].second][uses[b].second]++;
+                }
+            }
+        }
+        begin = end;
+    }
+
+    std::vector<bool> assigned(working.size(), false);
+    std::vector<std::vector<uint32_t>> groups;
+    for (uint32_t seed = 0; seed < working.size(); seed++) {
+        if (assigned[seed]) {
+            continue;
+        }
+        std::vector<uint32_t> group = {seed};
+        assigned[seed] = true;
+        while (group.size() < CLUSTER_GROUP_SIZE) {
+            int best = -1;
+            int bestShared = 0;
+            for (uint32_t member : group) {
+                for (auto kv : shared[member]) {
+                    if (!assigned[kv.first] && kv.second > bestShared) {
+                        best = kv.first;
+                        bestShared = kv.second;
+                    }
+                }
+            }
+            if (best < 0) {
+                break;
+            }
+            group.push_back(best);
+            assigned[best] = true;
+        }
+        for (uint32_t &member : group) {
+            member = working[member];
+        }
+        groups.push_back(group);
+    }
+    return groups;
+}
+
+struct GroupResult {
+    bool simplified = false;
+    float error = 0.0f;
+    glm::vec3 center;
+    float radius = 0.0f;
+    // new clusters, as triangle lists in global vertex indices
+    std::vector<std::vector<glm::ivec3>> clusters;
+};
+
+// simplify one group to half its triangles with every vertex shared outside the group locked
+GroupResult simplifyGroup(const ClusterDag &dag, const std::vector<uint32_t> &group, const std::vector<int> &levelUses) {
+    GroupResult result;
+
+    const LodCluster &first = dag.clusters[group[0]];
+    result.center = first.lodCenter;
+    result.radius = first.lodRadius;
+    for (uint32_t id : group) {
+        const LodCluster &cluster = dag.clusters[id];
+        result.error = std::max(result.error, cluster.lodError);
+        mergeSpheres(result.center, result.radius, cluster.lodCenter, cluster.lodRadius);
+    }
+
+    // local copy of the group with compact vertex indices
+    std::unordered_map<int, int> toLocal;
+    std::vector<int> toGlobal;
+    std::vector<glm::vec3> vertices;
+    std::vector<int> groupUses;
+    std::vector<glm::ivec3> faces;
+    for (uint32_t id : group) {
+        const LodCluster &cluster = dag.clusters[id];
+        for (uint32_t t = 0; t < cluster.triangleCount; t++) {
+            glm::ivec3 face = dag.triangles[cluster.triangleOffset + t];
+            for (int j = 0; j < 3; j++) {
+                auto it = toLocal.find(face[j]);
+                if (it == toLocal.end()) {
+                    it = toLocal.emplace(face[j], (int) toGlobal.size()).first;
+                    toGlobal.push_back(face[j]);
+                    vertices.push_back(dag.vertices[face[j]]);
+                    groupUses.push_back(0);
+                }
+                groupUses[it->second]++;
+                face[j] = it->second;
+            }
+            faces.push_back(face);
+        }
+    }
+
+    // lock vertices used by triangles outside the group and the ends of open edges,
+    // so neighbouring groups and mesh boundaries still line up after simplification
+    std::vector<bool> locked(vertices.size(), false);
+    for (size_t v = 0; v < vertices.size(); v++) {
+        locked[v] = groupUses[v] != levelUses[toGlobal[v]];
+    }
+    std::unordered_map<uint64_t, int> edgeUses;
+    for (const glm::ivec3 &face : faces) {
+        for (int j = 0; j < 3; j++) {
+            uint64_t a = std::min(face[j], face[(j + 1) % 3]);
+            uint64_t b = std::max(face[j], face[(j + 1) % 3]);
+            edgeUses[(a << 32) | b]++;
+        }
+    }
+    for (auto kv : edgeUses) {
+        if (kv.second == 1) {
+            locked[kv.first >> 32] = true;
+            locked[kv.first & 0xffffffff] = true;
+        }
+    }
+
+    size_t originalFaces = faces.size();
+    float error = simplifyQEM(vertices, faces, locked, originalFaces / 2);
+    // not worth a new level if the locked border kept most of the triangles
+    if (faces.size() > originalFaces * 85 / 100) {
+        return result;
+    }
+    result.simplified = true;
+    result.error = std::max(result.error, error);
+
+    MeshletData meshlets = buildMeshlets(vertices, faces);
+    for (const Meshlet &m : meshlets.meshlets) {
+        std::vector<glm::ivec3> cluster(faces.begin() + m.triangleOffset, faces.begin() + m.triangleOffset + m.triangleCount);
+        for (glm::ivec3 &face : cluster) {
+            face = glm::ivec3(toGlobal[face.x], toGlobal[face.y], toGlobal[face.z]);
+        }
+        result.clusters.push_back(cluster);
+    }
+    return result;
+}
+
+void addCluster(ClusterDag &dag, const std::vector<glm::ivec3> &faces, int level, glm::vec3 lodCenter, float lodRadius, float lodError) {
+    LodCluster cluster = {};
+    cluster.triangleOffset = (uint32_t) dag.triangles.size();
+    cluster.triangleCount = (uint32_t) faces.size();
+    cluster.level = level;
+    dag.triangles.insert(dag.triangles.end(), faces.begin(), faces.end());
+
+    std::vector<glm::vec3> points;
+    for (const glm::ivec3 &face : faces) {
+        for (int j = 0; j < 3; j++) {
+            points.push_back(dag.vertices[face[j]]);
+        }
+    }
+    computeBoundingSphere(points, cluster.center, cluster.radius);
+
+    cluster.lodCenter = level == 0 ? cluster.center : lodCenter;
+    cluster.lodRadius = level == 0 ? cluster.radius : lodRadius;
+    cluster.lodError = lodError;
+    cluster.parentCenter = cluster.lodCenter;
+    cluster.parentRadius = cluster.lodRadius;
+    cluster.parentError = FLT_MAX;
+    dag.clusters.push_back(cluster);
+}
+
+ClusterDag buildClusterDag(const std::vector<glm::vec3> &vertices, const std::vector<glm::vec3> &normals,
+                           const std::vector<glm::ivec3> &faces) {
+    ClusterDag dag;
+    dag.vertices = vertices;
+    dag.normals = normals;
+
+    std::vector<glm::ivec3> ordered = faces;
+    MeshletData meshlets = buildMeshlets(vertices, ordered);
+    std::vector<uint32_t> working;
+    for (const Meshlet &m : meshlets.meshlets) {
+        std::vector<glm::ivec3> cluster(ordered.begin() + m.triangleOffset, ordered.begin() + m.triangleOffset + m.triangleCount);
+        working.push_back((uint32_t) dag.clusters.size());
+        addCluster(dag, cluster, 0, glm::vec3(0.0f), 0.0f, 0.0f);
+    }
+
+    int level = 0;
+    std::vector<int> levelUses(vertices.size());
+    while (working.size() > 1) {
+        std::vector<std::vector<uint32_t>> groups = groupClusters(dag, working);
+
+        std::fill(levelUses.begin(), levelUses.end(), 0);
+        for (uint32_t id : working) {
+            const LodCluster &cluster = dag.clusters[id];
+            for (uint32_t t = 0; t < cluster.triangleCount; t++) {
+                glm::ivec3 face = dag.triangles[cluster.triangleOffset + t];
+                levelUses[face.x]++;
+                levelUses[face.y]++;
+                levelUses[face.z]++;
+            }
+        }
+
+        // groups only read the current level, so they simplify independently
+        std::vector<GroupResult> results(groups.size());
+        parallelFor(groups.size(), 1, [&](size_t i) {
+            results[i] = simplifyGroup(dag, groups[i], levelUses);
+        });
+
+        std::vector<uint32_t> next;
+        bool progress = false;
+        for (size_t i = 0; i < groups.size(); i++) {
+            const GroupResult &result = results[i];
+            if (!result.simplified) {
+                // try again with different neighbours on the next level
+                next.insert(next.end(), groups[i].begin(), groups[i].end());
+                continue;
+            }
+            progress = true;
+
+            LodGroup group;
+            group.level = level;
+            group.center = result.center;
+            group.radius = result.radius;
+            group.error = result.error;
+            group.childOffset = (uint32_t) dag.groupClusters.size();
+            group.childCount = (uint32_t) groups[i].size();
+            for (uint32_t id : groups[i]) {
+                LodCluster &child = dag.clusters[id];
+                child.parentCenter = result.center;
+                child.parentRadius = result.radius;
+                child.parentError = result.error;
+                dag.groupClusters.push_back(id);
+            }
+            group.parentOffset = (uint32_t) dag.groupClusters.size();
+            group.parentCount = (uint32_t) result.clusters.size();
+            for (const std::vector<glm::ivec3> &cluster : result.clusters) {
+                dag.groupClusters.push_back((uint32_t) dag.clusters.size());
+                next.push_back((uint32_t) dag.clusters.size());
+                addCluster(dag, cluster, level + 1, result.center, result.radius, result.error);
+            }
+            dag.groups.push_back(group);
+        }
+
+        if (!progress) {
+            break;
+        }
+        working.swap(next);
+        level++;
+    }
+    dag.levels = level + 1;
+    return dag;
+}
+
+// Screen-space error of a cluster seen from eye. projectionScale is viewport height / (2 tan(fovy / 2)),
+// so the result is in pixels.
+float projectedError(glm::vec3 center, float radius, float error, glm::vec3 eye, float projectionScale) {
+    if (error == FLT_MAX) {
+        return FLT_MAX;
+    }
+    float distance = std::max(glm::length(center - eye) - radius, 1e-4f);
+    return error / distance * projectionScale;
+}
+
+// The LOD cut: a cluster is drawn when it is accurate enough but its parent group is not. Each cluster decides
+// on its own, so this parallelizes trivially and stays crack free thanks to the monotone errors.
+std::vector<uint32_t> selectClusterLod(const ClusterDag &dag, glm::vec3 eye, float projectionScale, float thresholdPixels) {
+    std::vector<uint32_t> selected;
+    for (uint32_t i = 0; i < dag.clusters.size(); i++) {
+        const LodCluster &c = dag.clusters[i];
+        if (projectedError(c.lodCenter, c.lodRadius, c.lodError, eye, projectionScale) <= thresholdPixels &&
+            projectedError(c.parentCenter, c.parentRadius, c.parentError, eye, projectionScale) > thresholdPixels) {
+            selected.push_back(i);
+        }
+    }
+    return selected;
+}
+
+// Binary DAG format: "CDAG", version, the six counts, then the raw arrays.
+#define CLUSTER_DAG_FILE_VERSION 1
+
+template <typename T>
+bool writeArray(FILE* file, const std::vector<T> &array) {
+    return fwrite(array.data(), sizeof(T), array.size(), file) == array.size();
+}
+
+template <typename T>
+bool readArray(FILE* file, std::vector<T> &array, uint32_t count) {
+    array.resize(count);
+    return fread(array.data(), sizeof(T), array.size(), file) == array.size();
+}
+
+bool writeClusterDag(const char* path, const ClusterDag &dag) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Unable to open %s for writing!\n", path);
+        return false;
+    }
+
+    uint32_t header[9] = {0, CLUSTER_DAG_FILE_VERSION, (uint32_t) dag.levels,
+                          (uint32_t) dag.vertices.size(), (uint32_t) dag.normals.size(), (uint32_t) dag.triangles.size(),
+                          (uint32_t) dag.clusters.size(), (uint32_t) dag.groups.size(), (uint32_t) dag.groupClusters.size()};
+    memcpy(&header[0], "CDAG", 4);
+    bool ok = fwrite(header, sizeof(header), 1, file) == 1;
+    ok = ok && writeArray(file, dag.vertices) && writeArray(file, dag.normals) && writeArray(file, dag.triangles);
+    ok = ok && writeArray(file, dag.clusters) && writeArray(file, dag.groups) && writeArray(file, dag.groupClusters);
+    fclose(file);
+
+    if (!ok) {
+        fprintf(stderr, "Failed writing cluster DAG to %s!\n", path);
+    }
+    return ok;
+}
+
+bool readClusterDag(const char* path, ClusterDag &dag) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Unable to open %s!\n", path);
+        return false;
+    }
+
+    uint32_t header[9];
+    bool ok = fread(header, sizeof(header), 1, file) == 1;
+    if (!ok || memcmp(&header[0], "CDAG", 4) != 0 || header[1] != CLUSTER_DAG_FILE_VERSION) {
+        fprintf(stderr, "%s is not a version %d cluster DAG file!\n", path, CLUSTER_DAG_FILE_VERSION);
+        fclose(file);
+        return false;
+    }
+
+    dag.levels = (int) header[2];
+    ok = readArray(file, dag.vertices, header[3]) && readArray(file, dag.normals, header[4]) && readArray(file, dag.triangles, header[5]);
+    ok = ok && readArray(file, dag.clusters, header[6]) && readArray(file, dag.groups, header[7]) && readArray(file, dag.groupClusters, header[8]);
+    fclose(file);
+
+    if (!ok) {
+        fprintf(stderr, "%s is truncated!\n", path);
+    }
+    return ok;
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include "parallel.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// pixels per side of a Hi-Z block
+#define HIZ_BLOCK_SIZE 8
+// chunks tested together by cullChunks(), the width of an SSE register
+#define CULL_BATCH 4
+// batches handed to a thread at a time, so small meshes stay on the calling thread
+#define CULL_GRAIN 256
+
+// Six planes (left, right, bottom, top, near, far) with normals pointing inside, extracted from a
+// model-view-projection matrix (Gribb and Hartmann), so tests happen in the space the matrix starts from.
+struct Frustum {
+    glm::vec4 planes[6];
+};
+
+Frustum extractFrustum(const glm::mat4 &mvp) {
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++) {
+        rows[i] = glm::vec4(mvp[0][i], mvp[1][i], mvp[2][i], mvp[3][i]);
+    }
+
+    Frustum frustum;
+    frustum.planes[0] = rows[3] + rows[0];
+    frustum.planes[1] = rows[3] - rows[0];
+    frustum.planes[2] = rows[3] + rows[1];
+    frustum.planes[3] = rows[3] - rows[1];
+    frustum.planes[4] = rows[3] + rows[2];
+    frustum.planes[5] = rows[3] - rows[2];
+    for (int i = 0; i < 6; i++) {
+        frustum.planes[i] /= glm::length(glm::vec3(frustum.planes[i]));
+    }
+    return frustum;
+}
+
+bool sphereOutsideFrustum(const Frustum &frustum, glm::vec3 center, float radius) {
+    for (int i = 0; i < 6; i++) {
+        if (glm::dot(glm::vec3(frustum.planes[i]), center) + frustum.planes[i].w < -radius) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Normal cone test on a bounding sphere: every triangle faces away from the eye if the eye lies inside the
+// cone opposite to the axis. coneCutoff is the sine of the cone half angle, 1 for clusters that cannot be culled.
+bool coneBackfacing(glm::vec3 center, float radius, glm::vec3 coneAxis, float coneCutoff, glm::vec3 eye) {
+    glm::vec3 toCenter = center - eye;
+    return glm::dot(toCenter, coneAxis) >= coneCutoff * glm::length(toCenter) + radius;
+}
+
+// Bounds of many chunks as structure of arrays, so cullChunks() can load the same field of CULL_BATCH chunks
+// at once. The arrays are padded to a whole batch; padding entries are never reported.
+struct ChunkBounds {
+    size_t count = 0;
+    std::vector<float> centerX, centerY, centerZ, radius;
+    std::vector<float> axisX, axisY, axisZ, cutoff;
+};
+
+void addChunk(ChunkBounds &bounds, glm::vec3 center, float radius, glm::vec3 coneAxis, float coneCutoff) {
+    size_t padded = (bounds.count + CULL_BATCH) / CULL_BATCH * CULL_BATCH;
+    for (std::vector<float> *field : {&bounds.centerX, &bounds.centerY, &bounds.centerZ, &bounds.radius,
+                                      &bounds.axisX, &bounds.axisY, &bounds.axisZ, &bounds.cutoff}) {
+        field->resize(padded, 0.0f);
+    }
+    size_t i = bounds.count++;
+    bounds.centerX[i] = center.x;
+    bounds.centerY[i] = center.y;
+    bounds.centerZ[i] = center.z;
+    bounds.radius[i] = radius;
+    bounds.axisX[i] = coneAxis.x;
+    bounds.axisY[i] = coneAxis.y;
+    bounds.axisZ[i] = coneAxis.z;
+    bounds.cutoff[i] = coneCutoff;
+}
+
+// same tests as sphereOutsideFrustum() and coneBackfacing() on chunks [first, first + CULL_BATCH)
+void cullChunkBatch(const ChunkBounds &bounds, const Frustum &frustum, glm::vec3 eye, size_t first, uint8_t* visible) {
+#if defined(__SSE2__)
+    __m128 cx = _mm_loadu_ps(&bounds.centerX[first]);
+    __m128 cy = _mm_loadu_ps(&bounds.centerY[first]);
+    __m128 cz = _mm_loadu_ps(&bounds.centerZ[first]);
+    __m128 r = _mm_loadu_ps(&bounds.radius[first]);
+    __m128 negativeR = _mm_sub_ps(_mm_setzero_ps(), r);
+
+    __m128 culled = _mm_setzero_ps();
+    for (int p = 0; p < 6; p++) {
+        const glm::vec4 &plane = frustum.planes[p];
+        __m128 d = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), cx),
+                                                    _mm_mul_ps(_mm_set1_ps(plane.y), cy)),
+                                         _mm_mul_ps(_mm_set1_ps(plane.z), cz)),
+                              _mm_set1_ps(plane.w));
+        culled = _mm_or_ps(culled, _mm_cmplt_ps(d, negativeR));
+    }
+
+    __m128 tx = _mm_sub_ps(cx, _mm_set1_ps(eye.x));
+    __m128 ty = _mm_sub_ps(cy, _mm_set1_ps(eye.y));
+    __m128 tz = _mm_sub_ps(cz, _mm_set1_ps(eye.z));
+    __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, tx), _mm_mul_ps(ty, ty)), _mm_mul_ps(tz, tz)));
+    __m128 along = _mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, _mm_loadu_ps(&bounds.axisX[first])),
+                                         _mm_mul_ps(ty, _mm_loadu_ps(&bounds.axisY[first]))),
+                              _mm_mul_ps(tz, _mm_loadu_ps(&bounds.axisZ[first])));
+    __m128 limit = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&bounds.cutoff[first]), length), r);
+    culled = _mm_or_ps(culled, _mm_cmpge_ps(along, limit));
+
+    int mask = _mm_movemask_ps(culled);
+    for (int k = 0; k < CULL_BATCH; k++) {
+        visible[first + k] = !((mask >> k) & 1);
+    }
+#else
+    for (size_t i = first; i < first + CULL_BATCH; i++) {
+        glm::vec3 center(bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]);
+        glm::vec3 axis(bounds.axisX[i], bounds.axisY[i], bounds.axisZ[i]);
+        visible[i] = !sphereOutsideFrustum(frustum, center, bounds.radius[i]) &&
+                     !coneBackfacing(center, bounds.radius[i], axis, bounds.cutoff[i], eye);
+    }
+#endif
+}
+
+// Frustum and backface cone culling of every chunk, CULL_BATCH chunks per test and batches spread across
+// threads. visible[i] is set to 1 for chunks that may be seen; it is resized to the padded count.
+void cullChunks(const ChunkBounds &bounds, const Frustum &frustum, glm::vec3 eye, std::vector<uint8_t> &visible) {
+    size_t batches = (bounds.count + CULL_BATCH - 1) / CULL_BATCH;
+    visible.resize(batches * CULL_BATCH);
+    uint8_t* out = visible.data();
+    parallelFor(batches, CULL_GRAIN, [&](size_t b) {
+        cullChunkBatch(bounds, frustum, eye, b * CULL_BATCH, out);
+    });
+}
+
+// Coarse depth buffer for occlusion tests: the farthest depth in each HIZ_BLOCK_SIZE square of a depth buffer,
+// rows top to bottom. Filled by SoftwareRasterizer::buildHiZ().
+struct HiZBuffer {
+    int width = 0;
+    int height = 0;
+    int pixelWidth = 0;
+    int pixelHeight = 0;
+    std::vector<float> maxDepth;
+};
+
+// A sphere is occluded when its nearest depth lies behind the farthest depth of every block its screen rect
+// touches. The rect and the nearest depth come from the sphere's bounding box projected with the matrix the
+// depth buffer was rendered with, so the test is conservative. Spheres reaching behind the eye are visible.
+bool sphereOccluded(const HiZBuffer &hiz, const glm::mat4 &modelViewProjection, glm::vec3 center, float radius) {
+    float minX = 1.0f, minY = 1.0f, minZ = 1.0f;
+    float maxX = -1.0f, maxY = -1.0f;
+    for (int i = 0; i < 8; i++) {
+        glm::vec3 corner = center + radius * glm::vec3(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, i & 4 ? 1.0f : -1.0f);
+        glm::vec4 clip = modelViewProjection * glm::vec4(corner, 1.0f);
+        if (clip.w <= 0.0f) {
+            return false;
+        }
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        minX = std::min(minX, ndc.x);
+        maxX = std::max(maxX, ndc.x);
+        minY = std::min(minY, ndc.y);
+        maxY = std::max(maxY, ndc.y);
+        minZ = std::min(minZ, ndc.z);
+    }
+    if (minZ < -1.0f) {
+        return false;
+    }
+    float depth = minZ * 0.5f + 0.5f;
+
+    // ndc to blocks, y flipped since rows go top to bottom
+    int x0 = std::max(0, (int) ((minX * 0.5f + 0.5f) * hiz.pixelWidth) / HIZ_BLOCK_SIZE);
+    int x1 = std::min(hiz.width - 1, (int) ((maxX * 0.5f + 0.5f) * hiz.pixelWidth) / HIZ_BLOCK_SIZE);
+    int y0 = std::max(0, (int) ((0.5f - maxY * 0.5f) * hiz.pixelHeight) / HIZ_BLOCK_SIZE);
+    int y1 = std::min(hiz.height - 1, (int) ((0.5f - minY * 0.5f) * hiz.pixelHeight) / HIZ_BLOCK_SIZE);
+    for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) {
+            if (hiz.maxDepth[y * hiz.width + x] >= depth) {
+                return false;
+            }
+        }
+    }
+    return x0 <= x1 && y0 <= y1;
+}
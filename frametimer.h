@@ -0,0 +1,220 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#define FRAME_STATS_WINDOW 1024
+// frames in flight the GPU timings may lag behind before the CPU waits for one
+#define FRAME_TIMER_QUERIES 4
+
+// Fixed-size window over the most recent samples of one metric. Percentiles sort a copy of the window, which
+// is cheap enough at this size to do once per second.
+class RollingStats {
+public:
+    RollingStats(const char* name) : _name(name) {
+        _samples.reserve(FRAME_STATS_WINDOW);
+    }
+
+    void add(float sample) {
+        if (_samples.size() < FRAME_STATS_WINDOW) {
+            _samples.push_back(sample);
+        }
+        else {
+            _samples[_next] = sample;
+        }
+        _next = (_next + 1) % FRAME_STATS_WINDOW;
+        _total++;
+    }
+
+    // p in [0, 1], nearest rank
+    float percentile(float p) const {
+        if (_samples.empty()) {
+            return 0.0f;
+        }
+        std::vector<float> sorted = _samples;
+        size_t rank = std::min(sorted.size() - 1, (size_t) (p * sorted.size()));
+        std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+        return sorted[rank];
+    }
+
+    float max() const {
+        return _samples.empty() ? 0.0f : *std::max_element(_samples.begin(), _samples.end());
+    }
+
+    const char* getName() const { return _name; }
+    size_t getTotal() const { return _total; }
+
+    // samples oldest first
+    std::vector<float> getSamples() const {
+        std::vector<float> ordered;
+        ordered.reserve(_samples.size());
+        size_t start = _samples.size() < FRAME_STATS_WINDOW ? 0 : _next;
+        for (size_t i = 0; i < _samples.size(); i++) {
+            ordered.push_back(_samples[(start + i) % _samples.size()]);
+        }
+        return ordered;
+    }
+
+private:
+    const char* _name;
+    std::vector<float> _samples;
+    size_t _next = 0;
+    size_t _total = 0;
+};
+
+// Per-frame timings for the viewer: CPU time from the top of the loop to the swap, GPU time of the draw from
+// GL_TIME_ELAPSED queries, and CPU time and bytes spent updating buffers. The queries are a ring: each frame
+// reads back the results that are available, oldest first, and leaves the rest for a later frame, so the
+// timer never waits on the GPU unless the ring is full. A frame's samples are held with its query and recorded
+// together once it is read, which keeps the windows aligned row for row.
+class FrameTimer {
+public:
+    FrameTimer() {
+        glGenQueries(FRAME_TIMER_QUERIES, _queries);
+    }
+
+    void deleteGLResources() {
+        glDeleteQueries(FRAME_TIMER_QUERIES, _queries);
+    }
+
+    void beginFrame(size_t uploadedBytes) {
+        _frameStart = std::chrono::steady_clock::now();
+        _uploadMs = 0.0;
+        _uploadedBytes = uploadedBytes;
+    }
+
+    void beginUpload() {
+        _uploadStart = std::chrono::steady_clock::now();
+    }
+
+    void endUpload() {
+        _uploadMs += msSince(_uploadStart);
+    }
+
+    void beginDraw() {
+        // the query this frame reuses belongs to the frame FRAME_TIMER_QUERIES back, which has to be read first
+        if (_slots[_frame % FRAME_TIMER_QUERIES].pending) {
+            _stalls++;
+            readBack(_frame - FRAME_TIMER_QUERIES + 1, true);
+        }
+        glBeginQuery(GL_TIME_ELAPSED, _queries[_frame % FRAME_TIMER_QUERIES]);
+    }
+
+    void endDraw() {
+        glEndQuery(GL_TIME_ELAPSED);
+        _slots[_frame % FRAME_TIMER_QUERIES].pending = true;
+        _slots[_frame % FRAME_TIMER_QUERIES].frame = _frame;
+    }
+
+    // call before swapping buffers, with the model's running upload counter
+    void endFrame(size_t uploadedBytes) {
+        Slot &slot = _slots[_frame % FRAME_TIMER_QUERIES];
+        if (slot.pending && slot.frame == _frame) {
+            slot.cpuMs = msSince(_frameStart);
+            slot.uploadMs = _uploadMs;
+            slot.uploadKB = (uploadedBytes - _uploadedBytes) / 1024.0;
+        }
+        _frame++;
+        readBack(_frame, false);
+    }
+
+    // one line of p50/p95/p99 for the status bar
+    void summary(char* line, size_t size) const {
+        snprintf(line, size, "cpu %.2f/%.2f/%.2f ms, gpu %.2f/%.2f/%.2f ms (p50/p95/p99)",
+                 _cpu.percentile(0.5f), _cpu.percentile(0.95f), _cpu.percentile(0.99f),
+                 _gpu.percentile(0.5f), _gpu.percentile(0.95f), _gpu.percentile(0.99f));
+    }
+
+    void print(FILE* file) const {
+        fprintf(file, "frame times over the last %lu of %lu frames (%lu waits for a gpu query %d frames later):\n",
+                std::min((size_t) FRAME_STATS_WINDOW, _cpu.getTotal()), _cpu.getTotal(), _stalls,
+                FRAME_TIMER_QUERIES);
+        fprintf(file, "  %-12s %10s %10s %10s %10s\n", "", "p50", "p95", "p99", "max");
+        for (const RollingStats *stats : {&_cpu, &_gpu, &_upload, &_uploadKB}) {
+            fprintf(file, "  %-12s %10.3f %10.3f %10.3f %10.3f\n", stats->getName(),
+                    stats->percentile(0.5f), stats->percentile(0.95f), stats->percentile(0.99f), stats->max());
+        }
+    }
+
+    // writes the window as csv, one row per frame, oldest first
+    bool dump(const char* path) const {
+        FILE* file = fopen(path, "w");
+        if (file == NULL) {
+            fprintf(stderr, "Failed to open %s for writing!\n", path);
+            return false;
+        }
+        std::vector<float> cpu = _cpu.getSamples();
+        std::vector<float> gpu = _gpu.getSamples();
+        std::vector<float> upload = _upload.getSamples();
+        std::vector<float> uploadKB = _uploadKB.getSamples();
+        fprintf(file, "%s,%s,%s,%s\n", _cpu.getName(), _gpu.getName(), _upload.getName(), _uploadKB.getName());
+        for (size_t i = 0; i < cpu.size(); i++) {
+            fprintf(file, "%f,%f,%f,%f\n", cpu[i], gpu[i], upload[i], uploadKB[i]);
+        }
+        fclose(file);
+        fprintf(stderr, "Wrote %lu frame timings to %s\n", cpu.size(), path);
+        return true;
+    }
+
+private:
+    // a frame's samples, waiting for its gpu time
+    struct Slot {
+        bool pending = false;
+        size_t frame = 0;
+        float cpuMs = 0.0f;
+        float uploadMs = 0.0f;
+        float uploadKB = 0.0f;
+    };
+
+    GLuint _queries[FRAME_TIMER_QUERIES] = {0};
+    Slot _slots[FRAME_TIMER_QUERIES];
+    size_t _frame = 0;
+    // oldest frame not read back yet
+    size_t _read = 0;
+    size_t _stalls = 0;
+
+    std::chrono::steady_clock::time_point _frameStart;
+    std::chrono::steady_clock::time_point _uploadStart;
+    double _uploadMs = 0.0;
+    size_t _uploadedBytes = 0;
+
+    RollingStats _cpu{"cpu ms"};
+    RollingStats _gpu{"gpu ms"};
+    RollingStats _upload{"upload ms"};
+    RollingStats _uploadKB{"upload KB"};
+
+    // records the frames before end in order, stopping at the first query still in flight unless blocking
+    void readBack(size_t end, bool block) {
+        for (; _read < end; _read++) {
+            Slot &slot = _slots[_read % FRAME_TIMER_QUERIES];
+            if (!slot.pending || slot.frame != _read) {
+                // no draw that frame
+                continue;
+            }
+            GLuint query = _queries[_read % FRAME_TIMER_QUERIES];
+            if (!block) {
+                GLint available = 0;
+                glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available) {
+                    return;
+                }
+            }
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+            slot.pending = false;
+
+            _cpu.add(slot.cpuMs);
+            _gpu.add(ns / 1e6);
+            _upload.add(slot.uploadMs);
+            _uploadKB.add(slot.uploadKB);
+        }
+    }
+
+    static double msSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+};
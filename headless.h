@@ -0,0 +1,90 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <cstdio>
+
+// Offscreen GL context without a window system: EGL on the surfaceless platform, which Mesa backs with its
+// software rasterizer (llvmpipe) when there is no GPU. There is no default framebuffer, so rendering goes to
+// an FBO that stays bound.
+struct HeadlessContext {
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLContext context = EGL_NO_CONTEXT;
+    GLuint fbo = 0;
+    GLuint color = 0;
+    GLuint depth = 0;
+    int width = 0;
+    int height = 0;
+};
+
+bool createHeadlessContext(HeadlessContext &ctx, int width, int height) {
+    auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay == NULL) {
+        fprintf(stderr, "EGL_EXT_platform_base is not supported!\n");
+        return false;
+    }
+    ctx.display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    EGLint major, minor;
+    if (ctx.display == EGL_NO_DISPLAY || !eglInitialize(ctx.display, &major, &minor)) {
+        fprintf(stderr, "Failed to initialize a surfaceless EGL display!\n");
+        return false;
+    }
+    eglBindAPI(EGL_OPENGL_API);
+
+    // same requirements as the shaders
+    EGLint attributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 5,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    ctx.context = eglCreateContext(ctx.display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attributes);
+    if (ctx.context == EGL_NO_CONTEXT || !eglMakeCurrent(ctx.display, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx.context)) {
+        fprintf(stderr, "Failed to create a surfaceless OpenGL 4.5 context!\n");
+        return false;
+    }
+
+    if (!gladLoadGLLoader((GLADloadproc) eglGetProcAddress)) {
+        fprintf(stderr, "Failed to initialize GLAD\n");
+        return false;
+    }
+
+    ctx.width = width;
+    ctx.height = height;
+    glGenFramebuffers(1, &ctx.fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, ctx.fbo);
+    glGenRenderbuffers(1, &ctx.color);
+    glBindRenderbuffer(GL_RENDERBUFFER, ctx.color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, ctx.color);
+    glGenRenderbuffers(1, &ctx.depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, ctx.depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, ctx.depth);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Offscreen framebuffer is incomplete!\n");
+        return false;
+    }
+    glViewport(0, 0, width, height);
+
+    fprintf(stderr, "Headless context: %s, OpenGL %s\n", glGetString(GL_RENDERER), glGetString(GL_VERSION));
+    return true;
+}
+
+void destroyHeadlessContext(HeadlessContext &ctx) {
+    if (ctx.fbo) {
+        glDeleteRenderbuffers(1, &ctx.color);
+        glDeleteRenderbuffers(1, &ctx.depth);
+        glDeleteFramebuffers(1, &ctx.fbo);
+    }
+    if (ctx.display != EGL_NO_DISPLAY) {
+        eglMakeCurrent(ctx.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (ctx.context != EGL_NO_CONTEXT) {
+            eglDestroyContext(ctx.display, ctx.context);
+        }
+        eglTerminate(ctx.display);
+    }
+    ctx = HeadlessContext();
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// Per-vertex importance weights for simplification. A vertex's quadric is scaled by its weight, so the
+// collapses around a vertex of weight 10 cost ten times what the geometry alone says and happen that much
+// later, and a weight below 1 lets flat, unimportant areas go first. 1 is neutral. The sources below can be
+// combined; each one overwrites the weights it covers, so the last applied wins.
+
+struct ImportanceBox {
+    glm::vec3 lo, hi;
+    float weight;
+};
+
+bool insideImportanceBox(const ImportanceBox &box, glm::vec3 p) {
+    return p.x >= box.lo.x && p.y >= box.lo.y && p.z >= box.lo.z && p.x <= box.hi.x && p.y <= box.hi.y &&
+           p.z <= box.hi.z;
+}
+
+// set the weight of every vertex inside the box
+void applyImportanceBox(const std::vector<glm::vec3> &vertices, const ImportanceBox &box, std::vector<float> &weights) {
+    for (size_t v = 0; v < vertices.size(); v++) {
+        if (insideImportanceBox(box, vertices[v])) {
+            weights[v] = box.weight;
+        }
+    }
+}
+
+// Grey level of the vertex colours mapped linearly from low (black) to high (white), for weights painted
+// into the model
+std::vector<float> importanceFromColors(const std::vector<glm::vec3> &colors, float low, float high) {
+    std::vector<float> weights(colors.size());
+    for (size_t v = 0; v < colors.size(); v++) {
+        float grey = glm::clamp(glm::dot(colors[v], glm::vec3(0.2126f, 0.7152f, 0.0722f)), 0.0f, 1.0f);
+        weights[v] = low + (high - low) * grey;
+    }
+    return weights;
+}
+
+// Reads a sidecar weight file into weights, which must hold one entry per vertex. One entry per line:
+//   v <vertex> <weight>                  a vertex, numbered from 1 as in the OBJ
+//   f <face> <weight>                    all three corners of a face, numbered from 1 in file order
+//   box <x0 y0 z0> <x1 y1 z1> <weight>   every vertex inside the box
+// Entries apply in file order, so a file can lower everything with one large box and then raise regions.
+// Blank lines and lines starting with # are skipped.
+bool loadImportance(const char* path, const std::vector<glm::vec3> &vertices, const std::vector<glm::ivec3> &faces,
+                    std::vector<float> &weights) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Unable to open the importance file %s\n", path);
+        return false;
+    }
+
+    char line[512];
+    int lineNumber = 0;
+    bool ok = true;
+    while (fgets(line, sizeof(line), file)) {
+        lineNumber++;
+        char kind[16];
+        if (sscanf(line, "%15s", kind) != 1 || kind[0] == '#') {
+            continue;
+        }
+        long index;
+        float weight;
+        ImportanceBox box;
+        if (strcmp(kind, "v") == 0 && sscanf(line, "%*s %ld %f", &index, &weight) == 2 && index >= 1 &&
+            (size_t) index <= vertices.size()) {
+            weights[index - 1] = weight;
+        }
+        else if (strcmp(kind, "f") == 0 && sscanf(line, "%*s %ld %f", &index, &weight) == 2 && index >= 1 &&
+                 (size_t) index <= faces.size()) {
+            for (int k = 0; k < 3; k++) {
+                weights[faces[index - 1][k]] = weight;
+            }
+        }
+        else if (strcmp(kind, "box") == 0 &&
+                 sscanf(line, "%*s %f %f %f %f %f %f %f", &box.lo.x, &box.lo.y, &box.lo.z, &box.hi.x, &box.hi.y,
+                        &box.hi.z, &box.weight) == 7) {
+            applyImportanceBox(vertices, box, weights);
+        }
+        else {
+            fprintf(stderr, "%s:%d: unrecognized importance entry\n", path, lineNumber);
+            ok = false;
+        }
+    }
+    fclose(file);
+    return ok;
+}
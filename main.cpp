@@ -6,23 +6,36 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include <iostream>
+#include <string>
 
 #include "utilities.h"
 #include "shader.h"
 #include "camera.h"
 #include "model.h"
+#include "bench.h"
+#include "simplifier.h"
+#include "scheduler.h"
+#include "renderbench.h"
+#include "frametimer.h"
+#include "uniforms.h"
+#include "softraster.h"
 
 GLFWwindow* initWindow();
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow *window);
+std::vector<glm::ivec3> buildOccluders(const Model &model, float &error);
 unsigned int loadTexture(const char *path);
 unsigned int loadCubemap(std::vector<std::string> faces);
 
 // settings
 const unsigned int SCR_WIDTH = 1200;
 const unsigned int SCR_HEIGHT = 800;
+// width of the software occluder render, the height follows the window's aspect
+const int OCCLUSION_WIDTH = 320;
+// the occluders are the drawn mesh simplified to as little as this fraction of its faces
+const int OCCLUSION_LOD_DIVISOR = 8;
 
 // camera
 Camera camera(glm::vec3(-2, 4, 8), glm::vec3(0, 1, 0), -77.0f, -16.0f);
@@ -37,35 +50,246 @@ float lastFrame = 0.0f;
 // wireframe mode
 bool wireframe = false;
 
-int main()
+int main(int argc, char** argv)
 {
+    // headless benchmark mode: ./main --bench [model.obj] [target face ratio]
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        const char* path = argc > 2 ? argv[2] : "teapot.obj";
+        float targetRatio = argc > 3 ? atof(argv[3]) : 0.9f;
+        return runBenchmarks(path, targetRatio);
+    }
+
+    // headless render benchmark: ./main --bench-render [model.obj] [frames] [--quantized]
+    if (argc > 1 && strcmp(argv[1], "--bench-render") == 0) {
+        const char* path = argc > 2 ? argv[2] : "teapot.obj";
+        int frames = argc > 3 ? atoi(argv[3]) : 100;
+        bool quantized = argc > 4 && strcmp(argv[4], "--quantized") == 0;
+        return runRenderBenchmark(path, frames, quantized);
+    }
+
+    // instanced scene benchmark: ./main --bench-scene [model.obj] [instances] [frames]
+    if (argc > 1 && strcmp(argv[1], "--bench-scene") == 0) {
+        const char* path = argc > 2 ? argv[2] : "teapot.obj";
+        size_t instances = argc > 3 ? atol(argv[3]) : 10000;
+        int frames = argc > 4 ? atoi(argv[4]) : 50;
+        return runSceneBenchmark(path, instances, frames);
+    }
+
+    // meshlet export: ./main --meshlets model.obj out.meshlets [target face ratio]
+    if (argc > 3 && strcmp(argv[1], "--meshlets") == 0) {
+        float targetRatio = argc > 4 ? atof(argv[4]) : 1.0f;
+        return exportMeshlets(argv[2], argv[3], targetRatio) ? 0 : 1;
+    }
+
+    // software rendered LOD thumbnails: ./main --thumbnails model.obj out/prefix [size]
+    if (argc > 3 && strcmp(argv[1], "--thumbnails") == 0) {
+        int size = argc > 4 ? atoi(argv[4]) : 256;
+        return exportThumbnails(argv[2], argv[3], size) ? 0 : 1;
+    }
+
+    // simplification error: ./main --error model.obj [target face ratio] [samples]
+    if (argc > 2 && strcmp(argv[1], "--error") == 0) {
+        float targetRatio = argc > 3 ? atof(argv[3]) : 0.5f;
+        size_t samples = argc > 4 ? atol(argv[4]) : MESH_DISTANCE_DEFAULT_SAMPLES;
+        return reportMeshError(argv[2], targetRatio, samples) ? 0 : 1;
+    }
+
+    // distance between two meshes: ./main --distance a.obj b.obj [samples]
+    if (argc > 3 && strcmp(argv[1], "--distance") == 0) {
+        size_t samples = argc > 4 ? atol(argv[4]) : MESH_DISTANCE_DEFAULT_SAMPLES;
+        return reportMeshDistance(argv[2], argv[3], samples) ? 0 : 1;
+    }
+
+    // cluster LOD export: ./main --cluster-lod model.obj out.dag
+    if (argc > 3 && strcmp(argv[1], "--cluster-lod") == 0) {
+        return exportClusterDag(argv[2], argv[3]) ? 0 : 1;
+    }
+
+    // viewer options:
+    //   --quantized    upload 16-bit positions, oct-encoded normals and 16-bit indices
+    //   --budget <ms>  simplify on the render thread within a per-frame time budget instead of on a worker
+    //   --frame-stats <path>  write the last frame timings as csv on exit
+    //   --scene <n>    draw a grid of n instances with per-instance LOD instead of the single model
+    //   --importance <path>  simplification weights from a sidecar file, see importance.h
+    //   --importance-colors <max>  weights from the vertex colours, black 1 to white max
+    //   --reorder      sort vertices and faces along a Morton curve before simplifying
+    //   --occlusion    render a coarse LOD of the model on the CPU each frame and skip the meshlets behind it
+    //   --weld <eps>   merge vertices within eps of each other on load, 0 for exact duplicates only. An
+    //                  importance sidecar then numbers the welded vertices and faces.
+    bool quantized = false;
+    double budgetMs = 0.0;
+    const char* frameStatsPath = NULL;
+    size_t sceneInstances = 0;
+    const char* importancePath = NULL;
+    float importanceColorMax = 0.0f;
+    bool reorder = false;
+    float weldEpsilon = -1.0f;
+    bool occlusion = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--quantized") == 0) {
+            quantized = true;
+        }
+        else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+            budgetMs = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--frame-stats") == 0 && i + 1 < argc) {
+            frameStatsPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc) {
+            sceneInstances = atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--importance") == 0 && i + 1 < argc) {
+            importancePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--importance-colors") == 0 && i + 1 < argc) {
+            importanceColorMax = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--reorder") == 0) {
+            reorder = true;
+        }
+        else if (strcmp(argv[i], "--occlusion") == 0) {
+            occlusion = true;
+        }
+        else if (strcmp(argv[i], "--weld") == 0 && i + 1 < argc) {
+            weldEpsilon = atof(argv[++i]);
+        }
+    }
+
     GLFWwindow* window = initWindow();
 
     glEnable(GL_DEPTH_TEST);
 
 
     Shader *basicShader = new Shader("shaders/basic.vert", "shaders/basic.frag");
-    Model *model = new Model("teapot.obj");
-    model->setupBuffers();
+    Model *model = new Model("teapot.obj", weldEpsilon);
+    model->setupBuffers(quantized);
+    if (importancePath || importanceColorMax > 0.0f) {
+        // colours first, so the sidecar can override them
+        std::vector<float> weights(model->getVertices().size(), 1.0f);
+        if (importanceColorMax > 0.0f && !model->getColors().empty()) {
+            weights = importanceFromColors(model->getColors(), 1.0f, importanceColorMax);
+        }
+        if (importancePath) {
+            loadImportance(importancePath, model->getVertices(), model->getFaces(), weights);
+        }
+        model->setImportance(weights);
+    }
+    // after the weights, whose sidecar numbers vertices in file order
+    if (reorder) {
+        model->reorderSpatially();
+    }
+
+    // camera and light go through the shared uniform buffer, the per-draw uniforms are set by location
+    FrameUniforms frameUniforms;
+    GLint positionOffsetLocation = basicShader->getUniformLocation("positionOffset");
+    GLint positionScaleLocation = basicShader->getUniformLocation("positionScale");
+    GLint octNormalsLocation = basicShader->getUniformLocation("octNormals");
+
+    // scene mode: many instances of the model, no simplification
+    InstancedScene *scene = nullptr;
+    Shader *instancedShader = nullptr;
+    if (sceneInstances > 0) {
+        scene = new InstancedScene(*model);
+        scene->addGrid(sceneInstances);
+        scene->setupBuffers();
+        instancedShader = new Shader("shaders/instanced.vert", "shaders/basic.frag");
+        camera.MovementSpeed = 0.02f * scene->getExtent();
+        camera.Position = glm::vec3(0.0f, 0.05f, 0.5f) * scene->getExtent();
+    }
+    float farPlane = scene ? 2.0f * scene->getExtent() : 100.0f;
+    float projectionScale = SCR_HEIGHT / (2.0f * std::tan(glm::radians(camera.Zoom) / 2.0f));
 
     // render loop
     // -----------
     glm::mat4 modelMat = glm::mat4(1);
     glm::mat4 view;
-    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, farPlane);
 
     glm::vec3 lightPos{1.0f, 2.0f, 1.0f};
 
+    // By default simplification runs on a worker thread and the render loop only uploads the snapshots it
+    // publishes. The first snapshot is the model as loaded, which is already on the GPU.
+    AsyncSimplifier *simplifier = budgetMs > 0.0 || scene ? nullptr : new AsyncSimplifier(*model);
+    uint64_t appliedVersion = 1;
+    uint64_t vertexVersion = 1;
+    size_t movedApplied = 0;
+
+    // With --occlusion, once meshlets are built a coarse LOD of the model is rendered depth-only at low
+    // resolution on the CPU each frame and meshlets behind its Hi-Z are skipped. The LOD is rebuilt whenever
+    // the mesh is finalized, see buildOccluders().
+    SoftwareRasterizer *occluders = occlusion && !scene ?
+        new SoftwareRasterizer(OCCLUSION_WIDTH, OCCLUSION_WIDTH * SCR_HEIGHT / SCR_WIDTH) : nullptr;
+    std::vector<glm::ivec3> occluderFaces;
+    bool occludersStale = true;
+    HiZBuffer occluderHiZ;
+
+    // with a budget, collapses run here instead, as many per frame as fit
+    CollapseScheduler scheduler(budgetMs);
+    bool collapsing = false;
+    char status[256] = "";
+
+    // cpu, gpu and upload time per frame, summarized in the title once per second and printed on exit
+    FrameTimer frameTimer;
+    char frameStats[256];
+    float lastSummary = 0.0f;
+
     while (!glfwWindowShouldClose(window))
     {
         float currentFrame = glfwGetTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
+        frameTimer.beginFrame(model->getUploadedBytes());
         processInput(window);
-        // bootleg testing
-        if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS){
-            fprintf(stderr, "Pressed up, attempting to collapse mesh!\n");
-            model->collapseMeshQEM();
+        // simplify while UP is held, the buffers get optimized once it is released
+        bool simplify = !scene && glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS;
+        if (simplifier) {
+            simplifier->setActive(simplify);
+            std::shared_ptr<const MeshSnapshot> snapshot = simplifier->latest();
+            if (snapshot->version != appliedVersion) {
+                frameTimer.beginUpload();
+                applySnapshot(*model, *snapshot, vertexVersion, movedApplied);
+                frameTimer.endUpload();
+                appliedVersion = snapshot->version;
+                occludersStale = true;
+            }
+        }
+        else if (simplify) {
+            scheduler.runFrame(*model);
+            frameTimer.beginUpload();
+            model->uploadDirtyFaces();
+            frameTimer.endUpload();
+            collapsing = true;
+        }
+        else if (collapsing) {
+            // counted as upload time: the reordering only happens to rewrite the buffers
+            frameTimer.beginUpload();
+            model->optimizeVertexCache();
+            model->buildMeshlets();
+            model->optimizeVertexFetch();
+            frameTimer.endUpload();
+            collapsing = false;
+            occludersStale = true;
+        }
+        if (!simplifier && !scene && scheduler.report(currentFrame, model->getFaces().size(), status, sizeof(status))) {
+            fprintf(stderr, "%s\n", status);
+        }
+        if (currentFrame - lastSummary >= 1.0f) {
+            frameTimer.summary(frameStats, sizeof(frameStats));
+            if (scene) {
+                const SceneStats &stats = scene->getStats();
+                snprintf(status, sizeof(status), "%lu/%lu instances, %lu draw calls (%lu commands), %.2f Mtris, lod %.2f ms",
+                         stats.visibleInstances, scene->getInstanceCount(), stats.drawCalls, stats.drawCommands,
+                         stats.triangles / 1e6, stats.selectMs);
+                fprintf(stderr, "%s\n", status);
+            }
+            if (simplifier) {
+                glfwSetWindowTitle(window, frameStats);
+            }
+            else {
+                std::string title = std::string(status) + " | " + frameStats;
+                glfwSetWindowTitle(window, title.c_str());
+            }
+            lastSummary = currentFrame;
         }
 
         glClearColor(0.82, 0.93, 0.99, 1.0f);
@@ -74,21 +298,45 @@ int main()
         view = camera.GetViewMatrix();
         glm::vec3 camPos = camera.Position;
 
-        glm::mat4 modelView = view * modelMat;
-        glm::mat4 normalMatrix = glm::inverse(glm::transpose(modelView));
+        FrameConstants frameConstants = makeFrameConstants(modelMat, view, projection, lightPos, camPos);
+        frameUniforms.update(frameConstants);
 
-        basicShader->use();
-
-        basicShader->setMat4("model", modelMat);
-        basicShader->setMat4("view", view);
-        basicShader->setMat4("projection", projection);
-        basicShader->setMat4("normalMatrix", normalMatrix);
-
-        basicShader->setVec3("lightPos", lightPos);
-        basicShader->setVec3("eyePos", camPos);
-
-        // Draw the model
-        model->draw();
+        if (scene) {
+            // pick every instance's LOD for a one pixel error, then draw them all in one call
+            scene->update(projection * view, camPos, projectionScale, 1.0f);
+            instancedShader->use();
+            frameTimer.beginDraw();
+            scene->draw();
+            frameTimer.endDraw();
+        }
+        else {
+            basicShader->use();
+
+            basicShader->setVec3(positionOffsetLocation, model->getPositionOffset());
+            basicShader->setVec3(positionScaleLocation, model->getPositionScale());
+            basicShader->setBool(octNormalsLocation, model->isQuantized());
+
+            // Draw the model, culling meshlets against the camera once they have been built
+            glm::vec3 eyeModel = glm::vec3(glm::inverse(modelMat) * glm::vec4(camPos, 1.0f));
+            const HiZBuffer* occlusionTest = nullptr;
+            if (occluders && !model->getMeshlets().meshlets.empty()) {
+                if (occludersStale) {
+                    float error;
+                    occluderFaces = buildOccluders(*model, error);
+                    fprintf(stderr, "Occluders: %lu of %lu triangles, error %f\n", occluderFaces.size(),
+                            model->getFaces().size(), error);
+                    occludersStale = false;
+                }
+                occluders->clear(glm::vec3(0.0f));
+                occluders->drawMesh(model->getVertices(), model->getNormals(), occluderFaces, frameConstants, false);
+                occluders->buildHiZ(occluderHiZ);
+                occlusionTest = &occluderHiZ;
+            }
+            frameTimer.beginDraw();
+            model->draw(projection * view * modelMat, eyeModel, occlusionTest);
+            frameTimer.endDraw();
+        }
+        frameTimer.endFrame(model->getUploadedBytes());
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
@@ -96,6 +344,20 @@ int main()
         glfwPollEvents();
     }
 
+    frameTimer.print(stderr);
+    if (frameStatsPath) {
+        frameTimer.dump(frameStatsPath);
+    }
+    frameTimer.deleteGLResources();
+    frameUniforms.deleteGLResources();
+
+    delete simplifier;
+    delete occluders;
+    if (scene) {
+        scene->deleteGLResources();
+        delete scene;
+        delete instancedShader;
+    }
     model->deleteGLResources();
     delete model;
     delete basicShader;
@@ -106,6 +368,31 @@ int main()
     return 0;
 }
 
+// The model's faces halved with simplifyQEM() as long as they stay within half the smallest meshlet radius of
+// the surface (adding up the error of each halving, as scene.h does), down to 1/OCCLUSION_LOD_DIVISOR. A meshlet's
+// bounding sphere then still reaches in front of the occluders wherever they cover its own surface, so it is
+// not hidden by itself.
+std::vector<glm::ivec3> buildOccluders(const Model &model, float &error) {
+    float minRadius = INFINITY;
+    for (const Meshlet &m : model.getMeshlets().meshlets) {
+        minRadius = std::min(minRadius, m.radius);
+    }
+    std::vector<bool> locked(model.getVertices().size(), false);
+    std::vector<glm::ivec3> faces = model.getFaces();
+    size_t target = faces.size() / OCCLUSION_LOD_DIVISOR;
+    error = 0.0f;
+    while (faces.size() / 2 >= target && faces.size() > 1) {
+        std::vector<glm::ivec3> halved = faces;
+        float halvedError = error + simplifyQEM(model.getVertices(), halved, locked, halved.size() / 2);
+        if (halvedError > 0.5f * minRadius || halved.size() == faces.size()) {
+            break;
+        }
+        faces.swap(halved);
+        error = halvedError;
+    }
+    return faces;
+}
+
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
 // ---------------------------------------------------------------------------------------------------------
 void processInput(GLFWwindow *window)
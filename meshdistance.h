@@ -0,0 +1,155 @@
+#pragma once
+
+#include "bvh.h"
+#include "parallel.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#define MESH_DISTANCE_DEFAULT_SAMPLES 1000000
+#define MESH_DISTANCE_GRAIN 256
+
+// Distance from the surface of one mesh to another, over points sampled on the first
+struct MeshDistance {
+    float hausdorff = 0.0f;  // largest sample distance
+    float rms = 0.0f;
+    float mean = 0.0f;
+    size_t samples = 0;
+};
+
+// Both directions between an original and a simplified mesh. The symmetric Hausdorff distance is the larger
+// one-sided distance; the symmetric RMS pools the samples of both sides.
+struct MeshError {
+    MeshDistance forward;   // original to simplified
+    MeshDistance backward;  // simplified to original
+    float hausdorff = 0.0f;
+    float rms = 0.0f;
+};
+
+// well mixed 32 bits from a sample index and a stream, so every sample is independent of the thread that
+// draws it and the result does not depend on the thread count
+static inline float sampleRandom(uint64_t index, uint64_t stream) {
+    uint64_t x = index * 0x9e3779b97f4a7c15ull + stream * 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return (float) (x >> 40) * (1.0f / 16777216.0f);
+}
+
+// count points spread over the surface in proportion to area, plus every referenced vertex, since the largest
+// deviation of a simplified mesh is often at a corner. Sample k takes the face its stratum k / count falls in
+// on the cumulative area, then a uniform point inside it, so large faces are never skipped by chance.
+std::vector<glm::vec3> sampleSurface(const std::vector<glm::vec3> &vertices, const std::vector<glm::ivec3> &faces,
+                                     size_t count) {
+    std::vector<double> cumulative(faces.size() + 1, 0.0);
+    for (size_t f = 0; f < faces.size(); f++) {
+        glm::vec3 a = vertices[faces[f].x], b = vertices[faces[f].y], c = vertices[faces[f].z];
+        cumulative[f + 1] = cumulative[f] + 0.5 * glm::length(glm::cross(b - a, c - a));
+    }
+    std::vector<uint8_t> used(vertices.size(), 0);
+    for (const glm::ivec3 &f : faces) {
+        used[f.x] = used[f.y] = used[f.z] = 1;
+    }
+
+    std::vector<glm::vec3> points;
+    points.reserve(count + vertices.size());
+    for (size_t v = 0; v < vertices.size(); v++) {
+        if (used[v]) {
+            points.push_back(vertices[v]);
+        }
+    }
+    double total = cumulative.back();
+    if (faces.empty() || total <= 0.0) {
+        return points;
+    }
+
+    size_t first = points.size();
+    points.resize(first + count);
+    parallelFor(count, MESH_DISTANCE_GRAIN, [&](size_t k) {
+        double target = (k + sampleRandom(k, 0)) / count * total;
+        size_t f = std::upper_bound(cumulative.begin() + 1, cumulative.end(), target) - cumulative.begin() - 1;
+        f = std::min(f, faces.size() - 1);
+        float r1 = std::sqrt(sampleRandom(k, 1)), r2 = sampleRandom(k, 2);
+        glm::vec3 a = vertices[faces[f].x], b = vertices[faces[f].y], c = vertices[faces[f].z];
+        points[first + k] = a * (1.0f - r1) + b * (r1 * (1.0f - r2)) + c * (r1 * r2);
+    });
+    return points;
+}
+
+// One-sided distance from points to the surface in target. Each chunk of points keeps its own maximum and
+// sums, merged at the end in chunk order so the result does not depend on the thread count.
+MeshDistance pointsToSurface(const std::vector<glm::vec3> &points, const Bvh &target) {
+    MeshDistance result;
+    result.samples = points.size();
+    if (points.empty() || target.getTriangleCount() == 0) {
+        return result;
+    }
+
+    size_t chunks = (points.size() + MESH_DISTANCE_GRAIN - 1) / MESH_DISTANCE_GRAIN;
+    std::vector<float> chunkMax(chunks, 0.0f);
+    std::vector<double> chunkSum(chunks, 0.0), chunkSum2(chunks, 0.0);
+    parallelFor(chunks, 1, [&](size_t chunk) {
+        size_t begin = chunk * MESH_DISTANCE_GRAIN, end = std::min(begin + MESH_DISTANCE_GRAIN, points.size());
+        float hint = INFINITY;
+        for (size_t i = begin; i < end; i++) {
+            BvhClosest closest;
+            // neighbouring samples are usually near each other, so the last distance plus the step between
+            // them bounds this one and prunes the search from the start. Rounding can put the answer just
+            // past the bound, so a miss searches again without one.
+            float bound = INFINITY;
+            if (i > begin) {
+                bound = (hint + glm::length(points[i] - points[i - 1])) * 1.0001f;
+            }
+            if (!target.closestPoint(points[i], bound, closest)) {
+                target.closestPoint(points[i], INFINITY, closest);
+            }
+            float d = closest.distance;
+            hint = d;
+            chunkMax[chunk] = std::max(chunkMax[chunk], d);
+            chunkSum[chunk] += d;
+            chunkSum2[chunk] += (double) d * d;
+        }
+    });
+
+    double sum = 0.0, sum2 = 0.0;
+    for (size_t chunk = 0; chunk < chunks; chunk++) {
+        result.hausdorff = std::max(result.hausdorff, chunkMax[chunk]);
+        sum += chunkSum[chunk];
+        sum2 += chunkSum2[chunk];
+    }
+    result.mean = (float) (sum / points.size());
+    result.rms = (float) std::sqrt(sum2 / points.size());
+    return result;
+}
+
+// One-sided distance from mesh a to mesh b, over samples points on a (and its vertices)
+MeshDistance meshDistance(const std::vector<glm::vec3> &aVertices, const std::vector<glm::ivec3> &aFaces,
+                          const std::vector<glm::vec3> &bVertices, const std::vector<glm::ivec3> &bFaces,
+                          size_t samples = MESH_DISTANCE_DEFAULT_SAMPLES) {
+    Bvh bvh;
+    bvh.build(bVertices, bFaces);
+    return pointsToSurface(sampleSurface(aVertices, aFaces, samples), bvh);
+}
+
+// Symmetric error between an original mesh and its simplification, each side sampled with the same budget
+MeshError meshError(const std::vector<glm::vec3> &originalVertices, const std::vector<glm::ivec3> &originalFaces,
+                    const std::vector<glm::vec3> &simplifiedVertices, const std::vector<glm::ivec3> &simplifiedFaces,
+                    size_t samples = MESH_DISTANCE_DEFAULT_SAMPLES) {
+    MeshError error;
+    error.forward = meshDistance(originalVertices, originalFaces, simplifiedVertices, simplifiedFaces, samples);
+    error.backward = meshDistance(simplifiedVertices, simplifiedFaces, originalVertices, originalFaces, samples);
+    error.hausdorff = std::max(error.forward.hausdorff, error.backward.hausdorff);
+    size_t total = error.forward.samples + error.backward.samples;
+    if (total > 0) {
+        double sum2 = (double) error.forward.rms * error.forward.rms * error.forward.samples +
+                      (double) error.backward.rms * error.backward.rms * error.backward.samples;
+        error.rms = (float) std::sqrt(sum2 / total);
+    }
+    return error;
+}
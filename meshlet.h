@@ -0,0 +1,275 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+
+// limits that fit mesh shader workgroups on every vendor
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+struct Meshlet {
+    // ranges into MeshletData::vertices and MeshletData::triangles (in triangles, 3 bytes each)
+    uint32_t vertexOffset;
+    uint32_t triangleOffset;
+    uint32_t vertexCount;
+    uint32_t triangleCount;
+
+    // bounding sphere and normal cone for cluster culling, see culling.h
+    glm::vec3 center;
+    float radius;
+    glm::vec3 coneAxis;
+    float coneCutoff;
+};
+
+// Meshlet tables in the layout mesh shaders consume: each meshlet has a list of global vertex indices and
+// triangles made of 8-bit indices into that list.
+struct MeshletData {
+    std::vector<Meshlet> meshlets;
+    std::vector<uint32_t> vertices;
+    std::vector<uint8_t> triangles;
+};
+
+// Ritter's bounding sphere, good to within a few percent of the minimal one
+void computeBoundingSphere(const std::vector<glm::vec3> &points, glm::vec3 &center, float &radius) {
+    center = glm::vec3(0.0f);
+    radius = 0.0f;
+    if (points.empty()) {
+        return;
+    }
+
+    glm::vec3 a = points[0];
+    glm::vec3 b = a;
+    float best = -1.0f;
+    for (const glm::vec3 &p : points) {
+        float d = glm::dot(p - a, p - a);
+        if (d > best) {
+            best = d;
+            b = p;
+        }
+    }
+    glm::vec3 c = b;
+    best = -1.0f;
+    for (const glm::vec3 &p : points) {
+        float d = glm::dot(p - b, p - b);
+        if (d > best) {
+            best = d;
+            c = p;
+        }
+    }
+
+    center = (b + c) * 0.5f;
+    radius = glm::length(c - b) * 0.5f;
+    for (const glm::vec3 &p : points) {
+        float d = glm::length(p - center);
+        if (d > radius) {
+            // grow the sphere just enough to contain p
+            float newRadius = (radius + d) * 0.5f;
+            center += (p - center) * ((newRadius - radius) / d);
+            radius = newRadius;
+        }
+    }
+}
+
+void computeMeshletBounds(Meshlet &meshlet, const MeshletData &data, const std::vector<glm::vec3> &vertices) {
+    std::vector<glm::vec3> points(meshlet.vertexCount);
+    for (uint32_t i = 0; i < meshlet.vertexCount; i++) {
+        points[i] = vertices[data.vertices[meshlet.vertexOffset + i]];
+    }
+    computeBoundingSphere(points, meshlet.center, meshlet.radius);
+
+    // cone axis is the average of the triangle normals, the spread is set by the normal furthest from it
+    std::vector<glm::vec3> normals;
+    glm::vec3 axis(0.0f);
+    for (uint32_t t = 0; t < meshlet.triangleCount; t++) {
+        const uint8_t *tri = &data.triangles[3 * (meshlet.triangleOffset + t)];
+        glm::vec3 n = glm::cross(points[tri[1]] - points[tri[0]], points[tri[2]] - points[tri[0]]);
+        float len = glm::length(n);
+        if (len > 0.0f) {
+            normals.push_back(n / len);
+            axis += n / len;
+        }
+    }
+
+    float axisLength = glm::length(axis);
+    meshlet.coneAxis = axisLength > 0.0f ? axis / axisLength : glm::vec3(0.0f, 0.0f, 1.0f);
+    meshlet.coneCutoff = 1.0f;
+    if (axisLength > 0.0f) {
+        float minDot = 1.0f;
+        for (const glm::vec3 &n : normals) {
+            minDot = std::min(minDot, glm::dot(n, meshlet.coneAxis));
+        }
+        // a cone wider than a hemisphere can never be back-facing as a whole
+        if (minDot > 0.0f) {
+            meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+        }
+    }
+}
+
+// Greedy meshlet builder. Each meshlet grows from a seed triangle by adding the adjacent triangle that brings
+// in the fewest new vertices (vertex reuse), breaking ties by distance to the meshlet centroid (compactness).
+// When a meshlet has no adjacent triangles left it is closed and the next seed is taken in input order, so
+// running the vertex cache optimizer first keeps seeds spatially coherent.
+// faces is reordered so every meshlet's triangles are contiguous and start at its triangleOffset.
+MeshletData buildMeshlets(const std::vector<glm::vec3> &vertices, std::vector<glm::ivec3> &faces) {
+    MeshletData data;
+    size_t vertexCount = vertices.size();
+
+    // vertex to triangle adjacency in CSR layout
+    std::vector<int> offsets(vertexCount + 1, 0);
+    for (size_t i = 0; i < faces.size(); i++) {
+        for (int j = 0; j < 3; j++) {
+            offsets[faces[i][j] + 1]++;
+        }
+    }
+    for (size_t v = 0; v < vertexCount; v++) {
+        offsets[v + 1] += offsets[v];
+    }
+    std::vector<int> adjacency(offsets[vertexCount]);
+    std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < faces.size(); i++) {
+        for (int j = 0; j < 3; j++) {
+            adjacency[fill[faces[i][j]]++] = (int) i;
+        }
+    }
+
+    std::vector<glm::vec3> centroids(faces.size());
+    for (size_t i = 0; i < faces.size(); i++) {
+        centroids[i] = (vertices[faces[i][0]] + vertices[faces[i][1]] + vertices[faces[i][2]]) / 3.0f;
+    }
+
+    std::vector<bool> used(faces.size(), false);
+    std::vector<int> localIndex(vertexCount, -1);
+    std::vector<glm::ivec3> ordered;
+    ordered.reserve(faces.size());
+    std::vector<int> candidates;
+    size_t seedCursor = 0;
+
+    while (ordered.size() < faces.size()) {
+        while (used[seedCursor]) {
+            seedCursor++;
+        }
+
+        Meshlet meshlet = {};
+        meshlet.vertexOffset = (uint32_t) data.vertices.size();
+        meshlet.triangleOffset = (uint32_t) ordered.size();
+        glm::vec3 centroidSum(0.0f);
+        candidates.clear();
+
+        int next = (int) seedCursor;
+        while (next >= 0) {
+            glm::ivec3 face = faces[next];
+            used[next] = true;
+            ordered.push_back(face);
+            centroidSum += centroids[next];
+            for (int j = 0; j < 3; j++) {
+                int v = face[j];
+                if (localIndex[v] == -1) {
+                    localIndex[v] = meshlet.vertexCount++;
+                    data.vertices.push_back(v);
+                    candidates.insert(candidates.end(), adjacency.begin() + offsets[v], adjacency.begin() + offsets[v + 1]);
+                }
+                data.triangles.push_back((uint8_t) localIndex[v]);
+            }
+            meshlet.triangleCount++;
+
+            if (meshlet.triangleCount == MESHLET_MAX_TRIANGLES) {
+                break;
+            }
+
+            // pick the adjacent triangle adding the fewest vertices, then the closest to the centroid
+            glm::vec3 centroid = centroidSum / (float) meshlet.triangleCount;
+            next = -1;
+            int bestExtra = 4;
+            float bestDistance = FLT_MAX;
+            size_t live = 0;
+            for (size_t k = 0; k < candidates.size(); k++) {
+                int t = candidates[k];
+                if (used[t]) {
+                    continue;
+                }
+                candidates[live++] = t;
+                int extra = (localIndex[faces[t][0]] == -1) + (localIndex[faces[t][1]] == -1) + (localIndex[faces[t][2]] == -1);
+                if (meshlet.vertexCount + extra > MESHLET_MAX_VERTICES) {
+                    continue;
+                }
+                float distance = glm::dot(centroids[t] - centroid, centroids[t] - centroid);
+                if (extra < bestExtra || (extra == bestExtra && distance < bestDistance)) {
+                    bestExtra = extra;
+                    bestDistance = distance;
+                    next = t;
+                }
+            }
+            candidates.resize(live);
+        }
+
+        for (uint32_t i = 0; i < meshlet.vertexCount; i++) {
+            localIndex[data.vertices[meshlet.vertexOffset + i]] = -1;
+        }
+        computeMeshletBounds(meshlet, data, vertices);
+        data.meshlets.push_back(meshlet);
+    }
+
+    faces.swap(ordered);
+    return data;
+}
+
+// Binary meshlet table format: "MSHL", version, the three counts, then the raw arrays.
+#define MESHLET_FILE_VERSION 1
+
+bool writeMeshlets(const char* path, const MeshletData &data) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Unable to open %s for writing!\n", path);
+        return false;
+    }
+
+    uint32_t header[5] = {0, MESHLET_FILE_VERSION, (uint32_t) data.meshlets.size(),
+                          (uint32_t) data.vertices.size(), (uint32_t) data.triangles.size()};
+    memcpy(&header[0], "MSHL", 4);
+    bool ok = fwrite(header, sizeof(header), 1, file) == 1;
+    ok = ok && fwrite(data.meshlets.data(), sizeof(Meshlet), data.meshlets.size(), file) == data.meshlets.size();
+    ok = ok && fwrite(data.vertices.data(), sizeof(uint32_t), data.vertices.size(), file) == data.vertices.size();
+    ok = ok && fwrite(data.triangles.data(), sizeof(uint8_t), data.triangles.size(), file) == data.triangles.size();
+    fclose(file);
+
+    if (!ok) {
+        fprintf(stderr, "Failed writing meshlets to %s!\n", path);
+    }
+    return ok;
+}
+
+bool readMeshlets(const char* path, MeshletData &data) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Unable to open %s!\n", path);
+        return false;
+    }
+
+    uint32_t header[5];
+    bool ok = fread(header, sizeof(header), 1, file) == 1;
+    if (!ok || memcmp(&header[0], "MSHL", 4) != 0 || header[1] != MESHLET_FILE_VERSION) {
+        fprintf(stderr, "%s is not a version %d meshlet file!\n", path, MESHLET_FILE_VERSION);
+        fclose(file);
+        return false;
+    }
+
+    data.meshlets.resize(header[2]);
+    data.vertices.resize(header[3]);
+    data.triangles.resize(header[4]);
+    ok = fread(data.meshlets.data(), sizeof(Meshlet), data.meshlets.size(), file) == data.meshlets.size();
+    ok = ok && fread(data.vertices.data(), sizeof(uint32_t), data.vertices.size(), file) == data.vertices.size();
+    ok = ok && fread(data.triangles.data(), sizeof(uint8_t), data.triangles.size(), file) == data.triangles.size();
+    fclose(file);
+
+    if (!ok) {
+        fprintf(stderr, "%s is truncated!\n", path);
+    }
+    return ok;
+}
@@ -1,22 +1,56 @@
 #pragma once
 
 #include "utilities.h"
+#include "optimize.h"
+#include "quantize.h"
+#include "meshlet.h"
+#include "culling.h"
+#include "placement.h"
+#include "attributequadric.h"
+#include "importance.h"
+#include "bucketqueue.h"
+#include "spatialgrid.h"
+#include "spatialorder.h"
+#include "weld.h"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 #include <algorithm>
+#include <chrono>
 #include <unordered_map>
 #include <map>
 #include <queue>
+#include <cstddef>
+#include <cstring>
 
 #define DIM 256
 
+// segments in the persistently mapped index ring, one being written while up to two are in flight
+#define INDEX_RING_SEGMENTS 3
+
+// a vertex moved by a collapse and where it ended up, for feeding a model simplified elsewhere
+struct MovedVertex {
+    int index;
+    glm::vec3 position;
+    glm::vec3 normal;
+};
+
 class Model {
 public:
-    Model(const char* path) {
-        loadObj(path, _vertices, _faces, _normals);
+    // weldEpsilon >= 0 merges the vertices within it of each other after loading (weldVertices()), so seams
+    // the file split can be collapsed across; 0 merges exact duplicates only
+    Model(const char* path, float weldEpsilon = -1.0f) {
+        auto start = std::chrono::steady_clock::now();
+        loadObj(path, _vertices, _faces, _normals, &_colors);
+        if (weldEpsilon >= 0.0f) {
+            auto loaded = std::chrono::steady_clock::now();
+            weld(weldEpsilon);
+            fprintf(stderr, "Loaded in %.1f ms, welded in %.1f ms\n",
+                    std::chrono::duration<double, std::milli>(loaded - start).count(),
+                    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loaded).count());
+        }
 
         fprintf(stderr, "Vertices size is %lu\n", _vertices.size());
         fprintf(stderr, "Normals size is %lu\n", _normals.size());
@@ -25,52 +59,183 @@ public:
         computeQEM();
     }
 
-    void setupBuffers();
+    // CPU-only copy of a mesh, e.g. for simplifying on another thread
+    Model(const std::vector<glm::vec3> &vertices, const std::vector<glm::vec3> &normals, const std::vector<glm::ivec3> &faces)
+        : _vertices(vertices), _normals(normals), _faces(faces) {
+        computeQEM();
+    }
+
+    void setupBuffers(bool quantized = false);
     void draw();
+    void draw(const glm::mat4 &modelViewProjection, glm::vec3 eye, const HiZBuffer* occlusion = nullptr);
     void deleteGLResources();
     void collapseMesh();
     void computeQEM();
-    void collapseMeshQEM();
+    // collapses the cheapest pair; false once there is none left. A virtual pair joins two parts without
+    // removing a face, so the face count does not tell whether anything happened.
+    bool collapseMeshQEM();
+    // pick collapses from a BucketQueue instead of the exact multimap: cheaper to fill, but only ordered to
+    // within its bucket width. Rebuilds the queue.
+    void setBucketedQueue(bool bucketed, int precisionBits = BUCKET_QUEUE_DEFAULT_BITS);
+    // also consider collapsing vertices within threshold of each other that share no edge, so separate parts
+    // can merge (Garland and Heckbert's virtual pairs). 0 disables the search. Rebuilds the queue.
+    void setPairThreshold(float threshold);
+    // weigh the normals into the quadrics (Hoppe's attribute quadric), so collapses that would bend the shading
+    // cost more and the kept vertex gets the normal the quadric prefers. A weight of w makes a normal change
+    // of 1 cost like a distance of w in model units. 0 uses positions only. Rebuilds the queue.
+    void setNormalWeight(float weight);
+    // scale each vertex's quadric by its importance weight (see importance.h), one per vertex. Empty makes
+    // every vertex weigh 1. Rebuilds the queue.
+    void setImportance(const std::vector<float> &weights);
+    const std::vector<float>& getImportance() const { return _importance; }
+    // per-vertex colours from the OBJ, empty when it has none
+    const std::vector<glm::vec3>& getColors() const { return _colors; }
+    // virtual pairs found by the last computeQEM() and how long the search took
+    size_t getVirtualPairCount() const { return _virtualPairCount; }
+    double getPairSearchMs() const { return _pairSearchMs; }
+    // push the faces changed and the vertices moved by collapses to the GPU, once per frame however many
+    // collapses ran
+    void uploadDirtyFaces();
+    void optimizeVertexCache();
+    void optimizeVertexFetch();
+    // sort vertices along a Morton curve and faces after them (reorderMeshSpatially()), so the simplifier's
+    // passes over the mesh stay cache friendly. Best run right after loading.
+    void reorderSpatially();
+    void buildMeshlets();
+    bool saveMeshlets(const char* path) const { return writeMeshlets(path, _meshlets); }
+
+    // replace the mesh with one simplified elsewhere and upload it. The QEM state is not rebuilt,
+    // a model fed this way is only drawn.
+    void setVertices(const std::vector<glm::vec3> &vertices, const std::vector<glm::vec3> &normals);
+    // move vertices of the current streams, e.g. the ones collapses moved since setVertices(), and upload only
+    // those
+    void moveVertices(const MovedVertex* moved, size_t count);
+    void setFaces(const std::vector<glm::ivec3> &faces, const MeshletData &meshlets);
+
+    const std::vector<glm::vec3>& getVertices() const { return _vertices; }
+    const std::vector<glm::vec3>& getNormals() const { return _normals; }
+    const std::vector<glm::ivec3>& getFaces() const { return _faces; }
+
+    // position decode parameters for shaders/basic.vert: identity unless the quantized output is used
+    bool isQuantized() const { return _quantized; }
+    glm::vec3 getPositionOffset() const { return _positionOffset; }
+    glm::vec3 getPositionScale() const { return _positionScale; }
+
+    const MeshletData& getMeshlets() const { return _meshlets; }
+    size_t getVisibleMeshletCount() const { return _visibleMeshlets; }
+
+    // index and vertex bytes written to the GPU since the model was created
+    size_t getUploadedBytes() const { return _uploadedBytes; }
+
+    // vertices moved by collapses since the last upload, which never comes for a model without buffers: its
+    // owner reads and clears them instead
+    const std::vector<int>& getMovedVertices() const { return _movedVertices; }
+    void clearMovedVertices() {
+        _movedVertices.clear();
+        _movedNormals = false;
+    }
 
 private:
     std::vector<glm::vec3> _vertices;
     std::vector<glm::vec3> _normals;
     std::vector<glm::ivec3> _faces;
+    std::vector<glm::vec3> _colors;
 
     // Quadric Error Metric simplification data structures
     std::unordered_multimap<int, int> _vertexFaceAdjacency;
     std::unordered_multimap<int, int> _edges;
     std::unordered_map<int, glm::mat4> _quadrics;
+    // per vertex, used instead of _quadrics when _normalWeight is set
+    std::vector<AttributeQuadric> _attributeQuadrics;
+    float _normalWeight = 0.0f;
+    // per-vertex quadric scale, empty for all 1
+    std::vector<float> _importance;
     std::multimap<float, std::pair<int, int>> _pairs;
-
-    GLuint _vao;
-    GLuint _vertexBuffer;
-    GLuint _normalBuffer;
-    GLuint _faceBuffer;
+    // used instead of _pairs when _bucketed is set
+    BucketQueue<std::pair<int, int>> _bucketedPairs;
+    bool _bucketed = false;
+    float _pairThreshold = 0.0f;
+    size_t _virtualPairCount = 0;
+    double _pairSearchMs = 0.0;
+
+    // meshlets over the final _faces, whose triangles are kept in meshlet order. Cleared by any collapse.
+    MeshletData _meshlets;
+    // meshlet bounds in the layout cullChunks() takes, rebuilt whenever _meshlets changes
+    ChunkBounds _chunkBounds;
+    std::vector<uint8_t> _chunkVisible;
+    size_t _visibleMeshlets = 0;
+    std::vector<GLsizei> _drawCounts;
+    std::vector<const void*> _drawOffsets;
+
+    // zero until setupBuffers() runs, so the CPU-side code can be used without a GL context
+    GLuint _vao = 0;
+    GLuint _vertexBuffer = 0;
+    GLuint _normalBuffer = 0;
+    GLuint _faceBuffer = 0;
+    GLenum _indexType = GL_UNSIGNED_INT;
+
+    // persistently mapped index ring, see allocateFaceRing()
+    char* _faceMapping = nullptr;
+    size_t _segmentBytes = 0;
+    int _segment = 0;
+    GLsync _segmentFences[INDEX_RING_SEGMENTS] = {};
+    bool _segmentStale[INDEX_RING_SEGMENTS] = {};
+    std::vector<uint32_t> _dirtyFaces[INDEX_RING_SEGMENTS];
+    // vertices moved to their optimal placement since the last upload, and whether any of their normals
+    // changed too
+    std::vector<int> _movedVertices;
+    bool _movedNormals = false;
+    size_t _uploadedBytes = 0;
+
+    bool _quantized = false;
+    glm::vec3 _positionOffset = glm::vec3(0.0f);
+    glm::vec3 _positionScale = glm::vec3(1.0f);
+
+    void allocateFaceRing(size_t faceCapacity);
+    void markFaceDirty(size_t face);
+    void writeFaces(char* segment, size_t begin, size_t end);
+    void uploadFaces();
+    void uploadVertices();
+    void uploadMovedVertices();
+    void updateChunkBounds();
+    void findVirtualPairs(std::vector<std::pair<int, int>> &pairs);
+    void computeAttributeQuadrics();
+    void weld(float epsilon);
 };
 
-void Model::setupBuffers() {
+void Model::setupBuffers(bool quantized) {
+    _quantized = quantized;
+
     glGenVertexArrays(1, &_vao);
     glBindVertexArray(_vao);
 
-    // vertex buffer
     glGenBuffers(1, &_vertexBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, _vertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, _vertices.size() * sizeof(_vertices.at(0)), _vertices.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, false, sizeof(glm::vec3), (void *) 0);
-    glEnableVertexAttribArray(0);
-
-    // normal buffer
-    glGenBuffers(1, &_normalBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, _normalBuffer);
-    glBufferData(GL_ARRAY_BUFFER, _normals.size() * sizeof(_normals.at(0)), _normals.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(1, 3, GL_FLOAT, false, sizeof(glm::vec3), (void *) 0);
-    glEnableVertexAttribArray(1);
-
-    // vertex index buffer for drawing faces
+    if (_quantized) {
+        // one interleaved buffer: unorm16 position relative to the AABB, oct-encoded snorm16 normal
+        glBindBuffer(GL_ARRAY_BUFFER, _vertexBuffer);
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, true, sizeof(QuantizedVertex), (void *) offsetof(QuantizedVertex, position));
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 2, GL_SHORT, true, sizeof(QuantizedVertex), (void *) offsetof(QuantizedVertex, normal));
+        glEnableVertexAttribArray(1);
+    }
+    else {
+        // vertex buffer
+        glBindBuffer(GL_ARRAY_BUFFER, _vertexBuffer);
+        glVertexAttribPointer(0, 3, GL_FLOAT, false, sizeof(glm::vec3), (void *) 0);
+        glEnableVertexAttribArray(0);
+
+        // normal buffer
+        glGenBuffers(1, &_normalBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, _normalBuffer);
+        glVertexAttribPointer(1, 3, GL_FLOAT, false, sizeof(glm::vec3), (void *) 0);
+        glEnableVertexAttribArray(1);
+    }
+    uploadVertices();
+
+    // vertex index buffer for drawing faces, sized for the unsimplified mesh
     glGenBuffers(1, &_faceBuffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _faceBuffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, _faces.size() * sizeof(_faces.at(0)), _faces.data(), GL_STATIC_DRAW);
+    allocateFaceRing(_faces.size());
+    uploadFaces();
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -78,15 +243,296 @@ void Model::setupBuffers() {
 }
 
 void Model::deleteGLResources() {
+    if (_faceMapping) {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _faceBuffer);
+        glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+        _faceMapping = nullptr;
+    }
+    for (int i = 0; i < INDEX_RING_SEGMENTS; i++) {
+        if (_segmentFences[i]) {
+            glDeleteSync(_segmentFences[i]);
+            _segmentFences[i] = 0;
+        }
+    }
     glDeleteBuffers(1, &_vertexBuffer);
+    glDeleteBuffers(1, &_normalBuffer);
     glDeleteBuffers(1, &_faceBuffer);
     glDeleteVertexArrays(1, &_vao);
 }
 
+// Allocate the index ring once with immutable storage: INDEX_RING_SEGMENTS copies of the index buffer, mapped
+// persistently. Each update writes the next segment while the GPU may still read the previous ones, guarded by
+// a fence per segment. Falls back to glBufferData when buffer storage is not available.
+void Model::allocateFaceRing(size_t faceCapacity) {
+    if (!GLAD_GL_VERSION_4_4) {
+        return;
+    }
+    if (_faceMapping) {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _faceBuffer);
+        glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+        glDeleteBuffers(1, &_faceBuffer);
+        glGenBuffers(1, &_faceBuffer);
+    }
+
+    _segmentBytes = std::max<size_t>(faceCapacity, 1) * sizeof(glm::ivec3);
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _faceBuffer);
+    glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, _segmentBytes * INDEX_RING_SEGMENTS, nullptr, flags);
+    _faceMapping = (char *) glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, _segmentBytes * INDEX_RING_SEGMENTS, flags);
+    _segment = 0;
+}
+
+void Model::markFaceDirty(size_t face) {
+    if (_faceMapping == nullptr) {
+        return;
+    }
+    for (int i = 0; i < INDEX_RING_SEGMENTS; i++) {
+        _dirtyFaces[i].push_back((uint32_t) face);
+    }
+}
+
+// copy faces [begin, end) into the mapped segment in the current index format
+void Model::writeFaces(char* segment, size_t begin, size_t end) {
+    if (_indexType == GL_UNSIGNED_SHORT) {
+        uint16_t* indices = (uint16_t *) segment;
+        for (size_t i = begin; i < end; i++) {
+            indices[3 * i + 0] = (uint16_t) _faces[i].x;
+            indices[3 * i + 1] = (uint16_t) _faces[i].y;
+            indices[3 * i + 2] = (uint16_t) _faces[i].z;
+        }
+    }
+    else {
+        memcpy(segment + begin * sizeof(glm::ivec3), _faces.data() + begin, (end - begin) * sizeof(glm::ivec3));
+    }
+    _uploadedBytes += (end - begin) * 3 * (_indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t));
+}
+
+// re-upload every face, for changes that reorder the whole buffer
+void Model::uploadFaces() {
+    for (int i = 0; i < INDEX_RING_SEGMENTS; i++) {
+        _segmentStale[i] = true;
+        _dirtyFaces[i].clear();
+    }
+    uploadDirtyFaces();
+}
+
+// upload only the faces marked with markFaceDirty() since the next segment was last written
+void Model::uploadDirtyFaces() {
+    uploadMovedVertices();
+    if (_faceBuffer == 0) {
+        return;
+    }
+    // the quantized output drops to 16-bit indices whenever the vertices fit
+    GLenum indexType = _quantized && _vertices.size() < 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+    if (!GLAD_GL_VERSION_4_4) {
+        _indexType = indexType;
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _faceBuffer);
+        if (_indexType == GL_UNSIGNED_SHORT) {
+            std::vector<uint16_t> indices = packIndices16(_faces);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint16_t), indices.data(), GL_STATIC_DRAW);
+        }
+        else {
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, _faces.size() * sizeof(glm::ivec3), _faces.data(), GL_STATIC_DRAW);
+        }
+        _uploadedBytes += _faces.size() * 3 * (_indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t));
+        return;
+    }
+
+    if (_faceMapping == nullptr || _faces.size() * sizeof(glm::ivec3) > _segmentBytes) {
+        allocateFaceRing(_faces.size());
+        for (int i = 0; i < INDEX_RING_SEGMENTS; i++) {
+            _segmentStale[i] = true;
+            _dirtyFaces[i].clear();
+        }
+    }
+    if (indexType != _indexType) {
+        _indexType = indexType;
+        for (int i = 0; i < INDEX_RING_SEGMENTS; i++) {
+            _segmentStale[i] = true;
+        }
+    }
+
+    // retire the segment draws have been reading from and wait until the GPU is done with the next one
+    if (_segmentFences[_segment]) {
+        glDeleteSync(_segmentFences[_segment]);
+    }
+    _segmentFences[_segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    _segment = (_segment + 1) % INDEX_RING_SEGMENTS;
+    if (_segmentFences[_segment]) {
+        // the GPU may still be reading the segment through the persistent mapping, so keep waiting past a
+        // timeout, and drain the whole queue if the wait itself fails
+        GLenum wait;
+        do {
+            wait = glClientWaitSync(_segmentFences[_segment], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        } while (wait == GL_TIMEOUT_EXPIRED);
+        if (wait == GL_WAIT_FAILED) {
+            glFinish();
+        }
+        glDeleteSync(_segmentFences[_segment]);
+        _segmentFences[_segment] = 0;
+    }
+
+    char* segment = _faceMapping + _segment * _segmentBytes;
+    std::vector<uint32_t> &dirty = _dirtyFaces[_segment];
+    if (_segmentStale[_segment]) {
+        writeFaces(segment, 0, _faces.size());
+        _segmentStale[_segment] = false;
+    }
+    else {
+        // coalesce the dirty faces into ranges, faces past the end were removed and need no upload
+        std::sort(dirty.begin(), dirty.end());
+        dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+        for (size_t i = 0; i < dirty.size() && dirty[i] < _faces.size(); ) {
+            size_t j = i + 1;
+            while (j < dirty.size() && dirty[j] == dirty[j - 1] + 1 && dirty[j] < _faces.size()) {
+                j++;
+            }
+            writeFaces(segment, dirty[i], dirty[j - 1] + 1);
+            i = j;
+        }
+    }
+    dirty.clear();
+}
+
+void Model::uploadVertices() {
+    // a full upload covers any vertex moved so far
+    _movedVertices.clear();
+    _movedNormals = false;
+    if (_vertexBuffer == 0) {
+        return;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, _vertexBuffer);
+    if (_quantized) {
+        std::vector<QuantizedVertex> packed = quantizeVertices(_vertices, _normals, _positionOffset, _positionScale);
+        glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(QuantizedVertex), packed.data(), GL_STATIC_DRAW);
+    }
+    else {
+        glBufferData(GL_ARRAY_BUFFER, _vertices.size() * sizeof(glm::vec3), _vertices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, _normalBuffer);
+        glBufferData(GL_ARRAY_BUFFER, _normals.size() * sizeof(glm::vec3), _normals.data(), GL_STATIC_DRAW);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Vertices moved by collapses are written one by one. A quantized vertex keeps the box the buffer was
+// quantized with; optimal placements usually land inside it and anything outside is clamped.
+void Model::uploadMovedVertices() {
+    if (_vertexBuffer == 0 || _movedVertices.empty()) {
+        _movedVertices.clear();
+        _movedNormals = false;
+        return;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, _vertexBuffer);
+    for (int v : _movedVertices) {
+        if (_quantized) {
+            QuantizedVertex packed = quantizeVertex(_vertices[v], _normals[v], _positionOffset, _positionScale);
+            glBufferSubData(GL_ARRAY_BUFFER, v * sizeof(QuantizedVertex), sizeof(QuantizedVertex), &packed);
+            _uploadedBytes += sizeof(QuantizedVertex);
+        }
+        else {
+            glBufferSubData(GL_ARRAY_BUFFER, v * sizeof(glm::vec3), sizeof(glm::vec3), &_vertices[v]);
+            _uploadedBytes += sizeof(glm::vec3);
+            if (_movedNormals) {
+                // normals are in their own buffer, and attribute-aware collapses change them too
+                glBindBuffer(GL_ARRAY_BUFFER, _normalBuffer);
+                glBufferSubData(GL_ARRAY_BUFFER, v * sizeof(glm::vec3), sizeof(glm::vec3), &_normals[v]);
+                glBindBuffer(GL_ARRAY_BUFFER, _vertexBuffer);
+                _uploadedBytes += sizeof(glm::vec3);
+            }
+        }
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    _movedVertices.clear();
+    _movedNormals = false;
+}
+
+void Model::setVertices(const std::vector<glm::vec3> &vertices, const std::vector<glm::vec3> &normals) {
+    _vertices = vertices;
+    _normals = normals;
+    uploadVertices();
+}
+
+void Model::moveVertices(const MovedVertex* moved, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const MovedVertex &m = moved[i];
+        _vertices[m.index] = m.position;
+        if (m.normal != _normals[m.index]) {
+            _normals[m.index] = m.normal;
+            _movedNormals = true;
+        }
+        _movedVertices.push_back(m.index);
+    }
+    uploadMovedVertices();
+}
+
+void Model::setFaces(const std::vector<glm::ivec3> &faces, const MeshletData &meshlets) {
+    // consecutive snapshots mostly differ in a handful of faces, only those get uploaded
+    for (size_t i = 0; i < faces.size(); i++) {
+        if (i >= _faces.size() || faces[i] != _faces[i]) {
+            markFaceDirty(i);
+        }
+    }
+    _faces = faces;
+    _meshlets = meshlets;
+    updateChunkBounds();
+    uploadDirtyFaces();
+}
+
 void Model::draw() {
     glBindVertexArray(_vao);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _faceBuffer);
-    glDrawElements(GL_TRIANGLES, _faces.size() * 3, GL_UNSIGNED_INT, (void *) 0);
+    glDrawElements(GL_TRIANGLES, _faces.size() * 3, _indexType, (void *) (_segment * _segmentBytes));
+}
+
+// draw with CPU cluster culling: meshlets outside the frustum or entirely back-facing are skipped and the
+// remaining ranges of the index buffer are submitted with one glMultiDrawElements. eye is in model space.
+// With an occlusion buffer rendered with the same matrix, meshlets hidden behind it are skipped too.
+void Model::draw(const glm::mat4 &modelViewProjection, glm::vec3 eye, const HiZBuffer* occlusion) {
+    if (_meshlets.meshlets.empty()) {
+        _visibleMeshlets = 0;
+        draw();
+        return;
+    }
+
+    Frustum frustum = extractFrustum(modelViewProjection);
+    size_t indexSize = _indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+    _drawCounts.clear();
+    _drawOffsets.clear();
+    _visibleMeshlets = 0;
+
+    cullChunks(_chunkBounds, frustum, eye, _chunkVisible);
+
+    uint32_t rangeEnd = UINT32_MAX;
+    for (size_t i = 0; i < _meshlets.meshlets.size(); i++) {
+        if (!_chunkVisible[i]) {
+            continue;
+        }
+        const Meshlet &m = _meshlets.meshlets[i];
+        if (occlusion && sphereOccluded(*occlusion, modelViewProjection, m.center, m.radius)) {
+            continue;
+        }
+        _visibleMeshlets++;
+        // merge with the previous range when the meshlets are adjacent in the index buffer
+        if (m.triangleOffset == rangeEnd) {
+            _drawCounts.back() += m.triangleCount * 3;
+        } else {
+            _drawCounts.push_back(m.triangleCount * 3);
+            _drawOffsets.push_back((const void *) (_segment * _segmentBytes + m.triangleOffset * 3 * indexSize));
+        }
+        rangeEnd = m.triangleOffset + m.triangleCount;
+    }
+
+    glBindVertexArray(_vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _faceBuffer);
+    glMultiDrawElements(GL_TRIANGLES, _drawCounts.data(), _indexType, _drawOffsets.data(), (GLsizei) _drawCounts.size());
+}
+
+void Model::updateChunkBounds() {
+    _chunkBounds = ChunkBounds();
+    for (const Meshlet &m : _meshlets.meshlets) {
+        addChunk(_chunkBounds, m.center, m.radius, m.coneAxis, m.coneCutoff);
+    }
 }
 
 glm::mat4 computeKp(glm::vec4 plane) {
@@ -98,6 +544,7 @@ void Model::computeQEM() {
     _edges.clear();
     _quadrics.clear();
     _pairs.clear();
+    _bucketedPairs.clear();
 
     // compute vertex to face adjacency and vertex-vertex adjacency
     // TODO: this can be moved into the file parsing function.
@@ -113,47 +560,163 @@ void Model::computeQEM() {
 
     }
 
-    for (auto kv : _vertexFaceAdjacency) {
-        int vertexIndex = kv.first;
-        int faceIndex = kv.second;
-
-        glm::mat4 Kp = computeKp(computePlaneCoeffs(_vertices[_faces[faceIndex][0]], 
-                                                    _vertices[_faces[faceIndex][1]], 
-                                                    _vertices[_faces[faceIndex][2]]));
+    // per-vertex quadrics: positions only, or positions and normals in one face pass
+    if (_normalWeight > 0.0f) {
+        computeAttributeQuadrics();
+    }
+    else {
+        for (auto kv : _vertexFaceAdjacency) {
+            int vertexIndex = kv.first;
+            int faceIndex = kv.second;
+
+            glm::mat4 Kp = computeKp(computePlaneCoeffs(_vertices[_faces[faceIndex][0]], 
+                                                        _vertices[_faces[faceIndex][1]], 
+                                                        _vertices[_faces[faceIndex][2]]));
+            if (!_importance.empty()) {
+                Kp *= _importance[vertexIndex];
+            }
         
-        auto quadric_it = _quadrics.find(vertexIndex);
-        if ( quadric_it == _quadrics.end()) {
-            _quadrics.emplace(vertexIndex, Kp);
+            auto quadric_it = _quadrics.find(vertexIndex);
+            if ( quadric_it == _quadrics.end()) {
+                _quadrics.emplace(vertexIndex, Kp);
+            } else {
+                _quadrics[vertexIndex] += Kp;
+            }        
+        }
+
+        for (auto kv : _quadrics) {
+            int vertexIndex = kv.first;
+            glm::mat4 q = kv.second;
+            kv.second = glm::outerProduct(glm::vec4(_vertices[vertexIndex], 1), q * glm::vec4(_vertices[vertexIndex], 1));
+        }
+    }
+
+    // for every edge, compute the error of the pair at its optimal placement. The solves run in one batch.
+    std::vector<std::pair<int, int>> edges;
+    std::vector<glm::mat4> edgeQuadrics;
+    std::vector<glm::vec3> p1, p2;
+    edges.reserve(_edges.size());
+    edgeQuadrics.reserve(_edges.size());
+    p1.reserve(_edges.size());
+    p2.reserve(_edges.size());
+    for (auto it = _edges.begin(); it != _edges.end(); it++) {
+        edges.emplace_back(it->first, it->second);
+    }
+    if (_pairThreshold > 0.0f) {
+        findVirtualPairs(edges);
+    }
+    for (const std::pair<int, int> &edge : edges) {
+        p1.push_back(_vertices[edge.first]);
+        p2.push_back(_vertices[edge.second]);
+    }
+    if (_normalWeight > 0.0f) {
+        edgeQuadrics.resize(edges.size());
+        reducedQuadrics(_attributeQuadrics.data(), edges.data(), edges.size(), 3, edgeQuadrics.data());
+    }
+    else {
+        for (const std::pair<int, int> &edge : edges) {
+            edgeQuadrics.push_back(_quadrics.at(edge.first) + _quadrics.at(edge.second));
+        }
+    }
+    std::vector<glm::vec3> positions(edges.size());
+    std::vector<float> errors(edges.size());
+    optimalPlacements(edgeQuadrics.data(), p1.data(), p2.data(), edges.size(), positions.data(), errors.data());
+    for (size_t i = 0; i < edges.size(); i++) {
+        if (_bucketed) {
+            _bucketedPairs.push(errors[i], edges[i]);
         } else {
-            _quadrics[vertexIndex] += Kp;
-        }        
+            _pairs.emplace(errors[i], edges[i]);
+        }
     }
+}
 
-    for (auto kv : _quadrics) {
-        int vertexIndex = kv.first;
-        glm::mat4 q = kv.second;
-        kv.second = glm::outerProduct(glm::vec4(_vertices[vertexIndex], 1), q * glm::vec4(_vertices[vertexIndex], 1));
+// Appends the pairs of referenced vertices within _pairThreshold that are not already edges. Vertices
+// orphaned by earlier collapses are in no face and stay out of the grid.
+void Model::findVirtualPairs(std::vector<std::pair<int, int>> &pairs) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> referenced(_vertices.size(), 0);
+    for (const glm::ivec3 &face : _faces) {
+        referenced[face.x] = referenced[face.y] = referenced[face.z] = 1;
     }
+    std::vector<std::pair<int, int>> close = findClosePairs(_vertices, _pairThreshold, &referenced);
+
+    _virtualPairCount = 0;
+    for (const std::pair<int, int> &pair : close) {
+        bool isEdge = false;
+        for (int v : {pair.first, pair.second}) {
+            int other = v == pair.first ? pair.second : pair.first;
+            auto range = _edges.equal_range(v);
+            for (auto it = range.first; it != range.second && !isEdge; it++) {
+                isEdge = it->second == other;
+            }
+        }
+        if (!isEdge) {
+            pairs.push_back(pair);
+            _virtualPairCount++;
+        }
+    }
+    _pairSearchMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
 
-    // for every edge, compute the error of the pair
-    for (auto it = _edges.begin(); it != _edges.end(); it++) {
-        int v1 = it->first;
-        int v2 = it->second;
-        glm::mat4 Q = _quadrics.at(v1) + _quadrics.at(v2);
-        glm::vec3 midpoint = (_vertices[v1] + _vertices[v2]) / 2.0f;
-        float error = glm::dot(glm::vec4(midpoint, 1.0f), Q * glm::vec4(midpoint, 1.0f));
-        _pairs.emplace(error, std::make_pair(v1, v2));
+// Each face's quadric is built once, from its corners' positions and weighted normals, and added to its three
+// vertices. Vertices in no face keep an empty quadric.
+void Model::computeAttributeQuadrics() {
+    _attributeQuadrics.assign(_vertices.size(), AttributeQuadric());
+    for (const glm::ivec3 &face : _faces) {
+        glm::vec3 n0 = _normals[face.x] * _normalWeight;
+        glm::vec3 n1 = _normals[face.y] * _normalWeight;
+        glm::vec3 n2 = _normals[face.z] * _normalWeight;
+        AttributeQuadric q = faceAttributeQuadric(_vertices[face.x], _vertices[face.y], _vertices[face.z],
+                                                  &n0.x, &n1.x, &n2.x, 3);
+        _attributeQuadrics[face.x] += q;
+        _attributeQuadrics[face.y] += q;
+        _attributeQuadrics[face.z] += q;
+    }
+    for (size_t v = 0; v < _importance.size(); v++) {
+        _attributeQuadrics[v] *= _importance[v];
     }
 }
 
-void Model::collapseMeshQEM() {
-    if (_pairs.empty()) {
+void Model::setImportance(const std::vector<float> &weights) {
+    if (!weights.empty() && weights.size() != _vertices.size()) {
+        fprintf(stderr, "Importance has %lu weights for %lu vertices, ignored\n", weights.size(), _vertices.size());
         return;
     }
+    // a negative weight would turn the quadric upside down
+    _importance = weights;
+    for (float &w : _importance) {
+        w = std::max(w, 0.0f);
+    }
+    computeQEM();
+}
 
-    auto smallestEdge = _pairs.begin();
-    int v1 = smallestEdge->second.first;
-    int v2 = smallestEdge->second.second;
+void Model::setNormalWeight(float weight) {
+    _normalWeight = weight;
+    _attributeQuadrics.clear();
+    computeQEM();
+}
+
+void Model::setPairThreshold(float threshold) {
+    _pairThreshold = threshold;
+    _virtualPairCount = 0;
+    _pairSearchMs = 0.0;
+    computeQEM();
+}
+
+void Model::setBucketedQueue(bool bucketed, int precisionBits) {
+    _bucketed = bucketed;
+    _bucketedPairs = BucketQueue<std::pair<int, int>>(precisionBits);
+    computeQEM();
+}
+
+bool Model::collapseMeshQEM() {
+    if (_bucketed ? _bucketedPairs.empty() : _pairs.empty()) {
+        return false;
+    }
+
+    std::pair<int, int> smallestEdge = _bucketed ? _bucketedPairs.top().second : _pairs.begin()->second;
+    int v1 = smallestEdge.first;
+    int v2 = smallestEdge.second;
 
     size_t v1_count = _vertexFaceAdjacency.count(v1);
     size_t v2_count = _vertexFaceAdjacency.count(v2);
@@ -161,28 +724,55 @@ void Model::collapseMeshQEM() {
     int toKeep = v1_count > v2_count ? v2 : v1;
     int toRemove = v1_count > v2_count ? v1 : v2;
 
+    // the kept vertex moves to where the combined quadric is smallest. With normals in the quadric it also
+    // takes the normal the quadric prefers there.
+    glm::vec3 position;
+    bool normalChanged = false;
+    if (_normalWeight > 0.0f) {
+        AttributeQuadric q = _attributeQuadrics[v1] + _attributeQuadrics[v2];
+        optimalPlacement(reducedQuadric(q, 3), _vertices[v1], _vertices[v2], position);
+        glm::vec3 normal;
+        attributeValues(q, 3, position, &normal.x);
+        if (glm::dot(normal, normal) > 0.0f) {
+            _normals[toKeep] = glm::normalize(normal);
+            normalChanged = true;
+            _movedNormals = true;
+        }
+    }
+    else {
+        optimalPlacement(_quadrics.at(v1) + _quadrics.at(v2), _vertices[v1], _vertices[v2], position);
+    }
+    if (position != _vertices[toKeep] || normalChanged) {
+        _vertices[toKeep] = position;
+        _movedVertices.push_back(toKeep);
+    }
+
     // change all instances of the more-frequent vertex to the less-frequent vertex
     for (size_t i = 0; i < _faces.size(); i++) {
         for (int j = 0; j < 3; j++) {
             if (_faces[i][j] == toRemove) {
                 _faces[i][j] = toKeep;
+                markFaceDirty(i);
             }
         }
     }
 
-    for (auto it = _faces.begin(); it != _faces.end(); ) {
-        if (it->x == it->y || it->x == it->z || it->y == it->z) {
-            it = _faces.erase(it);
+    // remove degenerate faces by moving the last face into their slot, so only the faces this collapse
+    // touched have to be uploaded again
+    for (size_t i = 0; i < _faces.size(); ) {
+        glm::ivec3 face = _faces[i];
+        if (face.x == face.y || face.x == face.z || face.y == face.z) {
+            _faces[i] = _faces.back();
+            _faces.pop_back();
+            markFaceDirty(i);
         }
         else {
-            it++;
+            i++;
         }
     }
-    fprintf(stderr, "Collapsed mesh now has %lu vertices and %lu faces\n", _vertices.size(), _faces.size());
-
-    // update GL buffer
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _faceBuffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, _faces.size() * sizeof(_faces.at(0)), _faces.data(), GL_STATIC_DRAW);
+    // the face order and meshlet bounds no longer match
+    _meshlets = MeshletData();
+    updateChunkBounds();
 
     computeQEM();
 
@@ -197,4 +787,94 @@ void Model::collapseMeshQEM() {
     // for each adjacent face, recalculate the error quadrics for every vertex in the face
     
     // then remove all key-value pairs in _pairs that use v2 i
-}
\ No newline at end of file
+    return true;
+}
+
+// merge the loaded vertices within epsilon of each other, before any state is built over them
+void Model::weld(float epsilon) {
+    size_t before = _vertices.size(), facesBefore = _faces.size();
+    std::vector<int> remap = weldVertices(_vertices, _faces, epsilon);
+    weldNormals(_normals, remap);
+    if (!_colors.empty()) {
+        weldVertexStream(_colors, remap);
+    }
+    fprintf(stderr, "Welded %lu vertices into %lu, dropping %lu collapsed faces\n",
+            before, _vertices.size(), facesBefore - _faces.size());
+}
+
+void Model::reorderSpatially() {
+    std::vector<int> remap = reorderMeshSpatially(_vertices, _faces);
+    remapVertexStream(_normals, remap, _vertices.size());
+    if (!_colors.empty()) {
+        remapVertexStream(_colors, remap, _vertices.size());
+    }
+    if (!_importance.empty()) {
+        remapVertexStream(_importance, remap, _vertices.size());
+    }
+    // the faces moved, so meshlets built over the old order no longer apply
+    _meshlets = MeshletData();
+    updateChunkBounds();
+
+    computeQEM();
+
+    uploadVertices();
+    uploadFaces();
+}
+
+// reorder the final index buffer for the post-transform vertex cache. The collapses leave _faces in whatever
+// order they happened to be erased in, so this is best run once simplification is done.
+void Model::optimizeVertexCache() {
+    VertexCacheStats before = simulateVertexCacheFIFO(_faces, _vertices.size());
+    optimizeVertexCacheTipsify(_faces, _vertices.size());
+    VertexCacheStats after = simulateVertexCacheFIFO(_faces, _vertices.size());
+    fprintf(stderr, "Vertex cache optimization: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+            before.acmr, after.acmr, before.atvr, after.atvr);
+
+    uploadFaces();
+}
+
+// renumber _vertices and _normals into first-use order of the (already cache optimized) index buffer and drop
+// the vertices the collapses orphaned. Vertex indices change, so the QEM state is rebuilt afterwards.
+void Model::optimizeVertexFetch() {
+    VertexFetchStats before = simulateVertexFetch(_faces, _vertices.size(), 2 * sizeof(glm::vec3));
+
+    size_t newVertexCount = 0;
+    std::vector<int> remap = optimizeVertexFetchRemap(_faces, _vertices.size(), newVertexCount);
+    remapVertexStream(_vertices, remap, newVertexCount);
+    remapVertexStream(_normals, remap, newVertexCount);
+    if (!_colors.empty()) {
+        remapVertexStream(_colors, remap, newVertexCount);
+    }
+    if (!_importance.empty()) {
+        remapVertexStream(_importance, remap, newVertexCount);
+    }
+    for (uint32_t &v : _meshlets.vertices) {
+        v = remap[v];
+    }
+
+    VertexFetchStats after = simulateVertexFetch(_faces, _vertices.size(), 2 * sizeof(glm::vec3));
+    fprintf(stderr, "Vertex fetch optimization: %lu vertices, overfetch %.3f -> %.3f\n",
+            _vertices.size(), before.overfetch, after.overfetch);
+
+    computeQEM();
+
+    uploadVertices();
+    uploadFaces();
+}
+
+// split the final _faces into meshlets for cluster culling. Triangles are reordered into meshlet order,
+// so run this after optimizeVertexCache() and before optimizeVertexFetch().
+void Model::buildMeshlets() {
+    _meshlets = ::buildMeshlets(_vertices, _faces);
+    updateChunkBounds();
+    if (_meshlets.meshlets.empty()) {
+        return;
+    }
+
+    VertexCacheStats stats = simulateVertexCacheFIFO(_faces, _vertices.size());
+    fprintf(stderr, "Built %lu meshlets (%.1f vertices, %.1f triangles on average), ACMR %.3f\n",
+            _meshlets.meshlets.size(), (float) _meshlets.vertices.size() / _meshlets.meshlets.size(),
+            (float) _faces.size() / _meshlets.meshlets.size(), stats.acmr);
+
+    uploadFaces();
+}
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+
+// post-transform cache size most desktop GPUs behave like
+#define VERTEX_CACHE_SIZE 16
+
+// pre-transform vertex fetch cache, sized after the small texture/L1 caches on low-end parts
+#define FETCH_CACHE_LINE 64
+#define FETCH_CACHE_LINES 64
+
+// Result of running an index buffer through a simulated post-transform vertex cache.
+// ACMR is misses per triangle (0.5 is the ideal for a regular grid, 3.0 is the worst case),
+// ATVR is misses per referenced vertex (1.0 means every vertex is transformed exactly once).
+struct VertexCacheStats {
+    size_t triangles = 0;
+    size_t vertices = 0;
+    size_t misses = 0;
+    float acmr = 0.0f;
+    float atvr = 0.0f;
+};
+
+void finishCacheStats(VertexCacheStats &stats, const std::vector<bool> &referenced) {
+    stats.vertices = std::count(referenced.begin(), referenced.end(), true);
+    stats.acmr = stats.triangles ? (float) stats.misses / stats.triangles : 0.0f;
+    stats.atvr = stats.vertices ? (float) stats.misses / stats.vertices : 0.0f;
+}
+
+// FIFO cache: a hit does not refresh the entry, which is how most fixed-function post-transform caches work.
+VertexCacheStats simulateVertexCacheFIFO(const std::vector<glm::ivec3> &faces, size_t vertexCount, int cacheSize = VERTEX_CACHE_SIZE) {
+    VertexCacheStats stats;
+    std::vector<bool> referenced(vertexCount, false);
+    // a vertex is in the cache if fewer than cacheSize misses happened since it was inserted
+    std::vector<size_t> insertedAt(vertexCount, 0);
+
+    for (size_t i = 0; i < faces.size(); i++) {
+        for (int j = 0; j < 3; j++) {
+            int v = faces[i][j];
+            referenced[v] = true;
+            if (insertedAt[v] == 0 || stats.misses - insertedAt[v] >= (size_t) cacheSize) {
+                stats.misses++;
+                insertedAt[v] = stats.misses;
+            }
+        }
+    }
+    stats.triangles = faces.size();
+    finishCacheStats(stats, referenced);
+    return stats;
+}
+
+// LRU cache: every hit moves the vertex back to the front.
+VertexCacheStats simulateVertexCacheLRU(const std::vector<glm::ivec3> &faces, size_t vertexCount, int cacheSize = VERTEX_CACHE_SIZE) {
+    VertexCacheStats stats;
+    std::vector<bool> referenced(vertexCount, false);
+    std::vector<int> cache;
+    cache.reserve(cacheSize + 1);
+
+    for (size_t i = 0; i < faces.size(); i++) {
+        for (int j = 0; j < 3; j++) {
+            int v = faces[i][j];
+            referenced[v] = true;
+            auto it = std::find(cache.begin(), cache.end(), v);
+            if (it == cache.end()) {
+                stats.misses++;
+                cache.insert(cache.begin(), v);
+                if (cache.size() > (size_t) cacheSize) {
+                    cache.pop_back();
+                }
+            } else {
+                std::rotate(cache.begin(), it, it + 1);
+            }
+        }
+    }
+    stats.triangles = faces.size();
+    finishCacheStats(stats, referenced);
+    return stats;
+}
+
+// Tipsify (Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw", 2007).
+// Fans triangles around one vertex at a time and picks the next fanning vertex among the ones that are still
+// in the cache, so it runs in linear time and does not need to know the exact cache replacement policy.
+int tipsifySkipDeadEnd(const std::vector<int> &liveTriangles, std::vector<int> &deadEnd, int &cursor) {
+    // first try the most recently emitted vertices that still have triangles left
+    while (!deadEnd.empty()) {
+        int d = deadEnd.back();
+        deadEnd.pop_back();
+        if (liveTriangles[d] > 0) {
+            return d;
+        }
+    }
+    // otherwise continue in input order
+    while (cursor < (int) liveTriangles.size()) {
+        if (liveTriangles[cursor] > 0) {
+            return cursor;
+        }
+        cursor++;
+    }
+    return -1;
+}
+
+void optimizeVertexCacheTipsify(std::vector<glm::ivec3> &faces, size_t vertexCount, int cacheSize = VERTEX_CACHE_SIZE) {
+    if (faces.empty()) {
+        return;
+    }
+
+    // vertex to triangle adjacency in CSR layout
+    std::vector<int> liveTriangles(vertexCount, 0);
+    for (size_t i = 0; i < faces.size(); i++) {
+        liveTriangles[faces[i][0]]++;
+        liveTriangles[faces[i][1]]++;
+        liveTriangles[faces[i][2]]++;
+    }
+    std::vector<int> offsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++) {
+        offsets[v + 1] = offsets[v] + liveTriangles[v];
+    }
+    std::vector<int> adjacency(offsets[vertexCount]);
+    std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < faces.size(); i++) {
+        for (int j = 0; j < 3; j++) {
+            adjacency[fill[faces[i][j]]++] = (int) i;
+        }
+    }
+
+    std::vector<glm::ivec3> output;
+    output.reserve(faces.size());
+    std::vector<bool> emitted(faces.size(), false);
+    std::vector<int> cacheTime(vertexCount, 0);
+    std::vector<int> deadEnd;
+    std::vector<int> candidates;
+
+    int fanning = faces[0][0];
+    int time = cacheSize + 1;
+    int cursor = 0;
+
+    while (fanning >= 0) {
+        candidates.clear();
+
+        // emit every remaining triangle around the fanning vertex
+        for (int k = offsets[fanning]; k < offsets[fanning + 1]; k++) {
+            int t = adjacency[k];
+            if (emitted[t]) {
+                continue;
+            }
+            glm::ivec3 face = faces[t];
+            output.push_back(face);
+            emitted[t] = true;
+            for (int j = 0; j < 3; j++) {
+                int v = face[j];
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                liveTriangles[v]--;
+                if (time - cacheTime[v] > cacheSize) {
+                    cacheTime[v] = time;
+                    time++;
+                }
+            }
+        }
+
+        // pick the candidate that will still be in the cache once all its triangles are emitted, preferring the oldest
+        int next = -1;
+        int bestPriority = -1;
+        for (int v : candidates) {
+            if (liveTriangles[v] <= 0) {
+                continue;
+            }
+            int priority = 0;
+            if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize) {
+                priority = time - cacheTime[v];
+            }
+            if (priority > bestPriority) {
+                bestPriority = priority;
+                next = v;
+            }
+        }
+        if (next == -1) {
+            next = tipsifySkipDeadEnd(liveTriangles, deadEnd, cursor);
+        }
+        fanning = next;
+    }
+
+    faces.swap(output);
+}
+
+// Result of running an index buffer through a simulated vertex fetch cache.
+// Overfetch is bytes pulled from memory over bytes of referenced vertex data (1.0 is ideal).
+struct VertexFetchStats {
+    size_t bytesFetched = 0;
+    size_t bytesReferenced = 0;
+    float overfetch = 0.0f;
+};
+
+// FIFO cache of cacheLines lines (FETCH_CACHE_LINES by default) over a vertex buffer with vertexSize bytes per
+// vertex. Vertices straddling a line boundary touch both lines.
+VertexFetchStats simulateVertexFetch(const std::vector<glm::ivec3> &faces, size_t vertexCount, size_t vertexSize,
+                                     size_t cacheLines = FETCH_CACHE_LINES) {
+    VertexFetchStats stats;
+    size_t lineCount = (vertexCount * vertexSize + FETCH_CACHE_LINE - 1) / FETCH_CACHE_LINE;
+    std::vector<size_t> insertedAt(lineCount, 0);
+    std::vector<bool> referenced(vertexCount, false);
+    size_t misses = 0;
+
+    for (size_t i = 0; i < faces.size(); i++) {
+        for (int j = 0; j < 3; j++) {
+            int v = faces[i][j];
+            referenced[v] = true;
+            size_t first = v * vertexSize / FETCH_CACHE_LINE;
+            size_t last = ((v + 1) * vertexSize - 1) / FETCH_CACHE_LINE;
+            for (size_t line = first; line <= last; line++) {
+                if (insertedAt[line] == 0 || misses - insertedAt[line] >= cacheLines) {
+                    misses++;
+                    insertedAt[line] = misses;
+                }
+            }
+        }
+    }
+    stats.bytesFetched = misses * FETCH_CACHE_LINE;
+    stats.bytesReferenced = std::count(referenced.begin(), referenced.end(), true) * vertexSize;
+    stats.overfetch = stats.bytesReferenced ? (float) stats.bytesFetched / stats.bytesReferenced : 0.0f;
+    return stats;
+}
+
+// Renumber vertices in the order the index buffer first uses them, so fetches walk the vertex buffer
+// mostly linearly. Returns the old-to-new remap table; unreferenced vertices map to -1 and get dropped.
+// Run this after the triangle order is final.
+std::vector<int> optimizeVertexFetchRemap(std::vector<glm::ivec3> &faces, size_t vertexCount, size_t &newVertexCount) {
+    std::vector<int> remap(vertexCount, -1);
+    int next = 0;
+    for (size_t i = 0; i < faces.size(); i++) {
+        for (int j = 0; j < 3; j++) {
+            int &v = faces[i][j];
+            if (remap[v] == -1) {
+                remap[v] = next++;
+            }
+            v = remap[v];
+        }
+    }
+    newVertexCount = next;
+    return remap;
+}
+
+template <typename T>
+void remapVertexStream(std::vector<T> &stream, const std::vector<int> &remap, size_t newVertexCount) {
+    std::vector<T> result(newVertexCount);
+    for (size_t v = 0; v < remap.size() && v < stream.size(); v++) {
+        if (remap[v] >= 0) {
+            result[remap[v]] = stream[v];
+        }
+    }
+    stream.swap(result);
+}
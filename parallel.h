@@ -0,0 +1,141 @@
+#pragma once
+
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+unsigned int workerCount() {
+    unsigned int n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+// Threads started once and parked between jobs, so parallelFor() in per-frame paths (culling, LOD selection,
+// the software rasterizer) pays a wake-up rather than a thread start per call. One caller owns the pool at a
+// time; a call made while it is busy, from another thread or from inside a job, gets no helpers.
+class WorkerPool {
+public:
+    static WorkerPool &get() {
+        static WorkerPool pool(workerCount() - 1);
+        return pool;
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _wake.notify_all();
+        for (std::thread &t : _threads) {
+            t.join();
+        }
+    }
+
+    // runs job on the calling thread and on up to helpers workers, returning once every copy has returned.
+    // False, without running anything, when another caller has the pool.
+    bool run(unsigned int helpers, const std::function<void()> &job) {
+        if (_busy.exchange(true, std::memory_order_acquire)) {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _job = &job;
+            _wanted = std::min<size_t>(helpers, _threads.size());
+            _generation++;
+        }
+        _wake.notify_all();
+        job();
+
+        // helpers that have not picked the job up yet would find no work left in it
+        std::unique_lock<std::mutex> lock(_mutex);
+        _wanted = 0;
+        _done.wait(lock, [&]() { return _running == 0; });
+        _job = nullptr;
+        _busy.store(false, std::memory_order_release);
+        return true;
+    }
+
+private:
+    WorkerPool(unsigned int threads) {
+        for (unsigned int t = 0; t < threads; t++) {
+            _threads.emplace_back(&WorkerPool::work, this);
+        }
+    }
+
+    void work() {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true) {
+            _wake.wait(lock, [&]() { return _stop || _generation != seen; });
+            if (_stop) {
+                return;
+            }
+            seen = _generation;
+            if (_wanted == 0) {
+                continue;
+            }
+            _wanted--;
+            _running++;
+            const std::function<void()> *job = _job;
+            lock.unlock();
+            (*job)();
+            lock.lock();
+            if (--_running == 0) {
+                _done.notify_one();
+            }
+        }
+    }
+
+    std::vector<std::thread> _threads;
+    // set by the caller whose job is running, a flag rather than a mutex so a nested call fails instead of
+    // relocking it
+    std::atomic<bool> _busy{false};
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    const std::function<void()> *_job = nullptr;
+    uint64_t _generation = 0;
+    size_t _wanted = 0;
+    size_t _running = 0;
+    bool _stop = false;
+};
+
+// Runs fn(i) for every i in [0, count) across all cores. Work is handed out in chunks of grain items from a
+// shared counter, so uneven items balance out. fn must only write state owned by item i.
+template <typename Fn>
+void parallelFor(size_t count, size_t grain, Fn fn) {
+    if (count == 0) {
+        return;
+    }
+    grain = std::max<size_t>(grain, 1);
+    unsigned int threads = std::min<size_t>(workerCount(), (count + grain - 1) / grain);
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; i++) {
+            fn(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    std::function<void()> worker = [&]() {
+        while (true) {
+            size_t begin = next.fetch_add(grain);
+            if (begin >= count) {
+                break;
+            }
+            size_t end = std::min(begin + grain, count);
+            for (size_t i = begin; i < end; i++) {
+                fn(i);
+            }
+        }
+    };
+
+    // the pool is busy with another caller: this one does all the work itself
+    if (!WorkerPool::get().run(threads - 1, worker)) {
+        worker();
+    }
+}
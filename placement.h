@@ -0,0 +1,152 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstddef>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// A quadric Q splits into A (upper-left 3x3), b (Q[3].xyz) and c (Q[3][3]), so that
+// v^T Q v = x^T A x + 2 b.x + c for v = (x, 1). Its minimum is where A x = -b.
+
+// det(A) against (trace(A) / 3)^3, the largest determinant a positive semi-definite A with that trace can
+// have. Below this A is close to singular (flat or cylindrical neighbourhoods) and the solve is not trusted.
+#define PLACEMENT_MIN_CONDITION 1e-5f
+
+float quadricErrorAt(const glm::mat4 &q, glm::vec3 x) {
+    float a00 = q[0][0], a01 = q[1][0], a02 = q[2][0], a11 = q[1][1], a12 = q[2][1], a22 = q[2][2];
+    glm::vec3 ax(a00 * x.x + a01 * x.y + a02 * x.z,
+                 a01 * x.x + a11 * x.y + a12 * x.z,
+                 a02 * x.x + a12 * x.y + a22 * x.z);
+    return glm::dot(x, ax) + 2.0f * (q[3][0] * x.x + q[3][1] * x.y + q[3][2] * x.z) + q[3][3];
+}
+
+// Garland-Heckbert optimal placement for collapsing the edge (p1, p2) with the summed quadric q: the minimum
+// of q when A is well conditioned, otherwise the best of the two endpoints and the midpoint. Returns the
+// error at the chosen position.
+float optimalPlacement(const glm::mat4 &q, glm::vec3 p1, glm::vec3 p2, glm::vec3 &position) {
+    float a00 = q[0][0], a01 = q[1][0], a02 = q[2][0], a11 = q[1][1], a12 = q[2][1], a22 = q[2][2];
+    float c00 = a11 * a22 - a12 * a12;
+    float c01 = a02 * a12 - a01 * a22;
+    float c02 = a01 * a12 - a02 * a11;
+    float c11 = a00 * a22 - a02 * a02;
+    float c12 = a01 * a02 - a00 * a12;
+    float c22 = a00 * a11 - a01 * a01;
+    float det = a00 * c00 + a01 * c01 + a02 * c02;
+    float trace = (a00 + a11 + a22) / 3.0f;
+
+    if (trace > 0.0f && det > PLACEMENT_MIN_CONDITION * trace * trace * trace) {
+        glm::vec3 b(q[3][0], q[3][1], q[3][2]);
+        float negInvDet = -1.0f / det;
+        position = glm::vec3(c00 * b.x + c01 * b.y + c02 * b.z,
+                             c01 * b.x + c11 * b.y + c12 * b.z,
+                             c02 * b.x + c12 * b.y + c22 * b.z) * negInvDet;
+        return quadricErrorAt(q, position);
+    }
+
+    glm::vec3 midpoint = (p1 + p2) * 0.5f;
+    float e1 = quadricErrorAt(q, p1);
+    float e2 = quadricErrorAt(q, p2);
+    float em = quadricErrorAt(q, midpoint);
+    if (em <= e1 && em <= e2) {
+        position = midpoint;
+        return em;
+    }
+    position = e1 <= e2 ? p1 : p2;
+    return e1 <= e2 ? e1 : e2;
+}
+
+#if defined(__SSE2__)
+static inline __m128 placementSelect(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+struct PlacementLanes {
+    __m128 x, y, z;
+};
+
+// x^T A x + 2 b.x + c for four points at once
+static inline __m128 placementError(const __m128* a, const __m128* b, __m128 c, PlacementLanes p) {
+    __m128 ax = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], p.x), _mm_mul_ps(a[1], p.y)), _mm_mul_ps(a[2], p.z));
+    __m128 ay = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[1], p.x), _mm_mul_ps(a[3], p.y)), _mm_mul_ps(a[4], p.z));
+    __m128 az = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[2], p.x), _mm_mul_ps(a[4], p.y)), _mm_mul_ps(a[5], p.z));
+    __m128 xax = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p.x, ax), _mm_mul_ps(p.y, ay)), _mm_mul_ps(p.z, az));
+    __m128 bx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(b[0], p.x), _mm_mul_ps(b[1], p.y)), _mm_mul_ps(b[2], p.z));
+    return _mm_add_ps(_mm_add_ps(xax, _mm_add_ps(bx, bx)), c);
+}
+#endif
+
+// optimalPlacement() for count edges. With SSE2 four edges are solved per iteration, each lane picking the
+// solve or its fallback with masks, so badly conditioned edges cost no branch.
+void optimalPlacements(const glm::mat4* quadrics, const glm::vec3* p1, const glm::vec3* p2, size_t count,
+                       glm::vec3* positions, float* errors) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 4 <= count; i += 4) {
+        const glm::mat4 &q0 = quadrics[i], &q1 = quadrics[i + 1], &q2 = quadrics[i + 2], &q3 = quadrics[i + 3];
+        #define PLACEMENT_GATHER(c, r) _mm_setr_ps(q0[c][r], q1[c][r], q2[c][r], q3[c][r])
+        __m128 a[6] = {PLACEMENT_GATHER(0, 0), PLACEMENT_GATHER(1, 0), PLACEMENT_GATHER(2, 0),
+                       PLACEMENT_GATHER(1, 1), PLACEMENT_GATHER(2, 1), PLACEMENT_GATHER(2, 2)};
+        __m128 b[3] = {PLACEMENT_GATHER(3, 0), PLACEMENT_GATHER(3, 1), PLACEMENT_GATHER(3, 2)};
+        __m128 c = PLACEMENT_GATHER(3, 3);
+        #undef PLACEMENT_GATHER
+        PlacementLanes e1 = {_mm_setr_ps(p1[i].x, p1[i + 1].x, p1[i + 2].x, p1[i + 3].x),
+                             _mm_setr_ps(p1[i].y, p1[i + 1].y, p1[i + 2].y, p1[i + 3].y),
+                             _mm_setr_ps(p1[i].z, p1[i + 1].z, p1[i + 2].z, p1[i + 3].z)};
+        PlacementLanes e2 = {_mm_setr_ps(p2[i].x, p2[i + 1].x, p2[i + 2].x, p2[i + 3].x),
+                             _mm_setr_ps(p2[i].y, p2[i + 1].y, p2[i + 2].y, p2[i + 3].y),
+                             _mm_setr_ps(p2[i].z, p2[i + 1].z, p2[i + 2].z, p2[i + 3].z)};
+
+        // a[] = a00 a01 a02 a11 a12 a22
+        __m128 c00 = _mm_sub_ps(_mm_mul_ps(a[3], a[5]), _mm_mul_ps(a[4], a[4]));
+        __m128 c01 = _mm_sub_ps(_mm_mul_ps(a[2], a[4]), _mm_mul_ps(a[1], a[5]));
+        __m128 c02 = _mm_sub_ps(_mm_mul_ps(a[1], a[4]), _mm_mul_ps(a[2], a[3]));
+        __m128 c11 = _mm_sub_ps(_mm_mul_ps(a[0], a[5]), _mm_mul_ps(a[2], a[2]));
+        __m128 c12 = _mm_sub_ps(_mm_mul_ps(a[1], a[2]), _mm_mul_ps(a[0], a[4]));
+        __m128 c22 = _mm_sub_ps(_mm_mul_ps(a[0], a[3]), _mm_mul_ps(a[1], a[1]));
+        __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], c00), _mm_mul_ps(a[1], c01)), _mm_mul_ps(a[2], c02));
+        __m128 trace = _mm_div_ps(_mm_add_ps(_mm_add_ps(a[0], a[3]), a[5]), _mm_set1_ps(3.0f));
+        __m128 limit = _mm_mul_ps(_mm_set1_ps(PLACEMENT_MIN_CONDITION), _mm_mul_ps(_mm_mul_ps(trace, trace), trace));
+        __m128 solvable = _mm_and_ps(_mm_cmpgt_ps(trace, _mm_setzero_ps()), _mm_cmpgt_ps(det, limit));
+
+        // x = -adj(A) b / det, garbage in the lanes that are not solvable
+        __m128 negInvDet = _mm_div_ps(_mm_set1_ps(-1.0f), det);
+        PlacementLanes best = {
+            _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c00, b[0]), _mm_mul_ps(c01, b[1])), _mm_mul_ps(c02, b[2])), negInvDet),
+            _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c01, b[0]), _mm_mul_ps(c11, b[1])), _mm_mul_ps(c12, b[2])), negInvDet),
+            _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c02, b[0]), _mm_mul_ps(c12, b[1])), _mm_mul_ps(c22, b[2])), negInvDet)};
+        __m128 bestError = placementError(a, b, c, best);
+
+        // fallback: midpoint unless an endpoint is strictly better, then the better endpoint
+        __m128 half = _mm_set1_ps(0.5f);
+        PlacementLanes mid = {_mm_mul_ps(_mm_add_ps(e1.x, e2.x), half), _mm_mul_ps(_mm_add_ps(e1.y, e2.y), half),
+                              _mm_mul_ps(_mm_add_ps(e1.z, e2.z), half)};
+        __m128 error1 = placementError(a, b, c, e1);
+        __m128 error2 = placementError(a, b, c, e2);
+        __m128 errorMid = placementError(a, b, c, mid);
+        __m128 pickFirst = _mm_cmple_ps(error1, error2);
+        PlacementLanes end = {placementSelect(pickFirst, e1.x, e2.x), placementSelect(pickFirst, e1.y, e2.y),
+                              placementSelect(pickFirst, e1.z, e2.z)};
+        __m128 endError = placementSelect(pickFirst, error1, error2);
+        __m128 pickMid = _mm_cmple_ps(errorMid, endError);
+        PlacementLanes fallback = {placementSelect(pickMid, mid.x, end.x), placementSelect(pickMid, mid.y, end.y),
+                                   placementSelect(pickMid, mid.z, end.z)};
+        __m128 fallbackError = placementSelect(pickMid, errorMid, endError);
+
+        float x[4], y[4], z[4];
+        _mm_storeu_ps(x, placementSelect(solvable, best.x, fallback.x));
+        _mm_storeu_ps(y, placementSelect(solvable, best.y, fallback.y));
+        _mm_storeu_ps(z, placementSelect(solvable, best.z, fallback.z));
+        _mm_storeu_ps(errors + i, placementSelect(solvable, bestError, fallbackError));
+        for (int k = 0; k < 4; k++) {
+            positions[i + k] = glm::vec3(x[k], y[k], z[k]);
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        errors[i] = optimalPlacement(quadrics[i], p1[i], p2[i], positions[i]);
+    }
+}
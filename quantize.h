@@ -0,0 +1,107 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+// Compact vertex format for the quantized output, 12 bytes instead of the 24 of two float vec3 streams.
+// Positions are unorm16 relative to the mesh AABB (the 4th component keeps the normal 4-byte aligned),
+// normals are octahedral encoded into two snorm16 components. Decoding lives in shaders/basic.vert.
+struct QuantizedVertex {
+    uint16_t position[4];
+    int16_t normal[2];
+};
+
+uint16_t quantizeUnorm16(float v) {
+    v = glm::clamp(v, 0.0f, 1.0f);
+    return (uint16_t) (v * 65535.0f + 0.5f);
+}
+
+int16_t quantizeSnorm16(float v) {
+    v = glm::clamp(v, -1.0f, 1.0f);
+    return (int16_t) std::round(v * 32767.0f);
+}
+
+// octahedral normal encoding from Cigolle et al., "A Survey of Efficient Representations for Independent Unit Vectors", 2014
+// A zero normal (degenerate faces, or one normalized from nothing into NaN) encodes as +Z.
+glm::vec2 octEncode(glm::vec3 n) {
+    float l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+    if (!(l1 > 0.0f)) {
+        return glm::vec2(0.0f);
+    }
+    n /= l1;
+    glm::vec2 e(n.x, n.y);
+    if (n.z < 0.0f) {
+        e.x = (1.0f - std::fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+        e.y = (1.0f - std::fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return e;
+}
+
+glm::vec3 octDecode(glm::vec2 e) {
+    glm::vec3 n(e.x, e.y, 1.0f - std::fabs(e.x) - std::fabs(e.y));
+    float t = std::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return glm::normalize(n);
+}
+
+void computeBounds(const std::vector<glm::vec3> &vertices, glm::vec3 &aabbMin, glm::vec3 &aabbMax) {
+    aabbMin = glm::vec3(0.0f);
+    aabbMax = glm::vec3(0.0f);
+    if (vertices.empty()) {
+        return;
+    }
+    aabbMin = aabbMax = vertices[0];
+    for (size_t i = 1; i < vertices.size(); i++) {
+        aabbMin = glm::min(aabbMin, vertices[i]);
+        aabbMax = glm::max(aabbMax, vertices[i]);
+    }
+}
+
+// positions outside the box the offset and scale describe are clamped to it
+QuantizedVertex quantizeVertex(glm::vec3 position, glm::vec3 normal, glm::vec3 offset, glm::vec3 scale) {
+    QuantizedVertex result;
+    glm::vec3 p = (position - offset) / scale;
+    result.position[0] = quantizeUnorm16(p.x);
+    result.position[1] = quantizeUnorm16(p.y);
+    result.position[2] = quantizeUnorm16(p.z);
+    result.position[3] = 0;
+
+    glm::vec2 e = octEncode(normal);
+    result.normal[0] = quantizeSnorm16(e.x);
+    result.normal[1] = quantizeSnorm16(e.y);
+    return result;
+}
+
+// positions decode as offset + scale * unorm, so a degenerate (flat) axis gets a scale of 1 instead of 0
+std::vector<QuantizedVertex> quantizeVertices(const std::vector<glm::vec3> &vertices, const std::vector<glm::vec3> &normals,
+                                              glm::vec3 &offset, glm::vec3 &scale) {
+    glm::vec3 aabbMax;
+    computeBounds(vertices, offset, aabbMax);
+    scale = aabbMax - offset;
+    for (int k = 0; k < 3; k++) {
+        if (scale[k] <= 0.0f) {
+            scale[k] = 1.0f;
+        }
+    }
+
+    std::vector<QuantizedVertex> result(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++) {
+        result[i] = quantizeVertex(vertices[i], normals[i], offset, scale);
+    }
+    return result;
+}
+
+std::vector<uint16_t> packIndices16(const std::vector<glm::ivec3> &faces) {
+    std::vector<uint16_t> result(faces.size() * 3);
+    for (size_t i = 0; i < faces.size(); i++) {
+        result[3 * i + 0] = (uint16_t) faces[i].x;
+        result[3 * i + 1] = (uint16_t) faces[i].y;
+        result[3 * i + 2] = (uint16_t) faces[i].z;
+    }
+    return result;
+}
@@ -0,0 +1,223 @@
+#pragma once
+
+#include "headless.h"
+#include "shader.h"
+#include "camera.h"
+#include "model.h"
+#include "simplify.h"
+#include "uniforms.h"
+#include "scene.h"
+
+#include <chrono>
+#include <vector>
+
+// Render-side benchmark: draws every LOD of a model N times into an offscreen framebuffer and reports the
+// CPU time spent submitting the draw and the GPU time from GL_TIME_ELAPSED queries (or a glFinish-bounded wall
+// clock where the driver's queries report nothing), i.e. a triangles vs frame time curve. Runs on a surfaceless
+// EGL context, so it works on machines without a GPU or a display.
+
+#define BENCH_RENDER_WIDTH 1200
+#define BENCH_RENDER_HEIGHT 800
+// GL_TIME_ELAPSED at or below this per frame is taken as a driver that does not time draws (llvmpipe reports
+// 0 for small meshes), and the frame is timed on the wall clock instead
+#define BENCH_RENDER_MIN_GPU_MS 0.001
+
+struct RenderTiming {
+    double cpuMs = 0.0;
+    double gpuMs = 0.0;
+    // gpuMs came from timeFinishedFrames() rather than the queries
+    bool wallClock = false;
+};
+
+// Wall clock per frame with the GPU drained before and after, the fallback for drivers whose timer queries
+// report nothing. Slower than the queries, which let frames overlap.
+template <typename Draw>
+double timeFinishedFrames(int frames, Draw draw) {
+    double ms = 0.0;
+    for (int i = 0; i < frames; i++) {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glFinish();
+        auto start = std::chrono::steady_clock::now();
+        draw();
+        glFinish();
+        ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    return ms / frames;
+}
+
+// triangles per second over a frame time, or n/a when even the fallback is below the clock resolution
+void formatThroughput(char* out, size_t size, size_t triangles, double frameMs) {
+    if (frameMs > BENCH_RENDER_MIN_GPU_MS) {
+        snprintf(out, size, "%.2f", triangles / (frameMs * 1000.0));
+    }
+    else {
+        snprintf(out, size, "n/a");
+    }
+}
+
+RenderTiming timeDraws(Model &model, Shader &shader, FrameUniforms &uniforms, Camera &camera, int frames) {
+    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float) BENCH_RENDER_WIDTH / (float) BENCH_RENDER_HEIGHT, 0.1f, 100.0f);
+    uniforms.update(makeFrameConstants(glm::mat4(1), camera.GetViewMatrix(), projection, glm::vec3(1.0f, 2.0f, 1.0f), camera.Position));
+
+    shader.use();
+    shader.setVec3("positionOffset", model.getPositionOffset());
+    shader.setVec3("positionScale", model.getPositionScale());
+    shader.setBool("octNormals", model.isQuantized());
+
+    std::vector<GLuint> queries(frames);
+    glGenQueries(frames, queries.data());
+
+    RenderTiming timing;
+    for (int i = 0; i < frames; i++) {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glBeginQuery(GL_TIME_ELAPSED, queries[i]);
+        auto start = std::chrono::steady_clock::now();
+        model.draw();
+        timing.cpuMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        glEndQuery(GL_TIME_ELAPSED);
+    }
+
+    // results are only read back at the end so the queries do not serialize the frames
+    for (int i = 0; i < frames; i++) {
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &ns);
+        timing.gpuMs += ns / 1e6;
+    }
+    glDeleteQueries(frames, queries.data());
+
+    timing.cpuMs /= frames;
+    timing.gpuMs /= frames;
+    if (timing.gpuMs <= BENCH_RENDER_MIN_GPU_MS) {
+        timing.gpuMs = timeFinishedFrames(frames, [&]() { model.draw(); });
+        timing.wallClock = true;
+    }
+    return timing;
+}
+
+int runRenderBenchmark(const char* path, int frames, bool quantized) {
+    HeadlessContext ctx;
+    if (!createHeadlessContext(ctx, BENCH_RENDER_WIDTH, BENCH_RENDER_HEIGHT)) {
+        destroyHeadlessContext(ctx);
+        return 1;
+    }
+    glEnable(GL_DEPTH_TEST);
+    glClearColor(0.82, 0.93, 0.99, 1.0f);
+
+    Shader shader("shaders/basic.vert", "shaders/basic.frag");
+    FrameUniforms uniforms;
+    Camera camera(glm::vec3(-2, 4, 8), glm::vec3(0, 1, 0), -77.0f, -16.0f);
+    Model original(path);
+
+    const std::vector<glm::vec3> &vertices = original.getVertices();
+    std::vector<bool> locked(vertices.size(), false);
+
+    printf("render benchmark: %d frames per LOD at %dx%d%s\n", frames, BENCH_RENDER_WIDTH, BENCH_RENDER_HEIGHT, quantized ? ", quantized" : "");
+    printf("  %10s %12s %14s %14s %12s\n", "ratio", "triangles", "cpu us/frame", "gpu ms/frame", "Mtris/s");
+    bool wallClock = false;
+    for (float ratio : {1.0f, 0.5f, 0.25f, 0.125f, 0.0625f}) {
+        std::vector<glm::ivec3> faces = original.getFaces();
+        if (ratio < 1.0f) {
+            simplifyQEM(vertices, faces, locked, (size_t) (faces.size() * ratio));
+        }
+
+        Model lod(vertices, original.getNormals(), faces);
+        lod.optimizeVertexCache();
+        lod.setupBuffers(quantized);
+
+        // warm up shader compilation and buffer residency before measuring
+        timeDraws(lod, shader, uniforms, camera, 5);
+        RenderTiming timing = timeDraws(lod, shader, uniforms, camera, frames);
+        char throughput[32];
+        formatThroughput(throughput, sizeof(throughput), faces.size(), timing.gpuMs);
+        printf("  %10.4f %12lu %14.2f %13.3f%s %12s\n", ratio, faces.size(), timing.cpuMs * 1000.0, timing.gpuMs,
+               timing.wallClock ? "*" : " ", throughput);
+        wallClock = wallClock || timing.wallClock;
+
+        lod.deleteGLResources();
+    }
+    if (wallClock) {
+        printf("  * timer queries reported nothing, wall clock between glFinish calls\n");
+    }
+
+    uniforms.deleteGLResources();
+    destroyHeadlessContext(ctx);
+    return 0;
+}
+
+// Scene benchmark: a grid of instances of one model seen from above one edge, so instances cover the whole
+// range of distances. Each frame runs the LOD selection and one indirect multi-draw; reports the average
+// selection time, draw calls and triangles submitted, and the GPU time of the draw.
+int runSceneBenchmark(const char* path, size_t instances, int frames) {
+    HeadlessContext ctx;
+    if (!createHeadlessContext(ctx, BENCH_RENDER_WIDTH, BENCH_RENDER_HEIGHT)) {
+        destroyHeadlessContext(ctx);
+        return 1;
+    }
+    glEnable(GL_DEPTH_TEST);
+    glClearColor(0.82, 0.93, 0.99, 1.0f);
+
+    Shader shader("shaders/instanced.vert", "shaders/basic.frag");
+    FrameUniforms uniforms;
+    Model model(path);
+    InstancedScene scene(model);
+    scene.addGrid(instances);
+    scene.setupBuffers();
+
+    float extent = scene.getExtent();
+    Camera camera(glm::vec3(0.0f, 0.05f * extent, 0.5f * extent), glm::vec3(0, 1, 0), -90.0f, -10.0f);
+    glm::mat4 view = camera.GetViewMatrix();
+    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float) BENCH_RENDER_WIDTH / (float) BENCH_RENDER_HEIGHT, 0.1f, 2.0f * extent);
+    float projectionScale = BENCH_RENDER_HEIGHT / (2.0f * std::tan(glm::radians(camera.Zoom) / 2.0f));
+    uniforms.update(makeFrameConstants(glm::mat4(1), view, projection, glm::vec3(1.0f, 2.0f, 1.0f), camera.Position));
+    shader.use();
+
+    std::vector<GLuint> queries(frames);
+    glGenQueries(frames, queries.data());
+    double selectMs = 0.0;
+    double cpuMs = 0.0;
+    for (int i = 0; i < frames; i++) {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        scene.update(projection * view, camera.Position, projectionScale, 1.0f);
+        selectMs += scene.getStats().selectMs;
+        glBeginQuery(GL_TIME_ELAPSED, queries[i]);
+        auto start = std::chrono::steady_clock::now();
+        scene.draw();
+        cpuMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        glEndQuery(GL_TIME_ELAPSED);
+    }
+    double gpuMs = 0.0;
+    for (int i = 0; i < frames; i++) {
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &ns);
+        gpuMs += ns / 1e6;
+    }
+    glDeleteQueries(frames, queries.data());
+    selectMs /= frames;
+    cpuMs /= frames;
+    gpuMs /= frames;
+    bool wallClock = gpuMs <= BENCH_RENDER_MIN_GPU_MS;
+    if (wallClock) {
+        gpuMs = timeFinishedFrames(frames, [&]() { scene.draw(); });
+    }
+
+    const SceneStats &stats = scene.getStats();
+    printf("scene benchmark: %lu instances, %d frames at %dx%d, %u threads\n", scene.getInstanceCount(), frames,
+           BENCH_RENDER_WIDTH, BENCH_RENDER_HEIGHT, workerCount());
+    printf("  visible instances   %lu\n", stats.visibleInstances);
+    for (size_t lod = 0; lod < scene.getLodCount(); lod++) {
+        printf("    lod %lu (%6u tris)  %lu\n", lod, scene.getLod(lod).indexCount / 3, stats.lodInstances[lod]);
+    }
+    printf("  draw calls          %lu (%lu indirect commands)\n", stats.drawCalls, stats.drawCommands);
+    printf("  triangles           %lu (%lu without LOD)\n", stats.triangles, stats.visibleInstances * (scene.getLod(0).indexCount / 3));
+    printf("  lod selection       %.3f ms/frame\n", selectMs);
+    printf("  cpu submission      %.3f ms/frame\n", cpuMs);
+    char throughput[32];
+    formatThroughput(throughput, sizeof(throughput), stats.triangles, gpuMs);
+    printf("  gpu                 %.3f ms/frame%s, %s Mtris/s\n", gpuMs,
+           wallClock ? " (wall clock between glFinish calls, timer queries reported nothing)" : "", throughput);
+
+    scene.deleteGLResources();
+    uniforms.deleteGLResources();
+    destroyHeadlessContext(ctx);
+    return 0;
+}
@@ -0,0 +1,260 @@
+#pragma once
+
+#include "model.h"
+#include "simplify.h"
+#include "clusterlod.h"
+#include "culling.h"
+#include "parallel.h"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#define SCENE_MAX_LODS 8
+#define SCENE_MIN_LOD_FACES 64
+
+// one level of the chain: a range of the shared index buffer and its error bound in model units
+struct SceneLod {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float error;
+};
+
+// layout fixed by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+struct SceneStats {
+    size_t visibleInstances = 0;
+    size_t drawCalls = 0;
+    size_t drawCommands = 0;
+    size_t triangles = 0;
+    size_t lodInstances[SCENE_MAX_LODS] = {0};
+    double selectMs = 0.0;
+};
+
+// Many copies of one model, each with its own translation and uniform scale. A chain of LODs is built once,
+// all indexing the same vertex buffer. Every frame update() culls the instances against the frustum and picks
+// per instance the coarsest LOD whose projected error stays under a pixel threshold, in parallel across
+// instances. Visible instances are then grouped by LOD so draw() submits one indirect command per LOD, all in
+// a single glMultiDrawElementsIndirect.
+class InstancedScene {
+public:
+    InstancedScene(const Model &model) : _vertices(model.getVertices()), _normals(model.getNormals()) {
+        buildLods(model.getFaces());
+    }
+
+    // square grid of count instances on the xz plane, spaced by a few bounding radii
+    void addGrid(size_t count) {
+        size_t side = (size_t) std::ceil(std::sqrt((double) count));
+        float spacing = 3.0f * _radius;
+        for (size_t i = 0; i < count; i++) {
+            float x = (float) (i % side) - 0.5f * side;
+            float z = (float) (i / side) - 0.5f * side;
+            _instances.push_back(glm::vec4(x * spacing, 0.0f, -z * spacing, 1.0f));
+        }
+        _instanceLod.resize(_instances.size());
+        _sorted.resize(_instances.size());
+    }
+
+    void setupBuffers();
+    // viewProjection and eye in world space; projectionScale is viewport height / (2 tan(fovy / 2))
+    void update(const glm::mat4 &viewProjection, glm::vec3 eye, float projectionScale, float thresholdPixels);
+    void draw();
+    void deleteGLResources();
+
+    size_t getInstanceCount() const { return _instances.size(); }
+    size_t getLodCount() const { return _lods.size(); }
+    const SceneLod& getLod(size_t i) const { return _lods[i]; }
+    const SceneStats& getStats() const { return _stats; }
+    // extent of the grid, for picking a far plane
+    float getExtent() const { return 3.0f * _radius * std::ceil(std::sqrt((double) _instances.size())); }
+
+private:
+    std::vector<glm::vec3> _vertices;
+    std::vector<glm::vec3> _normals;
+    std::vector<glm::ivec3> _indices;
+    std::vector<SceneLod> _lods;
+    glm::vec3 _center = glm::vec3(0.0f);
+    float _radius = 0.0f;
+
+    // xyz translation, w uniform scale
+    std::vector<glm::vec4> _instances;
+    // chosen LOD per instance, -1 when culled
+    std::vector<int8_t> _instanceLod;
+    // visible instances grouped by LOD, as uploaded
+    std::vector<glm::vec4> _sorted;
+    std::vector<DrawElementsIndirectCommand> _commands;
+    SceneStats _stats;
+
+    GLuint _vao = 0;
+    GLuint _vertexBuffer = 0;
+    GLuint _normalBuffer = 0;
+    GLuint _indexBuffer = 0;
+    GLuint _instanceBuffer = 0;
+    GLuint _indirectBuffer = 0;
+
+    void buildLods(const std::vector<glm::ivec3> &faces);
+};
+
+void InstancedScene::buildLods(const std::vector<glm::ivec3> &faces) {
+    computeBoundingSphere(_vertices, _center, _radius);
+
+    // each level halves the previous one, stopping once simplification stalls. simplifyQEM only measures the
+    // error against the level it starts from, so errors are accumulated to stay a bound on the original.
+    std::vector<bool> locked(_vertices.size(), false);
+    std::vector<glm::ivec3> level = faces;
+    float error = 0.0f;
+    while (true) {
+        _lods.push_back({(uint32_t) (_indices.size() * 3), (uint32_t) (level.size() * 3), error});
+        _indices.insert(_indices.end(), level.begin(), level.end());
+        if (_lods.size() == SCENE_MAX_LODS || level.size() / 2 < SCENE_MIN_LOD_FACES) {
+            break;
+        }
+        size_t before = level.size();
+        error += simplifyQEM(_vertices, level, locked, before / 2);
+        if (level.size() > before * 9 / 10) {
+            break;
+        }
+    }
+
+    fprintf(stderr, "Scene LODs:");
+    for (const SceneLod &lod : _lods) {
+        fprintf(stderr, " %u (%.4f)", lod.indexCount / 3, lod.error);
+    }
+    fprintf(stderr, "\n");
+}
+
+void InstancedScene::setupBuffers() {
+    glGenVertexArrays(1, &_vao);
+    glBindVertexArray(_vao);
+
+    glGenBuffers(1, &_vertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, _vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, _vertices.size() * sizeof(glm::vec3), _vertices.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, false, sizeof(glm::vec3), (void *) 0);
+    glEnableVertexAttribArray(0);
+
+    glGenBuffers(1, &_normalBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, _normalBuffer);
+    glBufferData(GL_ARRAY_BUFFER, _normals.size() * sizeof(glm::vec3), _normals.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(1, 3, GL_FLOAT, false, sizeof(glm::vec3), (void *) 0);
+    glEnableVertexAttribArray(1);
+
+    // per-instance transform, advanced once per instance
+    glGenBuffers(1, &_instanceBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, _instanceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, _instances.size() * sizeof(glm::vec4), NULL, GL_STREAM_DRAW);
+    glVertexAttribPointer(2, 4, GL_FLOAT, false, sizeof(glm::vec4), (void *) 0);
+    glEnableVertexAttribArray(2);
+    glVertexAttribDivisor(2, 1);
+
+    // every LOD back to back in one index buffer
+    glGenBuffers(1, &_indexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, _indices.size() * sizeof(glm::ivec3), _indices.data(), GL_STATIC_DRAW);
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glGenBuffers(1, &_indirectBuffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _indirectBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, SCENE_MAX_LODS * sizeof(DrawElementsIndirectCommand), NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void InstancedScene::update(const glm::mat4 &viewProjection, glm::vec3 eye, float projectionScale, float thresholdPixels) {
+    auto start = std::chrono::steady_clock::now();
+    Frustum frustum = extractFrustum(viewProjection);
+    int lodCount = (int) _lods.size();
+
+    // the selection only writes the slot of its own instance
+    parallelFor(_instances.size(), 1024, [&](size_t i) {
+        glm::vec4 instance = _instances[i];
+        glm::vec3 center = glm::vec3(instance) + instance.w * _center;
+        float radius = instance.w * _radius;
+        if (sphereOutsideFrustum(frustum, center, radius)) {
+            _instanceLod[i] = -1;
+            return;
+        }
+        int lod = 0;
+        while (lod + 1 < lodCount &&
+               projectedError(center, radius, instance.w * _lods[lod + 1].error, eye, projectionScale) <= thresholdPixels) {
+            lod++;
+        }
+        _instanceLod[i] = (int8_t) lod;
+    });
+
+    // counting sort by LOD, the order of instances within a LOD does not matter
+    size_t counts[SCENE_MAX_LODS] = {0};
+    for (int8_t lod : _instanceLod) {
+        if (lod >= 0) {
+            counts[lod]++;
+        }
+    }
+    size_t offsets[SCENE_MAX_LODS];
+    size_t visible = 0;
+    for (int lod = 0; lod < lodCount; lod++) {
+        offsets[lod] = visible;
+        visible += counts[lod];
+    }
+    for (size_t i = 0; i < _instances.size(); i++) {
+        if (_instanceLod[i] >= 0) {
+            _sorted[offsets[_instanceLod[i]]++] = _instances[i];
+        }
+    }
+
+    _commands.clear();
+    _stats = SceneStats();
+    size_t base = 0;
+    for (int lod = 0; lod < lodCount; lod++) {
+        _stats.lodInstances[lod] = counts[lod];
+        if (counts[lod] > 0) {
+            _commands.push_back({_lods[lod].indexCount, (GLuint) counts[lod], _lods[lod].firstIndex, 0, (GLuint) base});
+            _stats.triangles += counts[lod] * (_lods[lod].indexCount / 3);
+        }
+        base += counts[lod];
+    }
+    _stats.visibleInstances = visible;
+    _stats.drawCommands = _commands.size();
+    _stats.drawCalls = _commands.empty() ? 0 : 1;
+    _stats.selectMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void InstancedScene::draw() {
+    if (_commands.empty()) {
+        return;
+    }
+    // orphan the previous frame's storage rather than waiting for draws still reading it
+    glBindBuffer(GL_ARRAY_BUFFER, _instanceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, _instances.size() * sizeof(glm::vec4), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, _stats.visibleInstances * sizeof(glm::vec4), _sorted.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _indirectBuffer);
+    glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, _commands.size() * sizeof(DrawElementsIndirectCommand), _commands.data());
+
+    glBindVertexArray(_vao);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void *) 0, (GLsizei) _commands.size(), 0);
+    glBindVertexArray(0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void InstancedScene::deleteGLResources() {
+    glDeleteBuffers(1, &_vertexBuffer);
+    glDeleteBuffers(1, &_normalBuffer);
+    glDeleteBuffers(1, &_indexBuffer);
+    glDeleteBuffers(1, &_instanceBuffer);
+    glDeleteBuffers(1, &_indirectBuffer);
+    glDeleteVertexArrays(1, &_vao);
+    _vao = _vertexBuffer = _normalBuffer = _indexBuffer = _instanceBuffer = _indirectBuffer = 0;
+}
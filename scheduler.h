@@ -0,0 +1,78 @@
+#pragma once
+
+#include "model.h"
+
+#include <chrono>
+#include <cstdio>
+
+// Runs collapses on the render thread within a per-frame time budget. The cost of a collapse is tracked as a
+// moving average and another one only starts if it is expected to fit. A collapse that overruns the budget is
+// paid back over the following frames, so time spent per frame averages out to the budget even when a single
+// collapse costs more than a frame's worth.
+class CollapseScheduler {
+public:
+    CollapseScheduler(double budgetMs) : _budgetMs(budgetMs) {}
+
+    // returns the number of collapses run this frame
+    size_t runFrame(Model &model) {
+        _frames++;
+        double available = _budgetMs - _debtMs;
+        if (available <= 0.0) {
+            _debtMs -= _budgetMs;
+            return 0;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        size_t collapses = 0;
+        while (true) {
+            double elapsed = msSince(start);
+            if (collapses > 0 && elapsed + _averageMs > available) {
+                break;
+            }
+            if (!model.collapseMeshQEM()) {
+                break;
+            }
+            collapses++;
+            double cost = msSince(start) - elapsed;
+            _averageMs = _averageMs == 0.0 ? cost : 0.9 * _averageMs + 0.1 * cost;
+        }
+
+        double spent = msSince(start);
+        _debtMs = std::max(0.0, spent - available);
+        _windowCollapses += collapses;
+        _windowMs += spent;
+        return collapses;
+    }
+
+    // once per second, fills line with the throughput since the last report and returns true
+    bool report(double now, size_t faces, char* line, size_t size) {
+        if (_windowStart == 0.0) {
+            _windowStart = now;
+        }
+        double seconds = now - _windowStart;
+        if (seconds < 1.0) {
+            return false;
+        }
+        snprintf(line, size, "%.0f collapses/s, %lu faces left, %.2f ms/frame simplifying (budget %.2f)",
+                 _windowCollapses / seconds, faces, _frames ? _windowMs / _frames : 0.0, _budgetMs);
+        _windowStart = now;
+        _windowCollapses = 0;
+        _windowMs = 0.0;
+        _frames = 0;
+        return true;
+    }
+
+private:
+    double _budgetMs;
+    double _debtMs = 0.0;
+    double _averageMs = 0.0;
+
+    double _windowStart = 0.0;
+    size_t _windowCollapses = 0;
+    double _windowMs = 0.0;
+    size_t _frames = 0;
+
+    static double msSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+};
@@ -5,9 +5,19 @@
 #include <glm/glm.hpp>
 
 #include <string>
+#include <unordered_map>
+#include <vector>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <filesystem>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+// linked programs are kept here as driver binaries, see loadProgramBinary()
+#define SHADER_CACHE_DIR "shadercache"
+#define SHADER_CACHE_VERSION 1
 
 class Shader
 {
@@ -60,9 +70,16 @@ public:
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
         }
+        // 2. reuse the program linked by an earlier run if the driver still accepts it
+        std::string cachePath = programCachePath(vertexCode, fragmentCode, geometryCode);
+        if (loadProgramBinary(cachePath))
+        {
+            cacheUniformLocations();
+            return;
+        }
         const char* vShaderCode = vertexCode.c_str();
         const char * fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
+        // 3. compile shaders
         unsigned int vertex, fragment;
         // vertex shader
         vertex = glCreateShader(GL_VERTEX_SHADER);
@@ -86,12 +103,15 @@ public:
         }
         // shader Program
         ID = glCreateProgram();
+        glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
         glAttachShader(ID, vertex);
         glAttachShader(ID, fragment);
         if(geometryPath != nullptr)
             glAttachShader(ID, geometry);
         glLinkProgram(ID);
         checkCompileErrors(ID, "PROGRAM");
+        cacheUniformLocations();
+        saveProgramBinary(cachePath);
         // delete the shaders as they're linked into our program now and no longer necessery
         glDeleteShader(vertex);
         glDeleteShader(fragment);
@@ -105,66 +125,242 @@ public:
     { 
         glUseProgram(ID); 
     }
+    // location of a uniform in the default block, resolved at link time; -1 if it is not active
+    // ------------------------------------------------------------------------
+    GLint getUniformLocation(const std::string &name) const
+    {
+        auto it = uniformLocations.find(name);
+        return it == uniformLocations.end() ? -1 : it->second;
+    }
     // utility uniform functions
     // ------------------------------------------------------------------------
     void setBool(const std::string &name, bool value) const
     {         
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+        glUniform1i(getUniformLocation(name), (int)value); 
     }
     // ------------------------------------------------------------------------
     void setInt(const std::string &name, int value) const
     { 
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
+        glUniform1i(getUniformLocation(name), value); 
     }
     // ------------------------------------------------------------------------
     void setFloat(const std::string &name, float value) const
     { 
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
+        glUniform1f(getUniformLocation(name), value); 
     }
     // ------------------------------------------------------------------------
     void setVec2(const std::string &name, const glm::vec2 &value) const
     { 
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform2fv(getUniformLocation(name), 1, &value[0]); 
     }
     void setVec2(const std::string &name, float x, float y) const
     { 
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y); 
+        glUniform2f(getUniformLocation(name), x, y); 
     }
     // ------------------------------------------------------------------------
     void setVec3(const std::string &name, const glm::vec3 &value) const
     { 
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform3fv(getUniformLocation(name), 1, &value[0]); 
     }
     void setVec3(const std::string &name, float x, float y, float z) const
     { 
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z); 
+        glUniform3f(getUniformLocation(name), x, y, z); 
     }
     // ------------------------------------------------------------------------
     void setVec4(const std::string &name, const glm::vec4 &value) const
     { 
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform4fv(getUniformLocation(name), 1, &value[0]); 
     }
     void setVec4(const std::string &name, float x, float y, float z, float w) 
     { 
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w); 
+        glUniform4f(getUniformLocation(name), x, y, z, w); 
     }
     // ------------------------------------------------------------------------
     void setMat2(const std::string &name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix2fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat3(const std::string &name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat4(const std::string &name, const glm::mat4 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix4fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
+    }
+
+    // setters by location, for per-draw uniforms whose location was looked up once
+    // ------------------------------------------------------------------------
+    void setBool(GLint location, bool value) const
+    {
+        glUniform1i(location, (int)value);
+    }
+    void setInt(GLint location, int value) const
+    {
+        glUniform1i(location, value);
+    }
+    void setFloat(GLint location, float value) const
+    {
+        glUniform1f(location, value);
+    }
+    void setVec3(GLint location, const glm::vec3 &value) const
+    {
+        glUniform3fv(location, 1, &value[0]);
+    }
+    void setVec4(GLint location, const glm::vec4 &value) const
+    {
+        glUniform4fv(location, 1, &value[0]);
+    }
+    void setMat4(GLint location, const glm::mat4 &mat) const
+    {
+        glUniformMatrix4fv(location, 1, GL_FALSE, &mat[0][0]);
     }
 
 private:
+    std::unordered_map<std::string, GLint> uniformLocations;
+
+    // query every active uniform once after linking so the setters never ask the driver by string
+    // ------------------------------------------------------------------------
+    void cacheUniformLocations()
+    {
+        uniformLocations.clear();
+        GLint count = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            GLchar name[256];
+            GLint size;
+            GLenum type;
+            glGetActiveUniform(ID, i, sizeof(name), NULL, &size, &type, name);
+            // members of uniform blocks have no location
+            GLint location = glGetUniformLocation(ID, name);
+            if (location < 0)
+                continue;
+            uniformLocations[name] = location;
+            // arrays are reported as "name[0]", make the plain name work too
+            std::string arrayName = name;
+            if (arrayName.size() > 3 && arrayName.compare(arrayName.size() - 3, 3, "[0]") == 0)
+                uniformLocations[arrayName.substr(0, arrayName.size() - 3)] = location;
+        }
+    }
+
+    // The cache key covers the sources and the driver, since a binary is only valid for the driver that
+    // produced it. The driver may still reject a binary (e.g. after an update that kept the version string),
+    // in which case the program is compiled from source and the cache entry rewritten.
+    // ------------------------------------------------------------------------
+    static bool programBinarySupported()
+    {
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        return formats > 0;
+    }
+
+    static std::string programCachePath(const std::string &vertexCode, const std::string &fragmentCode, const std::string &geometryCode)
+    {
+        // FNV-1a
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&](const char* data, size_t size)
+        {
+            for (size_t i = 0; i < size; i++)
+            {
+                hash ^= (unsigned char)data[i];
+                hash *= 1099511628211ull;
+            }
+            // separator, so that moving text between the inputs changes the key
+            hash ^= 0xff;
+            hash *= 1099511628211ull;
+        };
+        mix(vertexCode.data(), vertexCode.size());
+        mix(fragmentCode.data(), fragmentCode.size());
+        mix(geometryCode.data(), geometryCode.size());
+        for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION})
+        {
+            const char* value = (const char*)glGetString(name);
+            if (value != NULL)
+                mix(value, strlen(value));
+        }
+        char file[64];
+        snprintf(file, sizeof(file), "/%016llx.bin", (unsigned long long)hash);
+        return std::string(SHADER_CACHE_DIR) + file;
+    }
+
+    bool loadProgramBinary(const std::string &path)
+    {
+        if (!programBinarySupported())
+            return false;
+        FILE* file = fopen(path.c_str(), "rb");
+        if (file == NULL)
+            return false;
+
+        char magic[4];
+        uint32_t header[3]; // version, format, length
+        bool ok = fread(magic, 1, 4, file) == 4 && memcmp(magic, "PBIN", 4) == 0
+            && fread(header, sizeof(uint32_t), 3, file) == 3 && header[0] == SHADER_CACHE_VERSION;
+        std::vector<char> binary;
+        if (ok)
+        {
+            // the binary is the rest of the file, so a truncated or corrupt length is caught before allocating it
+            long start = ftell(file);
+            ok = start >= 0 && fseek(file, 0, SEEK_END) == 0;
+            long end = ok ? ftell(file) : -1;
+            ok = ok && end >= start && (uint64_t)(end - start) == header[2] && fseek(file, start, SEEK_SET) == 0;
+        }
+        if (ok)
+        {
+            binary.resize(header[2]);
+            ok = fread(binary.data(), 1, binary.size(), file) == binary.size();
+        }
+        fclose(file);
+        if (!ok)
+        {
+            std::cout << "WARNING::SHADER::CACHE_ENTRY_CORRUPT " << path << std::endl;
+            return false;
+        }
+
+        ID = glCreateProgram();
+        glProgramBinary(ID, (GLenum)header[1], binary.data(), (GLsizei)binary.size());
+        GLint success = 0;
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            glDeleteProgram(ID);
+            ID = 0;
+            return false;
+        }
+        return true;
+    }
+
+    bool saveProgramBinary(const std::string &path)
+    {
+        GLint success = 0;
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        if (!success || !programBinarySupported())
+            return false;
+        GLint length = 0;
+        glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return false;
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(ID, length, &length, &format, binary.data());
+
+        std::error_code error;
+        std::filesystem::create_directories(SHADER_CACHE_DIR, error);
+        FILE* file = fopen(path.c_str(), "wb");
+        if (file == NULL)
+        {
+            std::cout << "WARNING::SHADER::CACHE_NOT_WRITABLE " << path << std::endl;
+            return false;
+        }
+        uint32_t header[3] = {SHADER_CACHE_VERSION, (uint32_t)format, (uint32_t)length};
+        bool ok = fwrite("PBIN", 1, 4, file) == 4 && fwrite(header, sizeof(uint32_t), 3, file) == 3
+            && fwrite(binary.data(), 1, length, file) == (size_t)length;
+        fclose(file);
+        return ok;
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type)
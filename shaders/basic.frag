@@ -1,16 +1,19 @@
-#version 460 core
+#version 450 core
 
 layout(location = 0) in vec3 vertexPositionView;
 layout(location = 1) in vec3 vertexNormalView;
 
 out vec4 FragColor;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-
-uniform vec3 lightPos;
-uniform vec3 eyePos;
+// per-frame constants, shared by every program through uniform buffer binding 0 (see uniforms.h)
+layout (std140, binding = 0) uniform FrameConstants {
+    mat4 model;
+    mat4 view;
+    mat4 projection;
+    mat4 normalMatrix;
+    vec3 lightPos;
+    vec3 eyePos;
+};
 
 void main() {
 
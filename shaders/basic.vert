@@ -1,4 +1,4 @@
-#version 460 core
+#version 450 core
 
 layout (location = 0) in vec3 vertexPosition;
 layout (location = 1) in vec3 vertexNormal;
@@ -6,17 +6,36 @@ layout (location = 1) in vec3 vertexNormal;
 layout (location = 0) out vec3 vertexPositionView;
 layout (location = 1) out vec3 vertexNormalView;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat4 normalMatrix;
+// per-frame constants, shared by every program through uniform buffer binding 0 (see uniforms.h)
+layout (std140, binding = 0) uniform FrameConstants {
+	mat4 model;
+	mat4 view;
+	mat4 projection;
+	mat4 normalMatrix;
+	vec3 lightPos;
+	vec3 eyePos;
+};
 
-uniform vec3 lightPos;
-uniform vec3 eyePos;
+// quantized vertex decode: positions are unorm16 relative to the mesh AABB and normals are
+// octahedral encoded in .xy. The defaults leave float vertices untouched.
+uniform vec3 positionOffset = vec3(0.0);
+uniform vec3 positionScale = vec3(1.0);
+uniform bool octNormals = false;
+
+vec3 octDecode(vec2 e) {
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
 
 void main() {
-	vertexPositionView = (view * model * vec4(vertexPosition, 1.0f)).xyz;
-	vertexNormalView = normalize((normalMatrix * vec4(vertexNormal, 0.0f)).xyz);
+	vec3 position = positionOffset + positionScale * vertexPosition;
+	vec3 normal = octNormals ? octDecode(vertexNormal.xy) : vertexNormal;
+
+	vertexPositionView = (view * model * vec4(position, 1.0f)).xyz;
+	vertexNormalView = normalize((normalMatrix * vec4(normal, 0.0f)).xyz);
 
-	gl_Position = projection * view * model * vec4(vertexPosition, 1.0f);
+	gl_Position = projection * view * model * vec4(position, 1.0f);
 }
\ No newline at end of file
@@ -0,0 +1,29 @@
+#version 450 core
+
+layout (location = 0) in vec3 vertexPosition;
+layout (location = 1) in vec3 vertexNormal;
+// per instance: xyz translation, w uniform scale
+layout (location = 2) in vec4 instanceTransform;
+
+layout (location = 0) out vec3 vertexPositionView;
+layout (location = 1) out vec3 vertexNormalView;
+
+// per-frame constants, shared by every program through uniform buffer binding 0 (see uniforms.h)
+layout (std140, binding = 0) uniform FrameConstants {
+	mat4 model;
+	mat4 view;
+	mat4 projection;
+	mat4 normalMatrix;
+	vec3 lightPos;
+	vec3 eyePos;
+};
+
+void main() {
+	// a uniform scale leaves normal directions unchanged, so normalMatrix still applies
+	vec3 position = instanceTransform.xyz + instanceTransform.w * vertexPosition;
+
+	vertexPositionView = (view * model * vec4(position, 1.0f)).xyz;
+	vertexNormalView = normalize((normalMatrix * vec4(vertexNormal, 0.0f)).xyz);
+
+	gl_Position = projection * view * model * vec4(position, 1.0f);
+}
\ No newline at end of file
@@ -0,0 +1,181 @@
+#pragma once
+
+#include "model.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+// Immutable state of the mesh as the worker last left it. The vertex streams are copied only when the vertices
+// are renumbered and are shared by every snapshot until the next time; the vertices collapses move in between
+// go into a log, of which a snapshot covers the first movedCount entries. The worker only ever appends past
+// those, so a snapshot's range stays valid while the log grows.
+struct MeshSnapshot {
+    uint64_t version = 0;
+    // changes only when the vertices are renumbered (finalizing), not when collapses move some of them
+    uint64_t vertexVersion = 0;
+    std::shared_ptr<const std::vector<glm::vec3>> vertices;
+    std::shared_ptr<const std::vector<glm::vec3>> normals;
+    std::shared_ptr<const std::vector<MovedVertex>> moved;
+    size_t movedCount = 0;
+    std::vector<glm::ivec3> faces;
+    MeshletData meshlets;
+};
+
+// Runs collapseMeshQEM() on a CPU-only copy of the model on a worker thread and publishes a snapshot after
+// every collapse. When simplification is switched off the worker finalizes the mesh (index reordering,
+// meshlets, vertex renumbering) and publishes that too. The render thread picks up whatever is newest with
+// latest(), which never waits on the worker.
+class AsyncSimplifier {
+public:
+    AsyncSimplifier(const Model &model)
+        : _model(model.getVertices(), model.getNormals(), model.getFaces()) {
+        if (!model.getImportance().empty()) {
+            _model.setImportance(model.getImportance());
+        }
+        publish(true);
+        // latest() falls back to this until it first gets the lock, so it never returns null
+        _acquired = _latest;
+        _thread = std::thread(&AsyncSimplifier::run, this);
+    }
+
+    ~AsyncSimplifier() {
+        {
+            std::lock_guard<std::mutex> lock(_controlMutex);
+            _stop = true;
+        }
+        _wake.notify_one();
+        _thread.join();
+    }
+
+    // simplify while active, finalize once it turns inactive
+    void setActive(bool active) {
+        {
+            std::lock_guard<std::mutex> lock(_controlMutex);
+            if (_active == active) {
+                return;
+            }
+            _active = active;
+        }
+        _wake.notify_one();
+    }
+
+    // newest snapshot, or the previous one if the worker happens to be publishing right now
+    std::shared_ptr<const MeshSnapshot> latest() {
+        std::unique_lock<std::mutex> lock(_snapshotMutex, std::try_to_lock);
+        if (lock.owns_lock()) {
+            _acquired = _latest;
+        }
+        return _acquired;
+    }
+
+private:
+    Model _model;
+
+    std::thread _thread;
+    std::mutex _controlMutex;
+    std::condition_variable _wake;
+    bool _active = false;
+    bool _stop = false;
+
+    // guards only the pointer swap, never any simplification work
+    std::mutex _snapshotMutex;
+    std::shared_ptr<const MeshSnapshot> _latest;
+    // owned by the render thread
+    std::shared_ptr<const MeshSnapshot> _acquired;
+
+    // owned by the worker
+    uint64_t _version = 0;
+    uint64_t _vertexVersion = 0;
+    std::shared_ptr<const std::vector<glm::vec3>> _vertices;
+    std::shared_ptr<const std::vector<glm::vec3>> _normals;
+    // sized once per renumbering, never reallocated while snapshots point into it
+    std::shared_ptr<std::vector<MovedVertex>> _moved;
+    size_t _movedCount = 0;
+
+    void run() {
+        bool collapsed = false;
+        bool exhausted = false;
+        while (true) {
+            bool active;
+            {
+                std::unique_lock<std::mutex> lock(_controlMutex);
+                _wake.wait(lock, [&] { return _stop || (_active && !exhausted) || (!_active && collapsed); });
+                if (_stop) {
+                    return;
+                }
+                active = _active;
+            }
+
+            if (active) {
+                exhausted = !_model.collapseMeshQEM();
+                collapsed = collapsed || !exhausted;
+                if (!exhausted) {
+                    publish(false);
+                }
+            }
+            else {
+                _model.optimizeVertexCache();
+                _model.buildMeshlets();
+                _model.optimizeVertexFetch();
+                publish(true);
+                collapsed = false;
+            }
+        }
+    }
+
+    void publish(bool renumbered) {
+        const std::vector<glm::vec3> &vertices = _model.getVertices();
+        const std::vector<glm::vec3> &normals = _model.getNormals();
+        const std::vector<int> &moved = _model.getMovedVertices();
+        // a collapse removes a vertex, so a log as long as the vertex count hardly ever fills up; if it does,
+        // start over as if renumbered
+        if (!renumbered && _movedCount + moved.size() > _moved->size()) {
+            renumbered = true;
+        }
+        if (renumbered) {
+            _vertices = std::make_shared<const std::vector<glm::vec3>>(vertices);
+            _normals = std::make_shared<const std::vector<glm::vec3>>(normals);
+            _moved = std::make_shared<std::vector<MovedVertex>>(vertices.size());
+            _movedCount = 0;
+            _vertexVersion++;
+        }
+        else {
+            for (int v : moved) {
+                (*_moved)[_movedCount++] = {v, vertices[v], normals[v]};
+            }
+        }
+        _model.clearMovedVertices();
+
+        auto snapshot = std::make_shared<MeshSnapshot>();
+        snapshot->version = ++_version;
+        snapshot->vertexVersion = _vertexVersion;
+        snapshot->vertices = _vertices;
+        snapshot->normals = _normals;
+        snapshot->moved = _moved;
+        snapshot->movedCount = _movedCount;
+        snapshot->faces = _model.getFaces();
+        snapshot->meshlets = _model.getMeshlets();
+
+        std::lock_guard<std::mutex> lock(_snapshotMutex);
+        _latest = snapshot;
+    }
+};
+
+// Upload a snapshot into the model drawn on the render thread. Renumbered vertices are uploaded whole; otherwise
+// only the log entries past the movedApplied of the last applied snapshot, however many were skipped in between.
+void applySnapshot(Model &model, const MeshSnapshot &snapshot, uint64_t &vertexVersion, size_t &movedApplied) {
+    if (snapshot.vertexVersion != vertexVersion) {
+        model.setVertices(*snapshot.vertices, *snapshot.normals);
+        vertexVersion = snapshot.vertexVersion;
+        movedApplied = 0;
+    }
+    if (snapshot.movedCount > movedApplied) {
+        model.moveVertices(snapshot.moved->data() + movedApplied, snapshot.movedCount - movedApplied);
+        movedApplied = snapshot.movedCount;
+    }
+    model.setFaces(snapshot.faces, snapshot.meshlets);
+}
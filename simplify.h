@@ -0,0 +1,388 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "utilities.h"
+#include "bucketqueue.h"
+
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+
+// Standalone incremental QEM edge collapse over an arbitrary index buffer, for callers that simplify many
+// small pieces (cluster groups) instead of one Model. Like collapseMeshQEM() it collapses onto an existing
+// endpoint, so the output indexes the same vertex array. Unlike it, the quadrics are only updated around each
+// collapse, and locked vertices are never removed. How the queue follows the changed errors is a QueuePolicy.
+
+enum QueuePolicy {
+    // push fresh entries after each collapse and skip the stale ones by version stamp when they are popped
+    QUEUE_LAZY,
+    // keep one entry per edge in an indexed heap and re-key or remove it in place
+    QUEUE_EAGER,
+    // lazy, but on a BucketQueue: O(1) push and pop, collapses only ordered to within the bucket width
+    QUEUE_BUCKETED
+};
+
+// counters added to by simplifyQEM()
+struct SimplifyStats {
+    size_t collapses = 0;
+    size_t pushes = 0;
+    // entries re-keyed or removed in place, eager only
+    size_t updates = 0;
+    size_t removals = 0;
+    size_t pops = 0;
+    // popped entries whose version stamps no longer match, lazy and bucketed only
+    size_t stalePops = 0;
+    size_t flipRejects = 0;
+    size_t peakQueueSize = 0;
+    // sum of the quadric errors of the collapses made, the total the queue order tries to keep small
+    double errorSum = 0.0;
+};
+
+struct CollapseCandidate {
+    float error;
+    int from;
+    int to;
+    unsigned int fromVersion;
+    unsigned int toVersion;
+
+    bool operator>(const CollapseCandidate &other) const { return error > other.error; }
+};
+
+uint64_t edgeKey(int a, int b) {
+    return a < b ? ((uint64_t) a << 32) | (uint32_t) b : ((uint64_t) b << 32) | (uint32_t) a;
+}
+
+// Binary min-heap on error holding at most one candidate per edge. A map from edge key to heap slot lets an
+// entry be re-keyed (decrease or increase) or removed where it is, so nothing stale is ever popped, at the
+// price of a hash lookup and a sift for every touched edge.
+class CollapseHeap {
+public:
+    bool empty() const { return _heap.empty(); }
+    size_t size() const { return _heap.size(); }
+    const CollapseCandidate& top() const { return _heap[0]; }
+
+    void pop() { removeAt(0); }
+
+    // insert the candidate for edge key, or replace the one already there. Returns true on replace.
+    bool update(uint64_t key, const CollapseCandidate &candidate) {
+        auto it = _slots.find(key);
+        if (it == _slots.end()) {
+            _slots.emplace(key, _heap.size());
+            _heap.push_back(candidate);
+            _keys.push_back(key);
+            siftUp(_heap.size() - 1);
+            return false;
+        }
+        size_t i = it->second;
+        float previous = _heap[i].error;
+        _heap[i] = candidate;
+        if (candidate.error < previous) {
+            siftUp(i);
+        } else {
+            siftDown(i);
+        }
+        return true;
+    }
+
+    bool remove(uint64_t key) {
+        auto it = _slots.find(key);
+        if (it == _slots.end()) {
+            return false;
+        }
+        removeAt(it->second);
+        return true;
+    }
+
+private:
+    std::vector<CollapseCandidate> _heap;
+    std::vector<uint64_t> _keys;
+    std::unordered_map<uint64_t, size_t> _slots;
+
+    void place(size_t i, const CollapseCandidate &candidate, uint64_t key) {
+        _heap[i] = candidate;
+        _keys[i] = key;
+        _slots[key] = i;
+    }
+
+    void siftUp(size_t i) {
+        CollapseCandidate candidate = _heap[i];
+        uint64_t key = _keys[i];
+        while (i > 0) {
+            size_t parent = (i - 1) / 2;
+            if (!(_heap[parent].error > candidate.error)) {
+                break;
+            }
+            place(i, _heap[parent], _keys[parent]);
+            i = parent;
+        }
+        place(i, candidate, key);
+    }
+
+    void siftDown(size_t i) {
+        CollapseCandidate candidate = _heap[i];
+        uint64_t key = _keys[i];
+        size_t count = _heap.size();
+        while (true) {
+            size_t child = 2 * i + 1;
+            if (child >= count) {
+                break;
+            }
+            if (child + 1 < count && _heap[child + 1].error < _heap[child].error) {
+                child++;
+            }
+            if (!(_heap[child].error < candidate.error)) {
+                break;
+            }
+            place(i, _heap[child], _keys[child]);
+            i = child;
+        }
+        place(i, candidate, key);
+    }
+
+    void removeAt(size_t i) {
+        _slots.erase(_keys[i]);
+        size_t last = _heap.size() - 1;
+        if (i != last) {
+            float removed = _heap[i].error;
+            _heap[i] = _heap[last];
+            _keys[i] = _keys[last];
+            _slots[_keys[i]] = i;
+            _heap.pop_back();
+            _keys.pop_back();
+            if (_heap[i].error < removed) {
+                siftUp(i);
+            } else {
+                siftDown(i);
+            }
+            return;
+        }
+        _heap.pop_back();
+        _keys.pop_back();
+    }
+};
+
+float quadricError(const glm::mat4 &q, glm::vec3 p) {
+    glm::vec4 v(p, 1.0f);
+    return std::max(glm::dot(v, q * v), 0.0f);
+}
+
+// does moving vertex `from` onto `to` flip any remaining triangle around `from`?
+bool collapseFlipsFace(const std::vector<glm::vec3> &vertices, const std::vector<glm::ivec3> &faces,
+                       const std::vector<int> &vertexFaces, const std::vector<bool> &faceAlive, int from, int to) {
+    for (int f : vertexFaces) {
+        if (!faceAlive[f]) {
+            continue;
+        }
+        glm::ivec3 face = faces[f];
+        if (face.x == to || face.y == to || face.z == to) {
+            continue;
+        }
+        glm::vec3 p[3], q[3];
+        for (int j = 0; j < 3; j++) {
+            p[j] = vertices[face[j]];
+            q[j] = face[j] == from ? vertices[to] : p[j];
+        }
+        glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+        glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+        if (glm::dot(before, after) <= 0.0f) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Simplify faces in place down to targetFaces (or until nothing collapsible is left).
+// Returns the largest collapse error as a distance: the square root of the quadric error.
+float simplifyQEM(const std::vector<glm::vec3> &vertices, std::vector<glm::ivec3> &faces,
+                  const std::vector<bool> &locked, size_t targetFaces,
+                  QueuePolicy policy = QUEUE_LAZY, SimplifyStats* stats = nullptr,
+                  int bucketBits = BUCKET_QUEUE_DEFAULT_BITS) {
+    SimplifyStats counters;
+    size_t vertexCount = vertices.size();
+    std::vector<glm::mat4> quadrics(vertexCount, glm::mat4(0.0f));
+    std::vector<std::vector<int>> vertexFaces(vertexCount);
+    std::vector<bool> faceAlive(faces.size(), true);
+    std::vector<bool> removed(vertexCount, false);
+    std::vector<unsigned int> version(vertexCount, 0);
+
+    // unit planes, so the error is a sum of squared distances in model units
+    for (size_t i = 0; i < faces.size(); i++) {
+        glm::ivec3 face = faces[i];
+        glm::vec4 plane = computePlaneCoeffs(vertices[face[0]], vertices[face[1]], vertices[face[2]]);
+        float length = glm::length(glm::vec3(plane));
+        glm::mat4 Kp = length > 0.0f ? glm::outerProduct(plane / length, plane / length) : glm::mat4(0.0f);
+        for (int j = 0; j < 3; j++) {
+            quadrics[face[j]] += Kp;
+            vertexFaces[face[j]].push_back((int) i);
+        }
+    }
+
+    std::priority_queue<CollapseCandidate, std::vector<CollapseCandidate>, std::greater<CollapseCandidate>> queue;
+    CollapseHeap heap;
+    BucketQueue<CollapseCandidate> buckets(policy == QUEUE_BUCKETED ? bucketBits : 0);
+    auto pushCandidate = [&](int a, int b) {
+        if (locked[a] && locked[b]) {
+            if (policy == QUEUE_EAGER && heap.remove(edgeKey(a, b))) {
+                counters.removals++;
+            }
+            return;
+        }
+        glm::mat4 Q = quadrics[a] + quadrics[b];
+        // try both directions, a locked vertex can only be kept
+        float removeA = locked[a] ? INFINITY : quadricError(Q, vertices[b]);
+        float removeB = locked[b] ? INFINITY : quadricError(Q, vertices[a]);
+        CollapseCandidate candidate = removeA <= removeB ? CollapseCandidate{removeA, a, b, version[a], version[b]}
+                                                         : CollapseCandidate{removeB, b, a, version[b], version[a]};
+        if (policy == QUEUE_EAGER) {
+            if (heap.update(edgeKey(a, b), candidate)) {
+                counters.updates++;
+            } else {
+                counters.pushes++;
+            }
+            counters.peakQueueSize = std::max(counters.peakQueueSize, heap.size());
+        } else if (policy == QUEUE_BUCKETED) {
+            buckets.push(candidate.error, candidate);
+            counters.pushes++;
+            counters.peakQueueSize = std::max(counters.peakQueueSize, buckets.size());
+        } else {
+            queue.push(candidate);
+            counters.pushes++;
+            counters.peakQueueSize = std::max(counters.peakQueueSize, queue.size());
+        }
+    };
+
+    for (size_t i = 0; i < faces.size(); i++) {
+        for (int j = 0; j < 3; j++) {
+            // interior edges are queued from both faces. Lazily the copy popped second is stale by then,
+            // eagerly the second push just replaces the first.
+            pushCandidate(faces[i][j], faces[i][(j + 1) % 3]);
+        }
+    }
+
+    size_t liveFaces = faces.size();
+    float maxError = 0.0f;
+    std::vector<int> neighbours;
+    // eager only: third vertices of the faces that died around the collapsed edge
+    std::vector<int> dropped;
+
+    auto queueEmpty = [&]() {
+        return policy == QUEUE_EAGER ? heap.empty() : policy == QUEUE_BUCKETED ? buckets.empty() : queue.empty();
+    };
+    while (liveFaces > targetFaces && !queueEmpty()) {
+        CollapseCandidate c;
+        if (policy == QUEUE_EAGER) {
+            c = heap.top();
+            heap.pop();
+        } else if (policy == QUEUE_BUCKETED) {
+            c = buckets.top().second;
+            buckets.pop();
+        } else {
+            c = queue.top();
+            queue.pop();
+        }
+        counters.pops++;
+        // never true for the eager heap, which drops or re-keys an edge as soon as an endpoint changes
+        if (removed[c.from] || removed[c.to] || version[c.from] != c.fromVersion || version[c.to] != c.toVersion) {
+            counters.stalePops++;
+            continue;
+        }
+        if (collapseFlipsFace(vertices, faces, vertexFaces[c.from], faceAlive, c.from, c.to)) {
+            counters.flipRejects++;
+            continue;
+        }
+
+        maxError = std::max(maxError, c.error);
+        counters.collapses++;
+        counters.errorSum += c.error;
+        if (policy == QUEUE_EAGER) {
+            // the edges of the removed vertex go now; those that survive come back as edges of c.to below.
+            // Faces around the edge die, and c.to may lose their third vertex as a neighbour with them.
+            dropped.clear();
+            for (int f : vertexFaces[c.from]) {
+                if (!faceAlive[f]) {
+                    continue;
+                }
+                glm::ivec3 face = faces[f];
+                bool dies = face.x == c.to || face.y == c.to || face.z == c.to;
+                for (int j = 0; j < 3; j++) {
+                    int v = face[j];
+                    if (v != c.from && heap.remove(edgeKey(c.from, v))) {
+                        counters.removals++;
+                    }
+                    if (dies && v != c.from && v != c.to) {
+                        dropped.push_back(v);
+                    }
+                }
+            }
+        }
+        for (int f : vertexFaces[c.from]) {
+            if (!faceAlive[f]) {
+                continue;
+            }
+            glm::ivec3 &face = faces[f];
+            if (face.x == c.to || face.y == c.to || face.z == c.to) {
+                faceAlive[f] = false;
+                liveFaces--;
+                continue;
+            }
+            for (int j = 0; j < 3; j++) {
+                if (face[j] == c.from) {
+                    face[j] = c.to;
+                }
+            }
+            vertexFaces[c.to].push_back(f);
+        }
+        vertexFaces[c.from].clear();
+        quadrics[c.to] += quadrics[c.from];
+        removed[c.from] = true;
+        version[c.to]++;
+
+        // drop dead faces and requeue (or re-key) every edge around the kept vertex
+        std::vector<int> &toFaces = vertexFaces[c.to];
+        toFaces.erase(std::remove_if(toFaces.begin(), toFaces.end(), [&](int f) { return !faceAlive[f]; }), toFaces.end());
+        neighbours.clear();
+        for (int f : toFaces) {
+            for (int j = 0; j < 3; j++) {
+                if (faces[f][j] != c.to) {
+                    neighbours.push_back(faces[f][j]);
+                }
+            }
+        }
+        std::sort(neighbours.begin(), neighbours.end());
+        neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+        for (int n : neighbours) {
+            pushCandidate(c.to, n);
+        }
+        for (int v : dropped) {
+            if (!std::binary_search(neighbours.begin(), neighbours.end(), v) && heap.remove(edgeKey(c.to, v))) {
+                counters.removals++;
+            }
+        }
+    }
+
+    std::vector<glm::ivec3> result;
+    result.reserve(liveFaces);
+    for (size_t i = 0; i < faces.size(); i++) {
+        if (faceAlive[i]) {
+            result.push_back(faces[i]);
+        }
+    }
+    faces.swap(result);
+
+    if (stats) {
+        stats->collapses += counters.collapses;
+        stats->pushes += counters.pushes;
+        stats->updates += counters.updates;
+        stats->removals += counters.removals;
+        stats->pops += counters.pops;
+        stats->stalePops += counters.stalePops;
+        stats->flipRejects += counters.flipRejects;
+        stats->peakQueueSize = std::max(stats->peakQueueSize, counters.peakQueueSize);
+        stats->errorSum += counters.errorSum;
+    }
+    return std::sqrt(maxError);
+}
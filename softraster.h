@@ -0,0 +1,413 @@
+#pragma once
+
+#include "uniforms.h"
+#include "culling.h"
+#include "parallel.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define RASTER_TILE_SIZE 64
+
+// Software triangle rasterizer for machines without a GPU. Vertices are transformed in parallel, triangles
+// are set up and binned into RASTER_TILE_SIZE tiles, and tiles are rasterized in parallel, four pixels of a
+// row at a time. Pixels that pass the depth test are shaded like shaders/basic.vert + basic.frag, from the
+// same FrameConstants the GPU path uploads. There is no clipping: triangles crossing the near plane are
+// dropped, which is fine for a camera that frames the whole mesh.
+
+struct RasterVertex {
+    // x, y in pixels, z depth in [0, 1], w = 1 / clip w
+    glm::vec4 screen;
+    glm::vec3 viewPosition;
+    glm::vec3 viewNormal;
+};
+
+// l[i](x, y) = a[i] x + b[i] y + c[i] is the barycentric weight of vertex i, inside when all three are >= 0
+struct RasterTriangle {
+    float a[3], b[3], c[3];
+    int minX, minY, maxX, maxY;
+    glm::ivec3 vertices;
+};
+
+class SoftwareRasterizer {
+public:
+    SoftwareRasterizer(int width, int height)
+        : _width(width), _height(height), _stride((width + 3) & ~3),
+          _tilesX((width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE),
+          _tilesY((height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE) {
+        _depth.resize((size_t) _stride * _height);
+        _color.resize((size_t) _width * _height * 3);
+        _bins.resize((size_t) _tilesX * _tilesY);
+    }
+
+    void clear(glm::vec3 color) {
+        std::fill(_depth.begin(), _depth.end(), 1.0f);
+        for (size_t i = 0; i < _color.size(); i += 3) {
+            _color[i] = toUnorm8(color.x);
+            _color[i + 1] = toUnorm8(color.y);
+            _color[i + 2] = toUnorm8(color.z);
+        }
+    }
+
+    // shade = false only writes depth, for occluders
+    void drawMesh(const std::vector<glm::vec3> &vertices, const std::vector<glm::vec3> &normals,
+                  const std::vector<glm::ivec3> &faces, const FrameConstants &constants, bool shade = true);
+
+    // max depth of each HIZ_BLOCK_SIZE square of pixels, into hiz, whose storage is reused from frame to frame
+    void buildHiZ(HiZBuffer &hiz) const;
+
+    bool writePng(const char* path) const;
+
+    int getWidth() const { return _width; }
+    int getHeight() const { return _height; }
+    float getDepth(int x, int y) const { return _depth[(size_t) y * _stride + x]; }
+    // rgb8, rows top to bottom
+    const std::vector<uint8_t>& getColor() const { return _color; }
+
+private:
+    int _width;
+    int _height;
+    // depth rows are padded to whole groups of four pixels
+    int _stride;
+    int _tilesX;
+    int _tilesY;
+    std::vector<float> _depth;
+    std::vector<uint8_t> _color;
+
+    std::vector<RasterVertex> _transformed;
+    std::vector<RasterTriangle> _triangles;
+    std::vector<uint8_t> _triangleValid;
+    std::vector<std::vector<uint32_t>> _bins;
+
+    static uint8_t toUnorm8(float value) {
+        return (uint8_t) (std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+    }
+
+    bool setupTriangle(glm::ivec3 face, RasterTriangle &triangle) const;
+    void rasterizeTile(int tile, const FrameConstants &constants, bool shade);
+    void shadePixel(const RasterTriangle &triangle, float l0, float l1, float l2, int x, int y, const FrameConstants &constants);
+};
+
+void SoftwareRasterizer::drawMesh(const std::vector<glm::vec3> &vertices, const std::vector<glm::vec3> &normals,
+                                  const std::vector<glm::ivec3> &faces, const FrameConstants &constants, bool shade) {
+    glm::mat4 modelView = constants.view * constants.model;
+    glm::mat4 modelViewProjection = constants.projection * modelView;
+
+    _transformed.resize(vertices.size());
+    parallelFor(vertices.size(), 4096, [&](size_t i) {
+        glm::vec4 clip = modelViewProjection * glm::vec4(vertices[i], 1.0f);
+        RasterVertex &v = _transformed[i];
+        float invW = 1.0f / clip.w;
+        v.screen = glm::vec4((clip.x * invW * 0.5f + 0.5f) * _width, (0.5f - clip.y * invW * 0.5f) * _height,
+                             clip.z * invW * 0.5f + 0.5f, clip.w > 0.0f ? invW : -1.0f);
+        v.viewPosition = glm::vec3(modelView * glm::vec4(vertices[i], 1.0f));
+        v.viewNormal = glm::normalize(glm::vec3(constants.normalMatrix * glm::vec4(normals[i], 0.0f)));
+    });
+
+    _triangles.resize(faces.size());
+    _triangleValid.resize(faces.size());
+    parallelFor(faces.size(), 4096, [&](size_t i) {
+        _triangleValid[i] = setupTriangle(faces[i], _triangles[i]);
+    });
+
+    // binning stays serial so every tile sees its triangles in submission order
+    for (std::vector<uint32_t> &bin : _bins) {
+        bin.clear();
+    }
+    for (size_t i = 0; i < faces.size(); i++) {
+        if (!_triangleValid[i]) {
+            continue;
+        }
+        const RasterTriangle &t = _triangles[i];
+        for (int ty = t.minY / RASTER_TILE_SIZE; ty <= t.maxY / RASTER_TILE_SIZE; ty++) {
+            for (int tx = t.minX / RASTER_TILE_SIZE; tx <= t.maxX / RASTER_TILE_SIZE; tx++) {
+                _bins[ty * _tilesX + tx].push_back((uint32_t) i);
+            }
+        }
+    }
+
+    parallelFor(_bins.size(), 1, [&](size_t tile) {
+        rasterizeTile((int) tile, constants, shade);
+    });
+}
+
+bool SoftwareRasterizer::setupTriangle(glm::ivec3 face, RasterTriangle &triangle) const {
+    const RasterVertex *v[3] = {&_transformed[face[0]], &_transformed[face[1]], &_transformed[face[2]]};
+    float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+    for (int i = 0; i < 3; i++) {
+        // behind the eye or in front of the near plane
+        if (v[i]->screen.w <= 0.0f || v[i]->screen.z < 0.0f) {
+            return false;
+        }
+        minX = std::min(minX, v[i]->screen.x);
+        minY = std::min(minY, v[i]->screen.y);
+        maxX = std::max(maxX, v[i]->screen.x);
+        maxY = std::max(maxY, v[i]->screen.y);
+    }
+
+    // pixels whose centers can fall inside, clamped to the screen
+    triangle.minX = std::max(0, (int) std::floor(minX - 0.5f));
+    triangle.minY = std::max(0, (int) std::floor(minY - 0.5f));
+    triangle.maxX = std::min(_width - 1, (int) std::ceil(maxX - 0.5f));
+    triangle.maxY = std::min(_height - 1, (int) std::ceil(maxY - 0.5f));
+    if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY) {
+        return false;
+    }
+
+    // edge function of the edge opposite each vertex, divided by the signed area so that both windings
+    // come out positive inside
+    glm::vec2 p[3];
+    for (int i = 0; i < 3; i++) {
+        p[i] = glm::vec2(v[i]->screen.x, v[i]->screen.y);
+    }
+    float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[1].y - p[0].y) * (p[2].x - p[0].x);
+    if (std::fabs(area) < 1e-8f) {
+        return false;
+    }
+    for (int i = 0; i < 3; i++) {
+        glm::vec2 a = p[(i + 1) % 3];
+        glm::vec2 b = p[(i + 2) % 3];
+        triangle.a[i] = (a.y - b.y) / area;
+        triangle.b[i] = (b.x - a.x) / area;
+        triangle.c[i] = (a.x * b.y - a.y * b.x) / area;
+    }
+    triangle.vertices = face;
+    return true;
+}
+
+void SoftwareRasterizer::rasterizeTile(int tile, const FrameConstants &constants, bool shade) {
+    int tileX = (tile % _tilesX) * RASTER_TILE_SIZE;
+    int tileY = (tile / _tilesX) * RASTER_TILE_SIZE;
+    int tileMaxX = std::min(tileX + RASTER_TILE_SIZE, _width) - 1;
+    int tileMaxY = std::min(tileY + RASTER_TILE_SIZE, _height) - 1;
+
+    for (uint32_t index : _bins[tile]) {
+        const RasterTriangle &t = _triangles[index];
+        float z0 = _transformed[t.vertices[0]].screen.z;
+        float z1 = _transformed[t.vertices[1]].screen.z;
+        float z2 = _transformed[t.vertices[2]].screen.z;
+        // groups of four start on a multiple of four, tiles are too
+        int startX = std::max(t.minX, tileX) & ~3;
+        int endX = std::min(t.maxX, tileMaxX);
+        int startY = std::max(t.minY, tileY);
+        int endY = std::min(t.maxY, tileMaxY);
+
+        for (int y = startY; y <= endY; y++) {
+            float py = y + 0.5f;
+            float* depthRow = &_depth[(size_t) y * _stride];
+#if defined(__SSE2__)
+            __m128 rowL0 = _mm_set1_ps(t.b[0] * py + t.c[0]);
+            __m128 rowL1 = _mm_set1_ps(t.b[1] * py + t.c[1]);
+            __m128 rowL2 = _mm_set1_ps(t.b[2] * py + t.c[2]);
+            __m128 a0 = _mm_set1_ps(t.a[0]), a1 = _mm_set1_ps(t.a[1]), a2 = _mm_set1_ps(t.a[2]);
+            __m128 vz0 = _mm_set1_ps(z0), vz1 = _mm_set1_ps(z1), vz2 = _mm_set1_ps(z2);
+            __m128 zero = _mm_setzero_ps();
+            __m128 lastCenter = _mm_set1_ps(endX + 0.5f);
+            for (int x = startX; x <= endX; x += 4) {
+                __m128 px = _mm_add_ps(_mm_set1_ps((float) x), _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f));
+                __m128 l0 = _mm_add_ps(_mm_mul_ps(a0, px), rowL0);
+                __m128 l1 = _mm_add_ps(_mm_mul_ps(a1, px), rowL1);
+                __m128 l2 = _mm_add_ps(_mm_mul_ps(a2, px), rowL2);
+                __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(l0, zero), _mm_cmpge_ps(l1, zero)),
+                                           _mm_and_ps(_mm_cmpge_ps(l2, zero), _mm_cmple_ps(px, lastCenter)));
+                if (_mm_movemask_ps(inside) == 0) {
+                    continue;
+                }
+                __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(l0, vz0), _mm_mul_ps(l1, vz1)), _mm_mul_ps(l2, vz2));
+                __m128 depth = _mm_loadu_ps(depthRow + x);
+                __m128 pass = _mm_and_ps(inside, _mm_cmplt_ps(z, depth));
+                int mask = _mm_movemask_ps(pass);
+                if (mask == 0) {
+                    continue;
+                }
+                _mm_storeu_ps(depthRow + x, _mm_or_ps(_mm_and_ps(pass, z), _mm_andnot_ps(pass, depth)));
+                if (shade) {
+                    float w0[4], w1[4], w2[4];
+                    _mm_storeu_ps(w0, l0);
+                    _mm_storeu_ps(w1, l1);
+                    _mm_storeu_ps(w2, l2);
+                    for (int k = 0; k < 4; k++) {
+                        if ((mask >> k) & 1) {
+                            shadePixel(t, w0[k], w1[k], w2[k], x + k, y, constants);
+                        }
+                    }
+                }
+            }
+#else
+            for (int x = std::max(t.minX, tileX); x <= endX; x++) {
+                float px = x + 0.5f;
+                float l0 = t.a[0] * px + t.b[0] * py + t.c[0];
+                float l1 = t.a[1] * px + t.b[1] * py + t.c[1];
+                float l2 = t.a[2] * px + t.b[2] * py + t.c[2];
+                if (l0 < 0.0f || l1 < 0.0f || l2 < 0.0f) {
+                    continue;
+                }
+                float z = l0 * z0 + l1 * z1 + l2 * z2;
+                if (z >= depthRow[x]) {
+                    continue;
+                }
+                depthRow[x] = z;
+                if (shade) {
+                    shadePixel(t, l0, l1, l2, x, y, constants);
+                }
+            }
+#endif
+        }
+    }
+}
+
+// Blinn-Phong as in shaders/basic.frag, including its use of lightPos as a view space position and the
+// interpolated normal without renormalization
+void SoftwareRasterizer::shadePixel(const RasterTriangle &triangle, float l0, float l1, float l2, int x, int y,
+                                    const FrameConstants &constants) {
+    const RasterVertex &v0 = _transformed[triangle.vertices[0]];
+    const RasterVertex &v1 = _transformed[triangle.vertices[1]];
+    const RasterVertex &v2 = _transformed[triangle.vertices[2]];
+    // perspective correct weights
+    float w0 = l0 * v0.screen.w, w1 = l1 * v1.screen.w, w2 = l2 * v2.screen.w;
+    float sum = w0 + w1 + w2;
+    w0 /= sum;
+    w1 /= sum;
+    w2 /= sum;
+    glm::vec3 position = w0 * v0.viewPosition + w1 * v1.viewPosition + w2 * v2.viewPosition;
+    glm::vec3 normal = w0 * v0.viewNormal + w1 * v1.viewNormal + w2 * v2.viewNormal;
+
+    const float shininess = 100.0f;
+    const glm::vec3 ambient(0.82f, 0.93f, 0.99f);
+    const glm::vec3 diffuse(1.0f, 0.0f, 0.0f);
+    const glm::vec3 specular(1.0f, 1.0f, 1.0f);
+    const float ambientWeight = 0.1f;
+
+    glm::vec3 lightVector = glm::normalize(constants.lightPos - position);
+    glm::vec3 viewVector = glm::normalize(-position);
+    glm::vec3 halfway = glm::normalize(lightVector + viewVector);
+    float specularWeight = std::pow(std::max(glm::dot(halfway, normal), 0.0f), shininess);
+    float diffuseWeight = std::max(glm::dot(normal, lightVector), 0.0f);
+    glm::vec3 color = ambient * ambientWeight + diffuse * diffuseWeight + specular * specularWeight;
+
+    uint8_t* out = &_color[((size_t) y * _width + x) * 3];
+    out[0] = toUnorm8(color.x);
+    out[1] = toUnorm8(color.y);
+    out[2] = toUnorm8(color.z);
+}
+
+void SoftwareRasterizer::buildHiZ(HiZBuffer &hiz) const {
+    hiz.pixelWidth = _width;
+    hiz.pixelHeight = _height;
+    hiz.width = (_width + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+    hiz.height = (_height + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+    hiz.maxDepth.resize((size_t) hiz.width * hiz.height);
+    parallelFor(hiz.height, 16, [&](size_t by) {
+        for (int bx = 0; bx < hiz.width; bx++) {
+            float maxDepth = 0.0f;
+            int endY = std::min((int) (by + 1) * HIZ_BLOCK_SIZE, _height);
+            int endX = std::min((bx + 1) * HIZ_BLOCK_SIZE, _width);
+            for (int y = (int) by * HIZ_BLOCK_SIZE; y < endY; y++) {
+                for (int x = bx * HIZ_BLOCK_SIZE; x < endX; x++) {
+                    maxDepth = std::max(maxDepth, _depth[(size_t) y * _stride + x]);
+                }
+            }
+            hiz.maxDepth[by * hiz.width + bx] = maxDepth;
+        }
+    });
+}
+
+// Minimal PNG encoder: one IDAT of stored (uncompressed) deflate blocks. Thumbnails are small, so the size
+// does not matter and no compression library is needed.
+uint32_t pngCrc(uint32_t crc, const uint8_t* data, size_t size) {
+    static uint32_t table[256];
+    static bool initialized = false;
+    if (!initialized) {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) {
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+        initialized = true;
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+void pngAppend32(std::vector<uint8_t> &out, uint32_t value) {
+    out.push_back(value >> 24);
+    out.push_back(value >> 16);
+    out.push_back(value >> 8);
+    out.push_back(value);
+}
+
+void pngWriteChunk(FILE* file, const char* type, const std::vector<uint8_t> &data) {
+    std::vector<uint8_t> chunk;
+    pngAppend32(chunk, (uint32_t) data.size());
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    pngAppend32(chunk, pngCrc(0, chunk.data() + 4, chunk.size() - 4));
+    fwrite(chunk.data(), 1, chunk.size(), file);
+}
+
+bool writePng(const char* path, int width, int height, const uint8_t* rgb) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open %s for writing!\n", path);
+        return false;
+    }
+    const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    fwrite(signature, 1, 8, file);
+
+    std::vector<uint8_t> header;
+    pngAppend32(header, width);
+    pngAppend32(header, height);
+    // 8 bit rgb, deflate, adaptive filtering, no interlace
+    header.insert(header.end(), {8, 2, 0, 0, 0});
+    pngWriteChunk(file, "IHDR", header);
+
+    // scanlines with filter type 0
+    std::vector<uint8_t> raw;
+    raw.reserve((size_t) height * (width * 3 + 1));
+    for (int y = 0; y < height; y++) {
+        raw.push_back(0);
+        raw.insert(raw.end(), rgb + (size_t) y * width * 3, rgb + (size_t) (y + 1) * width * 3);
+    }
+
+    std::vector<uint8_t> zlib = {0x78, 0x01};
+    uint32_t adlerA = 1, adlerB = 0;
+    for (size_t offset = 0; offset < raw.size(); offset += 65535) {
+        size_t size = std::min<size_t>(65535, raw.size() - offset);
+        zlib.push_back(offset + size == raw.size() ? 1 : 0);
+        zlib.push_back(size & 0xff);
+        zlib.push_back(size >> 8);
+        zlib.push_back(~size & 0xff);
+        zlib.push_back((~size >> 8) & 0xff);
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + size);
+    }
+    for (uint8_t byte : raw) {
+        adlerA = (adlerA + byte) % 65521;
+        adlerB = (adlerB + adlerA) % 65521;
+    }
+    pngAppend32(zlib, (adlerB << 16) | adlerA);
+    pngWriteChunk(file, "IDAT", zlib);
+    pngWriteChunk(file, "IEND", {});
+
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+bool SoftwareRasterizer::writePng(const char* path) const {
+    return ::writePng(path, _width, _height, _color.data());
+}
@@ -0,0 +1,218 @@
+#pragma once
+
+#include "parallel.h"
+#include "spatialorder.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// bits per axis in a packed cell key
+#define SPATIAL_GRID_AXIS_BITS 21
+#define SPATIAL_GRID_GRAIN 1024
+// columns per parallelFor chunk in findClosePairs()
+#define SPATIAL_GRID_COLUMN_GRAIN 16
+
+// Uniform grid over a point set, with cells at least as wide as the query radius so that every point within
+// the radius of another lies in the 3x3x3 block of cells around it. Each point is hashed to its packed cell
+// key (x, y, z from the high bits down) and the points are sorted on it. That keeps a cell's points
+// contiguous, and the cells of one (x, y) column contiguous in z order, so neighbours are found by walking
+// columns side by side rather than by a lookup per cell.
+struct SpatialGrid {
+    glm::vec3 origin = glm::vec3(0.0f);
+    float cellSize = 1.0f;
+    // unique occupied cells in key order, and where their points start in `points`
+    std::vector<uint64_t> cellKeys;
+    std::vector<uint32_t> cellStart;
+    // unique (x, y) columns in key order, and where their cells start in `cellKeys`
+    std::vector<uint64_t> columnKeys;
+    std::vector<uint32_t> columnStart;
+    // point indices grouped by cell, and their positions in the same order so scans read memory in sequence
+    std::vector<int> points;
+    std::vector<glm::vec3> sortedPositions;
+};
+
+uint64_t packCell(glm::ivec3 cell) {
+    return ((uint64_t) cell.x << (2 * SPATIAL_GRID_AXIS_BITS)) | ((uint64_t) cell.y << SPATIAL_GRID_AXIS_BITS) |
+           (uint64_t) cell.z;
+}
+
+glm::ivec3 cellOf(const SpatialGrid &grid, glm::vec3 p) {
+    const int maxCell = (1 << SPATIAL_GRID_AXIS_BITS) - 1;
+    glm::vec3 c = (p - grid.origin) / grid.cellSize;
+    return glm::ivec3(std::min((int) c.x, maxCell), std::min((int) c.y, maxCell), std::min((int) c.z, maxCell));
+}
+
+// Grid over the points with include[i] set (all of them when include is null). Cells are radius wide, or
+// minCellSize if larger, or wider still when the bounds would not fit the key.
+SpatialGrid buildSpatialGrid(const std::vector<glm::vec3> &positions, float radius,
+                             const std::vector<uint8_t>* include = nullptr, float minCellSize = 0.0f) {
+    SpatialGrid grid;
+    glm::vec3 lo(INFINITY), hi(-INFINITY);
+    for (size_t i = 0; i < positions.size(); i++) {
+        if (!include || (*include)[i]) {
+            lo = glm::min(lo, positions[i]);
+            hi = glm::max(hi, positions[i]);
+        }
+    }
+    if (lo.x > hi.x) {
+        grid.cellStart.push_back(0);
+        grid.columnStart.push_back(0);
+        return grid;
+    }
+    glm::vec3 extent = hi - lo;
+    float largest = std::max(extent.x, std::max(extent.y, extent.z));
+    grid.origin = lo;
+    grid.cellSize = std::max(std::max(std::max(radius, minCellSize), largest / ((1 << SPATIAL_GRID_AXIS_BITS) - 1)),
+                             1e-30f);
+
+    // Points are sorted on their cell packed into only as many bits per axis as the bounds need, in the same
+    // order as packCell(), so the radix sort makes as few passes as it can. Excluded points get the column
+    // past the last one and sort to the end.
+    glm::ivec3 last = cellOf(grid, hi);
+    glm::ivec3 bits(1);
+    for (int axis = 0; axis < 3; axis++) {
+        while (((int64_t) 1 << bits[axis]) <= last[axis] + (axis == 0)) {
+            bits[axis]++;
+        }
+    }
+    auto sortKey = [&](glm::ivec3 cell) {
+        return ((uint64_t) cell.x << (bits.y + bits.z)) | ((uint64_t) cell.y << bits.z) | (uint64_t) cell.z;
+    };
+    const uint64_t excluded = sortKey(glm::ivec3(last.x + 1, 0, 0));
+    std::vector<uint64_t> keys(positions.size());
+    parallelFor(positions.size(), SPATIAL_GRID_GRAIN, [&](size_t i) {
+        bool used = !include || (*include)[i];
+        keys[i] = used ? sortKey(cellOf(grid, positions[i])) : excluded;
+    });
+    std::vector<uint32_t> order = radixSortOrder(keys, bits.x + bits.y + bits.z, &keys);
+
+    size_t count = std::lower_bound(keys.begin(), keys.end(), excluded) - keys.begin();
+    grid.points.resize(count);
+    grid.sortedPositions.resize(count);
+    parallelFor(count, SPATIAL_GRID_GRAIN, [&](size_t k) {
+        grid.points[k] = (int) order[k];
+        grid.sortedPositions[k] = positions[order[k]];
+        uint64_t key = keys[k];
+        keys[k] = packCell(glm::ivec3((int) (key >> (bits.y + bits.z)), (int) ((key >> bits.z) & ((1u << bits.y) - 1)),
+                                      (int) (key & ((1u << bits.z) - 1))));
+    });
+    for (size_t k = 0; k < count; k++) {
+        uint64_t key = keys[k];
+        if (grid.cellKeys.empty() || grid.cellKeys.back() != key) {
+            uint64_t column = key >> SPATIAL_GRID_AXIS_BITS;
+            if (grid.columnKeys.empty() || grid.columnKeys.back() != column) {
+                grid.columnKeys.push_back(column);
+                grid.columnStart.push_back((uint32_t) grid.cellKeys.size());
+            }
+            grid.cellKeys.push_back(key);
+            grid.cellStart.push_back((uint32_t) k);
+        }
+    }
+    grid.cellStart.push_back((uint32_t) grid.points.size());
+    grid.columnStart.push_back((uint32_t) grid.cellKeys.size());
+    return grid;
+}
+
+// Every pair (i, j), i < j, of included points no farther apart than radius, so radius 0 finds exact
+// duplicates. Work is split by column, in parallel. A column finds its 3x3 neighbouring columns with a binary
+// search per row of three and then sweeps up z, advancing a cursor in every neighbour column, so no per-cell
+// lookup is needed. Pairs come out in column order whatever the thread count. A radius far below the point
+// spacing leaves nearly every point alone in its cell and column; a minCellSize near the spacing then makes
+// for fewer columns to search and a shorter sort.
+std::vector<std::pair<int, int>> findClosePairs(const std::vector<glm::vec3> &positions, float radius,
+                                                const std::vector<uint8_t>* include = nullptr,
+                                                float minCellSize = 0.0f) {
+    SpatialGrid grid = buildSpatialGrid(positions, radius, include, minCellSize);
+    size_t columnCount = grid.columnKeys.size();
+    float radius2 = radius * radius;
+    const uint64_t axisMask = ((uint64_t) 1 << SPATIAL_GRID_AXIS_BITS) - 1;
+
+    auto forEachPair = [&](size_t column, auto emit) {
+        uint64_t key = grid.columnKeys[column];
+        int64_t x = (int64_t) (key >> SPATIAL_GRID_AXIS_BITS);
+        int64_t y = (int64_t) (key & axisMask);
+        // [cursor, end) of the cells still ahead in each neighbouring column
+        uint32_t cursor[9], end[9];
+        int neighbours = 0;
+        // the columns (nx, y - 1) to (nx, y + 1) are adjacent in key order, so one search finds each row of
+        // three; this column's own row is right around it
+        auto columnsBegin = grid.columnKeys.begin();
+        for (int64_t nx = x - 1; nx <= x + 1; nx++) {
+            if (nx < 0 || nx > (int64_t) axisMask) {
+                continue;
+            }
+            uint64_t first = ((uint64_t) nx << SPATIAL_GRID_AXIS_BITS) | (uint64_t) std::max<int64_t>(y - 1, 0);
+            uint64_t last = ((uint64_t) nx << SPATIAL_GRID_AXIS_BITS) | (uint64_t) std::min<int64_t>(y + 1, axisMask);
+            size_t n;
+            if (nx < x) {
+                n = std::lower_bound(columnsBegin, columnsBegin + column, first) - columnsBegin;
+            }
+            else if (nx == x) {
+                n = column > 0 && grid.columnKeys[column - 1] >= first ? column - 1 : column;
+            }
+            else {
+                n = std::lower_bound(columnsBegin + column + 1, grid.columnKeys.end(), first) - columnsBegin;
+            }
+            for (; n < columnCount && grid.columnKeys[n] <= last; n++) {
+                cursor[neighbours] = grid.columnStart[n];
+                end[neighbours] = grid.columnStart[n + 1];
+                neighbours++;
+            }
+        }
+
+        for (uint32_t c = grid.columnStart[column]; c < grid.columnStart[column + 1]; c++) {
+            // the cells at z - 1 to z + 1 of a column are adjacent, so their points are one run
+            uint64_t z = grid.cellKeys[c] & axisMask;
+            uint32_t runBegin[9], runEnd[9];
+            for (int r = 0; r < neighbours; r++) {
+                while (cursor[r] < end[r] && (grid.cellKeys[cursor[r]] & axisMask) + 1 < z) {
+                    cursor[r]++;
+                }
+                uint32_t last = cursor[r];
+                while (last < end[r] && (grid.cellKeys[last] & axisMask) <= z + 1) {
+                    last++;
+                }
+                runBegin[r] = grid.cellStart[cursor[r]];
+                runEnd[r] = grid.cellStart[last];
+            }
+            for (uint32_t k = grid.cellStart[c]; k < grid.cellStart[c + 1]; k++) {
+                int i = grid.points[k];
+                glm::vec3 p = grid.sortedPositions[k];
+                for (int r = 0; r < neighbours; r++) {
+                    for (uint32_t m = runBegin[r]; m < runEnd[r]; m++) {
+                        glm::vec3 d = grid.sortedPositions[m] - p;
+                        if (glm::dot(d, d) <= radius2 && grid.points[m] > i) {
+                            emit(i, grid.points[m]);
+                        }
+                    }
+                }
+            }
+        }
+    };
+
+    // each chunk of columns collects its own pairs, copied out in chunk order after a prefix sum
+    size_t chunks = (columnCount + SPATIAL_GRID_COLUMN_GRAIN - 1) / SPATIAL_GRID_COLUMN_GRAIN;
+    std::vector<std::vector<std::pair<int, int>>> chunkPairs(chunks);
+    parallelFor(chunks, 1, [&](size_t chunk) {
+        size_t end = std::min(columnCount, (chunk + 1) * SPATIAL_GRID_COLUMN_GRAIN);
+        for (size_t column = chunk * SPATIAL_GRID_COLUMN_GRAIN; column < end; column++) {
+            forEachPair(column, [&](int i, int j) { chunkPairs[chunk].emplace_back(i, j); });
+        }
+    });
+    std::vector<size_t> offsets(chunks + 1, 0);
+    for (size_t chunk = 0; chunk < chunks; chunk++) {
+        offsets[chunk + 1] = offsets[chunk] + chunkPairs[chunk].size();
+    }
+
+    std::vector<std::pair<int, int>> pairs(offsets[chunks]);
+    parallelFor(chunks, 1, [&](size_t chunk) {
+        std::copy(chunkPairs[chunk].begin(), chunkPairs[chunk].end(), pairs.begin() + offsets[chunk]);
+        std::vector<std::pair<int, int>>().swap(chunkPairs[chunk]);
+    });
+    return pairs;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "parallel.h"
+#include "quantize.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// bits per axis of a Morton code, 30 bits in all
+#define MORTON_AXIS_BITS 10
+// radix sort digit width, and keys per chunk of the parallel count and scatter
+#define RADIX_SORT_BITS 8
+#define RADIX_SORT_GRAIN 65536
+
+// spread the low 10 bits of x out to every third bit
+static inline uint32_t mortonSpread(uint32_t x) {
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x30000ff;
+    x = (x | (x << 8)) & 0x300f00f;
+    x = (x | (x << 4)) & 0x30c30c3;
+    x = (x | (x << 2)) & 0x9249249;
+    return x;
+}
+
+// Morton code of every vertex on a 2^MORTON_AXIS_BITS grid over the bounds. Sorting by it walks the points
+// along a Z-order curve, so points close in space end up close in memory.
+std::vector<uint32_t> mortonCodes(const std::vector<glm::vec3> &vertices) {
+    glm::vec3 aabbMin, aabbMax;
+    computeBounds(vertices, aabbMin, aabbMax);
+    glm::vec3 extent = glm::max(aabbMax - aabbMin, glm::vec3(1e-30f));
+    const float cells = (float) ((1 << MORTON_AXIS_BITS) - 1);
+    glm::vec3 scale = glm::vec3(cells) / extent;
+    std::vector<uint32_t> codes(vertices.size());
+    parallelFor(vertices.size(), RADIX_SORT_GRAIN, [&](size_t v) {
+        glm::vec3 c = glm::clamp((vertices[v] - aabbMin) * scale, glm::vec3(0.0f), glm::vec3(cells));
+        codes[v] = mortonSpread((uint32_t) c.x) << 2 | mortonSpread((uint32_t) c.y) << 1 | mortonSpread((uint32_t) c.z);
+    });
+    return codes;
+}
+
+// Stable LSD radix sort of the indices 0..n-1 by keys[i], keyBits wide (uint32_t or uint64_t keys). Each pass
+// counts the digits of every chunk in parallel, turns the counts into per-chunk offsets (digit-major, so a
+// chunk's keys of one digit land after those of the chunks before it) and scatters the chunks in parallel. The
+// order is the same for any thread count. sortedKeysOut, when given, gets the keys in that order.
+template <typename Key>
+std::vector<uint32_t> radixSortOrder(const std::vector<Key> &keys, int keyBits,
+                                     std::vector<Key>* sortedKeysOut = nullptr) {
+    const size_t buckets = (size_t) 1 << RADIX_SORT_BITS;
+    size_t n = keys.size();
+    std::vector<uint32_t> order(n), scratchOrder(n);
+    std::vector<Key> sortedKeys(keys), scratchKeys(n);
+    parallelFor(n, RADIX_SORT_GRAIN, [&](size_t i) { order[i] = (uint32_t) i; });
+
+    size_t chunks = (n + RADIX_SORT_GRAIN - 1) / RADIX_SORT_GRAIN;
+    std::vector<size_t> offsets(chunks * buckets);
+    for (int shift = 0; shift < keyBits; shift += RADIX_SORT_BITS) {
+        parallelFor(chunks, 1, [&](size_t c) {
+            size_t* count = &offsets[c * buckets];
+            std::fill(count, count + buckets, 0);
+            for (size_t i = c * RADIX_SORT_GRAIN; i < std::min(n, (c + 1) * RADIX_SORT_GRAIN); i++) {
+                count[(sortedKeys[i] >> shift) & (buckets - 1)]++;
+            }
+        });
+        size_t sum = 0;
+        for (size_t digit = 0; digit < buckets; digit++) {
+            for (size_t c = 0; c < chunks; c++) {
+                size_t count = offsets[c * buckets + digit];
+                offsets[c * buckets + digit] = sum;
+                sum += count;
+            }
+        }
+        parallelFor(chunks, 1, [&](size_t c) {
+            size_t* next = &offsets[c * buckets];
+            for (size_t i = c * RADIX_SORT_GRAIN; i < std::min(n, (c + 1) * RADIX_SORT_GRAIN); i++) {
+                size_t to = next[(sortedKeys[i] >> shift) & (buckets - 1)]++;
+                scratchKeys[to] = sortedKeys[i];
+                scratchOrder[to] = order[i];
+            }
+        });
+        sortedKeys.swap(scratchKeys);
+        order.swap(scratchOrder);
+    }
+    if (sortedKeysOut) {
+        sortedKeysOut->swap(sortedKeys);
+    }
+    return order;
+}
+
+// Sort the vertices along a Morton curve and the faces by their lowest vertex in that order, so a pass over
+// the faces reads the vertices nearly in sequence, as loadObj()'s file order often does not. Returns the
+// old-to-new vertex table for the caller's other per-vertex streams (remapVertexStream()). Every vertex is
+// kept, referenced or not, and the winding of each face is unchanged.
+std::vector<int> reorderMeshSpatially(std::vector<glm::vec3> &vertices, std::vector<glm::ivec3> &faces) {
+    std::vector<uint32_t> vertexOrder = radixSortOrder(mortonCodes(vertices), 3 * MORTON_AXIS_BITS);
+    std::vector<int> remap(vertices.size());
+    std::vector<glm::vec3> sortedVertices(vertices.size());
+    parallelFor(vertices.size(), RADIX_SORT_GRAIN, [&](size_t i) {
+        remap[vertexOrder[i]] = (int) i;
+        sortedVertices[i] = vertices[vertexOrder[i]];
+    });
+    vertices.swap(sortedVertices);
+
+    int keyBits = 1;
+    while (keyBits < 32 && ((size_t) 1 << keyBits) < vertices.size()) {
+        keyBits++;
+    }
+    std::vector<uint32_t> faceKeys(faces.size());
+    parallelFor(faces.size(), RADIX_SORT_GRAIN, [&](size_t f) {
+        glm::ivec3 face(remap[faces[f].x], remap[faces[f].y], remap[faces[f].z]);
+        faces[f] = face;
+        faceKeys[f] = (uint32_t) std::min(face.x, std::min(face.y, face.z));
+    });
+    std::vector<uint32_t> faceOrder = radixSortOrder(faceKeys, keyBits);
+    std::vector<glm::ivec3> sortedFaces(faces.size());
+    parallelFor(faces.size(), RADIX_SORT_GRAIN, [&](size_t i) { sortedFaces[i] = faces[faceOrder[i]]; });
+    faces.swap(sortedFaces);
+    return remap;
+}
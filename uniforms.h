@@ -0,0 +1,66 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+
+// binding point of the FrameConstants block, fixed in the shaders with layout(binding = ...)
+#define FRAME_UNIFORM_BINDING 0
+
+// CPU mirror of the std140 FrameConstants block in shaders/basic.vert and basic.frag. vec3s are padded to 16
+// bytes as std140 requires, so the struct can be copied into the buffer as is.
+struct FrameConstants {
+    glm::mat4 model;
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 normalMatrix;
+    glm::vec3 lightPos;
+    float pad0;
+    glm::vec3 eyePos;
+    float pad1;
+};
+
+static_assert(offsetof(FrameConstants, lightPos) == 256, "FrameConstants does not match the std140 layout");
+static_assert(offsetof(FrameConstants, eyePos) == 272, "FrameConstants does not match the std140 layout");
+static_assert(sizeof(FrameConstants) == 288, "FrameConstants does not match the std140 layout");
+
+// Uniform buffer holding the per-frame camera and light constants. It is bound once to FRAME_UNIFORM_BINDING
+// and every program that declares the block reads from it, so a frame costs one buffer update instead of a
+// set of uniforms per program.
+class FrameUniforms {
+public:
+    FrameUniforms() {
+        glGenBuffers(1, &_ubo);
+        glBindBuffer(GL_UNIFORM_BUFFER, _ubo);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameConstants), NULL, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORM_BINDING, _ubo);
+    }
+
+    void update(const FrameConstants &constants) {
+        glBindBuffer(GL_UNIFORM_BUFFER, _ubo);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameConstants), &constants);
+    }
+
+    void deleteGLResources() {
+        glDeleteBuffers(1, &_ubo);
+        _ubo = 0;
+    }
+
+private:
+    GLuint _ubo = 0;
+};
+
+FrameConstants makeFrameConstants(const glm::mat4 &model, const glm::mat4 &view, const glm::mat4 &projection,
+                                  glm::vec3 lightPos, glm::vec3 eyePos) {
+    FrameConstants constants;
+    constants.model = model;
+    constants.view = view;
+    constants.projection = projection;
+    constants.normalMatrix = glm::inverse(glm::transpose(view * model));
+    constants.lightPos = lightPos;
+    constants.pad0 = 0.0f;
+    constants.eyePos = eyePos;
+    constants.pad1 = 0.0f;
+    return constants;
+}
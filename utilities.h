@@ -119,7 +119,10 @@ glm::vec4 computePlaneCoeffs(glm::vec3 a, glm::vec3 b, glm::vec3 c) {
     return glm::vec4(first_3, k);
 }
 
-bool loadObj (const char* path, std::vector<glm::vec3> &out_vertices, std::vector<glm::ivec3> &out_faces, std::vector<glm::vec3> &out_normals) {
+// out_colors, when given, gets the per-vertex colours of the "v x y z r g b" extension (white for vertices
+// without one), or stays empty if the file has none
+bool loadObj (const char* path, std::vector<glm::vec3> &out_vertices, std::vector<glm::ivec3> &out_faces, std::vector<glm::vec3> &out_normals,
+              std::vector<glm::vec3>* out_colors = nullptr) {
     FILE* file = fopen(path, "r");
     if (file == NULL) {
         fprintf(stderr, "Unable to open the file! \n");
@@ -127,6 +130,7 @@ bool loadObj (const char* path, std::vector<glm::vec3> &out_vertices, std::vecto
     }
 
     bool normalsInFile = false;
+    bool colorsInFile = false;
 
     // read line by line until EOF
     while (true) {
@@ -138,8 +142,16 @@ bool loadObj (const char* path, std::vector<glm::vec3> &out_vertices, std::vecto
 
         if (strcmp(lineHeader, "v") == 0) {
             glm::vec3 vertex;
-            fscanf(file, "%f %f %f\n", &vertex.x, &vertex.y, &vertex.z);
+            fscanf(file, "%f %f %f", &vertex.x, &vertex.y, &vertex.z);
             out_vertices.push_back(vertex);
+            // the rest of the line holds the colour, if any
+            char rest[256] = "";
+            fgets(rest, sizeof(rest), file);
+            glm::vec3 color(1.0f);
+            if (out_colors) {
+                colorsInFile |= sscanf(rest, "%f %f %f", &color.x, &color.y, &color.z) == 3;
+                out_colors->push_back(color);
+            }
         }
         else if (strcmp(lineHeader, "f") == 0) {
             glm::ivec3 face;
@@ -171,6 +183,9 @@ bool loadObj (const char* path, std::vector<glm::vec3> &out_vertices, std::vecto
             out_normals[i] = glm::normalize(out_normals[i]);
         }
     }
+    if (out_colors && !colorsInFile) {
+        out_colors->clear();
+    }
 
     return true;
 }
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "parallel.h"
+#include "quantize.h"
+#include "spatialgrid.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#define WELD_GRAIN 65536
+// weld grid cells per axis per square root of the vertex count. A surface of n points crosses on the order of
+// n cells when each axis has sqrt(n), so this leaves most cells with one welded vertex or none, however far
+// epsilon is below the spacing.
+#define WELD_GRID_DENSITY 4.0f
+
+// Merges the vertices within epsilon of each other, as scanners and STL exports duplicate them along seams and
+// leave the mesh in disconnected patches no edge collapse can cross. Pairs come from findClosePairs(), whose
+// grid is keyed, sorted and searched in parallel, with cells sized to the vertex count rather than to epsilon;
+// epsilon 0 merges exact duplicates only. Merging is transitive, so a chain of vertices each within epsilon of
+// the next becomes one. A group keeps its lowest numbered vertex, at that vertex's position, so the survivors
+// stay in file order. Faces are renumbered and the ones that lost a corner to the merge are dropped. Returns
+// the old-to-new table (weldVertexStream(), weldNormals()), in which every vertex of a group maps to the
+// survivor.
+std::vector<int> weldVertices(std::vector<glm::vec3> &vertices, std::vector<glm::ivec3> &faces, float epsilon) {
+    glm::vec3 aabbMin, aabbMax;
+    computeBounds(vertices, aabbMin, aabbMax);
+    glm::vec3 extent = aabbMax - aabbMin;
+    float cellSize = std::max(extent.x, std::max(extent.y, extent.z)) /
+                     (WELD_GRID_DENSITY * std::sqrt((float) std::max<size_t>(vertices.size(), 1)));
+    std::vector<std::pair<int, int>> pairs = findClosePairs(vertices, epsilon, nullptr, cellSize);
+
+    // union-find over the pairs, always linking to the lower root so every group's root is its lowest vertex
+    std::vector<int> parent(vertices.size());
+    parallelFor(vertices.size(), WELD_GRAIN, [&](size_t v) { parent[v] = (int) v; });
+    auto find = [&](int v) {
+        while (parent[v] != v) {
+            parent[v] = parent[parent[v]];
+            v = parent[v];
+        }
+        return v;
+    };
+    for (const std::pair<int, int> &pair : pairs) {
+        int a = find(pair.first), b = find(pair.second);
+        if (a != b) {
+            parent[std::max(a, b)] = std::min(a, b);
+        }
+    }
+
+    // a root comes before the rest of its group, so one pass in order settles every vertex on its root and
+    // numbers the roots
+    std::vector<int> remap(vertices.size());
+    int count = 0;
+    for (size_t v = 0; v < vertices.size(); v++) {
+        int root = parent[parent[v]];
+        parent[v] = root;
+        remap[v] = root == (int) v ? count++ : remap[root];
+    }
+
+    std::vector<glm::vec3> welded(count);
+    parallelFor(vertices.size(), WELD_GRAIN, [&](size_t v) {
+        if (parent[v] == (int) v) {
+            welded[remap[v]] = vertices[v];
+        }
+    });
+    vertices.swap(welded);
+
+    std::vector<uint8_t> keep(faces.size());
+    parallelFor(faces.size(), WELD_GRAIN, [&](size_t f) {
+        glm::ivec3 face(remap[faces[f].x], remap[faces[f].y], remap[faces[f].z]);
+        faces[f] = face;
+        keep[f] = face.x != face.y && face.y != face.z && face.z != face.x;
+    });
+    size_t kept = 0;
+    for (size_t f = 0; f < faces.size(); f++) {
+        if (keep[f]) {
+            faces[kept++] = faces[f];
+        }
+    }
+    faces.resize(kept);
+    return remap;
+}
+
+// Applies weldVertices()'s table to another per-vertex stream, keeping each group's survivor's value. The
+// survivors are numbered in order, so a vertex survives where its new index is the next one.
+template <typename T>
+void weldVertexStream(std::vector<T> &stream, const std::vector<int> &remap) {
+    std::vector<T> result;
+    for (size_t v = 0; v < remap.size() && v < stream.size(); v++) {
+        if ((size_t) remap[v] == result.size()) {
+            result.push_back(stream[v]);
+        }
+    }
+    stream.swap(result);
+}
+
+// Welded normals are the normalized sum of the group's, so a seam shades smoothly across the join. A group
+// whose normals cancel out keeps the survivor's.
+void weldNormals(std::vector<glm::vec3> &normals, const std::vector<int> &remap) {
+    std::vector<glm::vec3> survivors(normals);
+    weldVertexStream(survivors, remap);
+    std::vector<glm::vec3> sums(survivors.size(), glm::vec3(0.0f));
+    for (size_t v = 0; v < remap.size() && v < normals.size(); v++) {
+        sums[remap[v]] += normals[v];
+    }
+    parallelFor(sums.size(), WELD_GRAIN, [&](size_t v) {
+        float length = glm::length(sums[v]);
+        if (length > 0.0f) {
+            survivors[v] = sums[v] / length;
+        }
+    });
+    normals.swap(survivors);
+}